@@ -0,0 +1,37 @@
+/*
+  Contador de alocações pro bench/run.sh (LD_PRELOAD, glibc).
+  Conta malloc/calloc/realloc e, na saída do processo, escreve
+  "allocs N bytes B peak_rss_kb K" em $KC_ALLOC_OUT (ou no stderr).
+
+    cc -shared -fPIC -O2 bench/alloc_count.c -o alloc_count.so
+    KC_ALLOC_OUT=allocs.txt LD_PRELOAD=./alloc_count.so ./koalcode script.kc
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static unsigned long g_allocs, g_bytes;
+
+static void count(size_t size) {
+    __atomic_fetch_add(&g_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) { count(size); return __libc_malloc(size); }
+void *calloc(size_t n, size_t size) { count(n * size); return __libc_calloc(n, size); }
+void *realloc(void *p, size_t size) { count(size); return __libc_realloc(p, size); }
+
+__attribute__((destructor)) static void alloc_report(void) {
+    unsigned long allocs = g_allocs, bytes = g_bytes;   /* antes do fopen alocar */
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    const char *path = getenv("KC_ALLOC_OUT");
+    FILE *f = path ? fopen(path, "w") : NULL;
+    fprintf(f ? f : stderr, "allocs %lu bytes %lu peak_rss_kb %ld\n", allocs, bytes, ru.ru_maxrss);
+    if (f) fclose(f);
+}
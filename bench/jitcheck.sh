@@ -0,0 +1,39 @@
+#!/bin/sh
+# Teste diferencial do JIT: cada bench/jit/*.kc roda com e sem KC_FLAGS e
+# stdout, stderr e status de saída têm que ser idênticos. Os casos cobrem o
+# que os workloads do run.sh não pegam: recursão, return de dentro de while,
+# nós que voltam pro interpretador e erro de runtime em código compilado.
+#
+# uso: bench/jitcheck.sh [caso ...]                      (padrão: todos)
+#      KOALCODE=./koalcode KC_FLAGS=--jit bench/jitcheck.sh
+#
+# Uma linha por caso no stderr; status 1 no fim se algum diferir.
+
+KC=${KOALCODE:-./koalcode}
+DIR=$(cd "$(dirname "$0")" && pwd)
+FLAGS=${KC_FLAGS:---jit}
+FAIL=0
+TMP=${TMPDIR:-/tmp}/kc_jitcheck.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+[ $# -gt 0 ] || set -- $(cd "$DIR/jit" && ls *.kc | sed 's/\.kc$//')
+
+for name in "$@"; do
+    [ -f "$DIR/jit/$name.kc" ] || { printf '%-12s no bench/jit/%s.kc\n' "$name" "$name" >&2; FAIL=1; continue; }
+    # roda de dentro de bench/jit: o nome do arquivo nas mensagens de erro fica igual
+    (cd "$DIR/jit" && "$KC" "$name.kc" > "$TMP/ref.out" 2> "$TMP/ref.err" < /dev/null; echo $? > "$TMP/ref.st")
+    (cd "$DIR/jit" && "$KC" $FLAGS "$name.kc" > "$TMP/jit.out" 2> "$TMP/jit.err" < /dev/null; echo $? > "$TMP/jit.st")
+    bad=
+    for f in out err st; do
+        cmp -s "$TMP/ref.$f" "$TMP/jit.$f" || bad="$bad $f"
+    done
+    if [ -n "$bad" ]; then
+        printf '%-12s differs with %s:%s\n' "$name" "$FLAGS" "$bad" >&2
+        for f in $bad; do diff "$TMP/ref.$f" "$TMP/jit.$f" | head -n 10 >&2; done
+        FAIL=1
+    else
+        printf '%-12s ok (status %s)\n' "$name" "$(cat "$TMP/jit.st")" >&2
+    fi
+done
+exit $FAIL
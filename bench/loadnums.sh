@@ -0,0 +1,39 @@
+#!/bin/sh
+# Benchmark: io.loadnums (mmap + parser rápido em paralelo) contra o caminho
+# com strtod (file.readline + file.linenum, um número por linha).
+#
+# uso: bench/loadnums.sh [quantidade_de_numeros]
+#      KOALCODE=./koalcode bench/loadnums.sh 5000000
+
+N=${1:-2000000}
+KC=${KOALCODE:-./koalcode}
+TMP=${TMPDIR:-/tmp}/kc_loadnums.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v n="$N" 'BEGIN { srand(42); for (i = 0; i < n; i++) printf "%.6f\n", (rand() - 0.5) * 2e6 }' > "$TMP/nums.txt"
+
+cat > "$TMP/fast.kc" <<KC
+b = io.loadnums("$TMP/nums.txt")
+print("fast", buf.len(b), buf.sum(b))
+KC
+
+cat > "$TMP/strtod.kc" <<KC
+h = file.open("$TMP/nums.txt")
+n = 0
+s = 0
+while file.readline(h) >= 0 {
+    s += file.linenum(h)
+    n += 1
+}
+print("strtod", n, s)
+KC
+
+now_ms() { echo $(( $(date +%s%N) / 1000000 )); }
+
+for mode in fast strtod; do
+    t0=$(now_ms)
+    "$KC" "$TMP/$mode.kc" || exit 1
+    t1=$(now_ms)
+    echo "$mode: $N numbers in $((t1 - t0)) ms"
+done
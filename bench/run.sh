@@ -0,0 +1,123 @@
+#!/bin/sh
+# Suite de benchmarks do interpretador. Uma linha JSON por workload no stdout
+# (pra guardar e comparar entre commits) e um resumo legível no stderr.
+#
+# uso: bench/run.sh [workload ...]                      (padrão: todos)
+#      KOALCODE=./koalcode REPS=5 bench/run.sh > resultado.jsonl
+#      KC_FLAGS=--jit CHECK=1 bench/run.sh                 (teste diferencial)
+#
+# workloads: arith fib vars hash kernels memlimit lexer parse http triangles
+#   lexer      bench/lexer.kc repetido até LEXER_KB (padrão 2048) KB; ops = bytes do fonte
+#   parse      bench/parse.kc (só expressões) repetido até PARSE_KB (padrão 2048) KB; idem
+#   http       sobe um python3 -m http.server em 127.0.0.1:$HTTP_PORT (padrão 8765)
+#   triangles  roda com KOALCODE_HEADLESS=1 (binário compilado com -DKC_WITH_EGL)
+#
+# ns_per_op = menor tempo de parede em REPS execuções / "ops N" que o script imprime.
+# allocs, alloc_bytes e peak_rss_kb vêm de uma execução extra com bench/alloc_count.c
+# (LD_PRELOAD; precisa de cc e glibc). Workload que não dá pra rodar sai com "skipped".
+# KC_FLAGS vai pra linha de comando do koalcode em toda execução; com CHECK=1
+# cada workload roda mais uma vez sem KC_FLAGS e a saída tem que ser idêntica
+# (status 1 no fim se alguma diferir).
+
+KC=${KOALCODE:-./koalcode}
+DIR=$(cd "$(dirname "$0")" && pwd)
+REPS=${REPS:-3}
+FLAGS=${KC_FLAGS:-}
+FAIL=0
+PORT=${HTTP_PORT:-8765}
+TMP=${TMPDIR:-/tmp}/kc_bench.$$
+SRV=
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"; [ -n "$SRV" ] && kill "$SRV" 2>/dev/null' EXIT
+
+COMMIT=$(git -C "$DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+ALLOC_SO="$TMP/alloc_count.so"
+${CC:-cc} -shared -fPIC -O2 "$DIR/alloc_count.c" -o "$ALLOC_SO" 2>/dev/null || ALLOC_SO=
+
+[ $# -gt 0 ] || set -- arith fib vars hash kernels memlimit lexer parse http triangles
+
+now_ns() { date +%s%N; }
+
+skip() {
+    printf '{"bench":"%s","commit":"%s","skipped":"%s"}\n' "$1" "$COMMIT" "$2"
+    printf '%-10s skipped (%s)\n' "$1" "$2" >&2
+}
+
+# monta $TMP/<nome>.kc e BENV (variáveis de ambiente da execução); != 0 = não roda aqui
+prepare() {
+    BENV=
+    case "$1" in
+        lexer|parse)
+            [ "$1" = lexer ] && kb=${LEXER_KB:-2048} || kb=${PARSE_KB:-2048}
+            reps=$(( kb * 1024 / $(wc -c < "$DIR/$1.kc") + 1 ))
+            awk -v n="$reps" '{ l[NR] = $0 } END { for (i = 0; i < n; i++) for (j = 1; j <= NR; j++) print l[j] }' \
+                "$DIR/$1.kc" > "$TMP/$1.kc"
+            echo "print(\"ops\", $(wc -c < "$TMP/$1.kc"))" >> "$TMP/$1.kc"
+            ;;
+        http)
+            command -v python3 >/dev/null || { REASON="python3 not found"; return 1; }
+            if [ -z "$SRV" ]; then
+                mkdir -p "$TMP/www" && echo "ok" > "$TMP/www/small.txt"
+                (cd "$TMP/www" && exec python3 -m http.server "$PORT" --bind 127.0.0.1) >/dev/null 2>&1 &
+                SRV=$!
+                sleep 1
+            fi
+            sed "s/127\.0\.0\.1:8765/127.0.0.1:$PORT/" "$DIR/http.kc" > "$TMP/http.kc"
+            ;;
+        triangles)
+            BENV=KOALCODE_HEADLESS=1
+            cp "$DIR/triangles.kc" "$TMP/triangles.kc"
+            ;;
+        *)
+            [ -f "$DIR/$1.kc" ] || { REASON="no bench/$1.kc"; return 1; }
+            cp "$DIR/$1.kc" "$TMP/$1.kc"
+            ;;
+    esac
+}
+
+for name in "$@"; do
+    REASON=
+    prepare "$name" || { skip "$name" "$REASON"; continue; }
+    script="$TMP/$name.kc"
+
+    best=
+    r=0
+    while [ $r -lt "$REPS" ]; do
+        t0=$(now_ns)
+        env $BENV "$KC" $FLAGS "$script" > "$TMP/out" 2> "$TMP/err" || break
+        t1=$(now_ns)
+        ns=$((t1 - t0))
+        [ -z "$best" ] || [ "$ns" -lt "$best" ] && best=$ns
+        r=$((r + 1))
+    done
+    ops=$(awk '$1 == "ops" { o = $2 } END { printf "%.0f", o + 0 }' "$TMP/out")
+    if [ $r -lt "$REPS" ] || [ "$ops" = 0 ]; then
+        skip "$name" "$(head -c 200 "$TMP/err" | tr '\n"\\' '   ')"
+        continue
+    fi
+
+    allocs=null bytes=null rss=null
+    if [ -n "$ALLOC_SO" ]; then
+        env $BENV KC_ALLOC_OUT="$TMP/alloc" LD_PRELOAD="$ALLOC_SO" "$KC" $FLAGS "$script" > /dev/null 2>&1
+        if [ -s "$TMP/alloc" ]; then
+            read -r _ allocs _ bytes _ rss < "$TMP/alloc"
+        fi
+        rm -f "$TMP/alloc"
+    fi
+
+    if [ -n "$CHECK" ]; then
+        env $BENV "$KC" "$script" > "$TMP/ref" 2> /dev/null
+        if ! cmp -s "$TMP/ref" "$TMP/out"; then
+            printf '%-10s output differs without KC_FLAGS:\n' "$name" >&2
+            diff "$TMP/ref" "$TMP/out" | head -n 10 >&2
+            FAIL=1
+        fi
+    fi
+
+    nsop=$(awk -v t="$best" -v n="$ops" 'BEGIN { printf "%.1f", t / n }')
+    ms=$(awk -v t="$best" 'BEGIN { printf "%.2f", t / 1e6 }')
+    printf '{"bench":"%s","commit":"%s","reps":%d,"ops":%s,"best_ms":%s,"ns_per_op":%s,"allocs":%s,"alloc_bytes":%s,"peak_rss_kb":%s}\n' \
+        "$name" "$COMMIT" "$REPS" "$ops" "$ms" "$nsop" "$allocs" "$bytes" "$rss"
+    printf '%-10s %10s ns/op  %9s ms  %10s allocs  %8s KB rss\n' "$name" "$nsop" "$ms" "$allocs" "$rss" >&2
+done
+exit $FAIL
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Benchmark de tempo de frame do bench/triangles.kc (9800 triângulos x 300 frames).
+# Para medir no renderizador por software do Mesa (llvmpipe):
+#      LIBGL_ALWAYS_SOFTWARE=1 bench/triangles.sh
+# Sem display (máquina de CI), com um binário compilado com -DKC_WITH_EGL:
+#      KOALCODE_HEADLESS=1 bench/triangles.sh
+#
+# uso: KOALCODE=./koalcode bench/triangles.sh
+
+KC=${KOALCODE:-./koalcode}
+DIR=$(dirname "$0")
+FRAMES=300
+
+now_ms() { echo $(( $(date +%s%N) / 1000000 )); }
+
+t0=$(now_ms)
+"$KC" "$DIR/triangles.kc" || exit 1
+t1=$(now_ms)
+ms=$((t1 - t0))
+echo "triangles: $FRAMES frames in $ms ms ($(awk -v t="$ms" -v f="$FRAMES" 'BEGIN { printf "%.2f", t / f }') ms/frame)"
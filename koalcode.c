@@ -3,6 +3,7 @@
 */
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,26 +11,294 @@
 #include <ctype.h>
 #include <math.h>
 #include <stdint.h>
+#include <stddef.h>
+#ifndef KC_NO_GRAPHICS
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <GL/gl.h>
+#endif
 #include <pthread.h>
 #include <unistd.h>
+#ifndef KC_NO_NETWORK
 #include <curl/curl.h>
+#endif
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KC_SSE2 1
+#endif
+#ifdef KC_NO_GRAPHICS
+#undef KC_WITH_EGL
+#endif
+#ifdef KC_WITH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#if !defined(KC_LINK_LIBS) && !defined(_WIN32)
+#define KC_DLOPEN 1
+#include <dlfcn.h>
+#endif
+/* --jit gera código de máquina direto: só System V x86-64 (seção 7b) */
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(KC_NO_JIT)
+#define KC_JIT 1
+#endif
+
+#define KC_VERSION "1.0"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* SDL/GL/curl só entram no processo no primeiro graphics.* / network.init: script
+   que só faz conta não paga o carregamento nem precisa das bibliotecas instaladas.
+   -DKC_LINK_LIBS linka direto (como era antes); -DKC_NO_GRAPHICS / -DKC_NO_NETWORK
+   tiram o subsistema do binário. */
+#if defined(KC_DLOPEN) && (!defined(KC_NO_GRAPHICS) || !defined(KC_NO_NETWORK))
+static char g_dl_error[256];
+
+static void *kc_dl_open(const char *soname) {
+    void *lib = dlopen(soname, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) snprintf(g_dl_error, sizeof g_dl_error, "%s", dlerror());
+    return lib;
+}
+
+static int kc_dl_missing(const char *sym) {
+    snprintf(g_dl_error, sizeof g_dl_error, "missing symbol %s", sym);
+    return 0;
+}
+
+static const char *kc_load_error(void) { return g_dl_error; }
+
+#define KC_DL_DECLARE(fn) static __typeof__(fn) *kc_dl_##fn;
+#define KC_DL_RESOLVE(fn) if (!(*(void **)&kc_dl_##fn = dlsym(lib, #fn))) return kc_dl_missing(#fn);
+#endif
+
+#ifndef KC_NO_GRAPHICS
+#ifdef KC_DLOPEN
+/* nomes das bibliotecas (dá pra trocar com -DKC_SDL_LIB=\"...\" etc.) */
+#ifndef KC_SDL_LIB
+#define KC_SDL_LIB   "libSDL2-2.0.so.0"
+#endif
+#ifndef KC_IMG_LIB
+#define KC_IMG_LIB   "libSDL2_image-2.0.so.0"
+#endif
+#ifndef KC_GL_LIB
+#define KC_GL_LIB    "libGL.so.1"
+#endif
+#ifndef KC_EGL_LIB
+#define KC_EGL_LIB   "libEGL.so.1"
+#endif
+
+#define KC_SDL_FUNCS(X) \
+    X(SDL_Init) X(SDL_Quit) X(SDL_GetError) X(SDL_PollEvent) X(SDL_CreateWindow) X(SDL_DestroyWindow) \
+    X(SDL_FreeSurface) X(SDL_ConvertSurfaceFormat) X(SDL_GL_SetAttribute) X(SDL_GL_CreateContext) \
+    X(SDL_GL_DeleteContext) X(SDL_GL_SetSwapInterval) X(SDL_GL_SwapWindow) X(SDL_GL_GetProcAddress)
+#define KC_IMG_FUNCS(X) X(IMG_Load)
+#define KC_GL_FUNCS(X) \
+    X(glBindTexture) X(glClear) X(glClearColor) X(glColor3f) X(glColor3fv) X(glColorPointer) \
+    X(glDeleteTextures) X(glDisable) X(glDisableClientState) X(glDrawArrays) X(glDrawElements) \
+    X(glEnable) X(glEnableClientState) X(glFrustum) X(glGenTextures) X(glGetString) X(glLoadIdentity) \
+    X(glLoadMatrixd) X(glMatrixMode) X(glMultMatrixd) X(glNormalPointer) X(glPixelStorei) \
+    X(glReadPixels) X(glRotatef) X(glTexCoordPointer) X(glTexImage2D) X(glTexParameteri) \
+    X(glTranslatef) X(glVertexPointer) X(glViewport)
+#ifdef KC_WITH_EGL
+#define KC_EGL_FUNCS(X) \
+    X(eglBindAPI) X(eglChooseConfig) X(eglCreateContext) X(eglCreatePbufferSurface) X(eglDestroyContext) \
+    X(eglDestroySurface) X(eglGetDisplay) X(eglGetError) X(eglGetProcAddress) X(eglInitialize) \
+    X(eglMakeCurrent) X(eglSwapBuffers) X(eglSwapInterval) X(eglTerminate)
+#else
+#define KC_EGL_FUNCS(X)
+#endif
+
+KC_SDL_FUNCS(KC_DL_DECLARE)
+KC_IMG_FUNCS(KC_DL_DECLARE)
+KC_GL_FUNCS(KC_DL_DECLARE)
+KC_EGL_FUNCS(KC_DL_DECLARE)
+
+static int g_gfx_libs = 0;   /* 1 carregadas, -1 falhou (não tenta de novo) */
+
+static int kc_load_graphics(void) {
+    void *lib;
+    if (g_gfx_libs) return g_gfx_libs > 0;
+    g_gfx_libs = -1;
+    if (!(lib = kc_dl_open(KC_SDL_LIB))) return 0;
+    KC_SDL_FUNCS(KC_DL_RESOLVE)
+    if (!(lib = kc_dl_open(KC_IMG_LIB))) return 0;
+    KC_IMG_FUNCS(KC_DL_RESOLVE)
+    if (!(lib = kc_dl_open(KC_GL_LIB))) return 0;
+    KC_GL_FUNCS(KC_DL_RESOLVE)
+#ifdef KC_WITH_EGL
+    if (!(lib = kc_dl_open(KC_EGL_LIB))) return 0;
+    KC_EGL_FUNCS(KC_DL_RESOLVE)
+#endif
+    g_gfx_libs = 1;
+    return 1;
+}
+
+/* daqui pra baixo as chamadas vão pelos ponteiros resolvidos acima */
+#define SDL_Init                 kc_dl_SDL_Init
+#define SDL_Quit                 kc_dl_SDL_Quit
+#define SDL_GetError             kc_dl_SDL_GetError
+#define SDL_PollEvent            kc_dl_SDL_PollEvent
+#define SDL_CreateWindow         kc_dl_SDL_CreateWindow
+#define SDL_DestroyWindow        kc_dl_SDL_DestroyWindow
+#define SDL_FreeSurface          kc_dl_SDL_FreeSurface
+#define SDL_ConvertSurfaceFormat kc_dl_SDL_ConvertSurfaceFormat
+#define SDL_GL_SetAttribute      kc_dl_SDL_GL_SetAttribute
+#define SDL_GL_CreateContext     kc_dl_SDL_GL_CreateContext
+#define SDL_GL_DeleteContext     kc_dl_SDL_GL_DeleteContext
+#define SDL_GL_SetSwapInterval   kc_dl_SDL_GL_SetSwapInterval
+#define SDL_GL_SwapWindow        kc_dl_SDL_GL_SwapWindow
+#define SDL_GL_GetProcAddress    kc_dl_SDL_GL_GetProcAddress
+#define IMG_Load                 kc_dl_IMG_Load
+#define glBindTexture            kc_dl_glBindTexture
+#define glClear                  kc_dl_glClear
+#define glClearColor             kc_dl_glClearColor
+#define glColor3f                kc_dl_glColor3f
+#define glColor3fv               kc_dl_glColor3fv
+#define glColorPointer           kc_dl_glColorPointer
+#define glDeleteTextures         kc_dl_glDeleteTextures
+#define glDisable                kc_dl_glDisable
+#define glDisableClientState     kc_dl_glDisableClientState
+#define glDrawArrays             kc_dl_glDrawArrays
+#define glDrawElements           kc_dl_glDrawElements
+#define glEnable                 kc_dl_glEnable
+#define glEnableClientState      kc_dl_glEnableClientState
+#define glFrustum                kc_dl_glFrustum
+#define glGenTextures            kc_dl_glGenTextures
+#define glGetString              kc_dl_glGetString
+#define glLoadIdentity           kc_dl_glLoadIdentity
+#define glLoadMatrixd            kc_dl_glLoadMatrixd
+#define glMatrixMode             kc_dl_glMatrixMode
+#define glMultMatrixd            kc_dl_glMultMatrixd
+#define glNormalPointer          kc_dl_glNormalPointer
+#define glPixelStorei            kc_dl_glPixelStorei
+#define glReadPixels             kc_dl_glReadPixels
+#define glRotatef                kc_dl_glRotatef
+#define glTexCoordPointer        kc_dl_glTexCoordPointer
+#define glTexImage2D             kc_dl_glTexImage2D
+#define glTexParameteri          kc_dl_glTexParameteri
+#define glTranslatef             kc_dl_glTranslatef
+#define glVertexPointer          kc_dl_glVertexPointer
+#define glViewport               kc_dl_glViewport
+#ifdef KC_WITH_EGL
+#define eglBindAPI               kc_dl_eglBindAPI
+#define eglChooseConfig          kc_dl_eglChooseConfig
+#define eglCreateContext         kc_dl_eglCreateContext
+#define eglCreatePbufferSurface  kc_dl_eglCreatePbufferSurface
+#define eglDestroyContext        kc_dl_eglDestroyContext
+#define eglDestroySurface        kc_dl_eglDestroySurface
+#define eglGetDisplay            kc_dl_eglGetDisplay
+#define eglGetError              kc_dl_eglGetError
+#define eglGetProcAddress        kc_dl_eglGetProcAddress
+#define eglInitialize            kc_dl_eglInitialize
+#define eglMakeCurrent           kc_dl_eglMakeCurrent
+#define eglSwapBuffers           kc_dl_eglSwapBuffers
+#define eglSwapInterval          kc_dl_eglSwapInterval
+#define eglTerminate             kc_dl_eglTerminate
+#endif
+#else
+static int g_gfx_libs = 1;
+static int kc_load_graphics(void) { return 1; }
+#endif
+#endif /* KC_NO_GRAPHICS */
+
+#ifndef KC_NO_NETWORK
+#ifdef KC_DLOPEN
+#ifndef KC_CURL_LIB
+#define KC_CURL_LIB "libcurl.so.4"
+#endif
+/* curl.h embrulha setopt/getinfo em macros (checagem de tipo); aqui viram ponteiros */
+#undef curl_easy_setopt
+#undef curl_easy_getinfo
+
+#define KC_CURL_FUNCS(X) \
+    X(curl_global_init) X(curl_global_cleanup) X(curl_easy_init) X(curl_easy_cleanup) \
+    X(curl_easy_setopt) X(curl_easy_getinfo) X(curl_easy_perform) X(curl_easy_strerror)
+
+KC_CURL_FUNCS(KC_DL_DECLARE)
+
+static int g_net_libs = 0;
+
+static int kc_load_network(void) {
+    void *lib;
+    if (g_net_libs) return g_net_libs > 0;
+    g_net_libs = -1;
+    if (!(lib = kc_dl_open(KC_CURL_LIB))) return 0;
+    KC_CURL_FUNCS(KC_DL_RESOLVE)
+    g_net_libs = 1;
+    return 1;
+}
+
+#define curl_global_init    kc_dl_curl_global_init
+#define curl_global_cleanup kc_dl_curl_global_cleanup
+#define curl_easy_init      kc_dl_curl_easy_init
+#define curl_easy_cleanup   kc_dl_curl_easy_cleanup
+#define curl_easy_setopt    kc_dl_curl_easy_setopt
+#define curl_easy_getinfo   kc_dl_curl_easy_getinfo
+#define curl_easy_perform   kc_dl_curl_easy_perform
+#define curl_easy_strerror  kc_dl_curl_easy_strerror
+#else
+static int kc_load_network(void) { return 1; }
+#endif
+#endif /* KC_NO_NETWORK */
+
+#if !defined(KC_DLOPEN) && (!defined(KC_NO_GRAPHICS) || !defined(KC_NO_NETWORK))
+static const char *kc_load_error(void) { return "not available"; }
+#endif
 
-typedef struct { GLuint texture_id; char *filename; int width, height; } Texture;
+#ifndef KC_NO_GRAPHICS
+/* entrada do cache de texturas: decodificada numa thread, enviada pro GL na thread de render */
+enum { TEX_LOADING, TEX_DECODED, TEX_READY, TEX_FAILED };
+typedef struct {
+    GLuint texture_id;
+    char *filename;
+    int width, height;
+    uint64_t hash;
+    int refcount;
+    int state;              /* TEX_LOADING, TEX_DECODED, TEX_READY, TEX_FAILED */
+    SDL_Surface *surface;   /* RGBA32 esperando upload */
+    size_t bytes;           /* memória de GPU estimada (com mipmaps) */
+    uint64_t last_used;
+} Texture;
 typedef struct { float x,y,z; } Vertex3D;
-typedef struct { int v1,v2,v3; float u1,vt1,u2,vt2,u3,vt3; } Face3D;
-typedef struct { Vertex3D *vertices; Face3D *faces; int vertex_count, face_count; char *filename; GLuint texture_id; } Model3D;
+/* malha indexada: verts intercalados pos(3) normal(3) uv(2), liberados depois de subir pro VBO */
+typedef struct {
+    float *verts;
+    GLuint *indices;
+    int vertex_count, index_count;
+    int has_normals, has_uvs;
+    char *filename;
+    GLuint texture_id;
+    GLuint vbo, ibo;
+} Model3D;
+#define KC_MODEL_STRIDE 8
 
 static SDL_Window *g_sdl_window = NULL;
 static SDL_GLContext g_gl_context = NULL;
@@ -37,9 +306,48 @@ static int g_graphics_initialized = 0;
 static int g_window_width = 800;
 static int g_window_height = 600;
 
+/* GL 1.5+ (buffer objects) vem por ponteiro: gl.h só garante o 1.1 */
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER          0x8892
+#define GL_ELEMENT_ARRAY_BUFFER  0x8893
+#define GL_STATIC_DRAW           0x88E4
+#define GL_READ_ONLY             0x88B8
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER     0x88EB
+#define GL_STREAM_READ           0x88E1
+#endif
+static void (APIENTRY *kc_glGenBuffers)(GLsizei, GLuint *);
+static void (APIENTRY *kc_glDeleteBuffers)(GLsizei, const GLuint *);
+static void (APIENTRY *kc_glBindBuffer)(GLenum, GLuint);
+static void (APIENTRY *kc_glBufferData)(GLenum, ptrdiff_t, const void *, GLenum);
+static void *(APIENTRY *kc_glMapBuffer)(GLenum, GLenum);
+static GLboolean (APIENTRY *kc_glUnmapBuffer)(GLenum);
+
+#define KC_GL_PROC(getproc, var, name) (*(void **)&(var) = (getproc)(name))
+
+static void gl_load_procs(void *(*getproc)(const char *)) {
+    KC_GL_PROC(getproc, kc_glGenBuffers, "glGenBuffers");
+    KC_GL_PROC(getproc, kc_glDeleteBuffers, "glDeleteBuffers");
+    KC_GL_PROC(getproc, kc_glBindBuffer, "glBindBuffer");
+    KC_GL_PROC(getproc, kc_glBufferData, "glBufferData");
+    KC_GL_PROC(getproc, kc_glMapBuffer, "glMapBuffer");
+    KC_GL_PROC(getproc, kc_glUnmapBuffer, "glUnmapBuffer");
+}
+
+static int gl_has_buffers(void) {
+    return kc_glGenBuffers && kc_glDeleteBuffers && kc_glBindBuffer && kc_glBufferData;
+}
+#endif /* KC_NO_GRAPHICS */
+
+#ifndef KC_NO_NETWORK
 /* Global network */
 static CURL *g_curl_handle = NULL;
 static int g_network_initialized = 0;
+#endif
 
 /* Network connection structures */
 typedef struct {
@@ -76,12 +384,6 @@ typedef enum {
     TT_EOF
 } TokenType;
 
-typedef struct {
-    TokenType type;
-    char *lexeme;        /* NULL para números */
-    double num;          /* válido somente se type == TT_NUMBER */
-} Token;
-
 typedef enum {
     OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
     OP_POW,
@@ -101,6 +403,15 @@ typedef enum {
     OP_UNKNOWN
 } OpCode;
 
+typedef struct {
+    TokenType type;
+    char *lexeme;        /* NULL para números */
+    double num;          /* válido somente se type == TT_NUMBER */
+    int line, col, len;  /* posição no fonte (1-based) e tamanho em bytes */
+    OpCode op;           /* operador binário (tabela do parser); OP_UNKNOWN se não for */
+} Token;
+
+
 typedef enum {
     NODE_BINARY,
     NODE_UNARY,
@@ -114,11 +425,17 @@ typedef enum {
     NODE_IF,
     NODE_THREAD_START,
     NODE_FUNC_DECL,   /* declaração de função com o nome  'fuktion' */
-    NODE_RETURN  
+    NODE_RETURN,
+    NODE_INVARIANT,   /* só do otimizador (3b): expressão que não muda dentro do laço */
+    NODE_INT_EXPR,    /* só do otimizador (3b): conta inteira, avaliada em int64 (num_eval) */
+    NODE_VAR_NUM,     /* só do otimizador (3b): `var op número`, mesmo layout de bin */
+    NODE_VAR_VAR,     /* só do otimizador (3b): `var op var` */
+    NODE_INC          /* só do otimizador (3b): `x = x + número` / `x = x - número` */
 } NodeType;
 
 typedef struct Node {
     NodeType type;
+    uint32_t id;         /* índice em g_spans (posição no fonte); 0 = sem posição */
     union {
         struct { struct Node *left; struct Node *right; OpCode op; } bin;
         struct { OpCode op; struct Node *operand; } unary;
@@ -129,6 +446,8 @@ typedef struct Node {
             char *func_name;
             struct Node **args;
             size_t nargs;
+            int stat_id;          /* 6h: índice em g_stat_names, 0 = ainda não resolvido */
+            struct FuncEntry *fe_cache;   /* última fuktion resolvida aqui (ver seção 5) */
         } call;
         struct {
             char *class_name;
@@ -140,7 +459,20 @@ typedef struct Node {
         struct {
             struct Node *cond;
             struct Node *body;
+            struct Node *incr;    /* 3b: laço contado, o `i + k` do fim do corpo; NULL = genérico */
+            uint64_t epoch;       /* muda na entrada e na saída: invalida os NODE_INVARIANT */
         } while_node;
+        struct {
+            struct Node *expr;
+            struct Node *loop;
+            double value;
+            int64_t ival;         /* valor exato quando expr é NODE_INT_EXPR e deu inteiro (is_int) */
+            int is_int;
+            uint64_t epoch;       /* == loop->epoch: value vale */
+        } inv;
+        struct {
+            struct Node *expr;
+        } int_expr;
         struct {
             struct Node *cond;
             struct Node *then_body;
@@ -152,6 +484,7 @@ typedef struct Node {
             char **params;
             size_t nparams;
             struct Node *body; /* bloco */
+            uint32_t stack_max;   /* 3b: profundidade máxima da pilha no corpo */
         } func_decl;
         struct {
             struct Node *expr;
@@ -160,6 +493,89 @@ typedef struct Node {
     } data;
 } Node;
 
+/* posições ficam numa tabela à parte, indexada por Node.id: o Node não cresce
+   e o laço do interpretador nunca toca nelas (só erro e --profile) */
+typedef struct { uint32_t line; uint16_t col, len; } SrcSpan;
+
+static SrcSpan *g_spans = NULL;
+static uint32_t g_nspans = 0, g_spans_cap = 0;
+
+static SrcSpan node_span(const Node *n) {
+    return n && n->id < g_nspans ? g_spans[n->id] : (SrcSpan){ 0, 0, 0 };
+}
+
+static SrcSpan tok_span(Token t) {
+    return (SrcSpan){ (uint32_t)t.line, (uint16_t)(t.col > 65535 ? 65535 : t.col),
+                      (uint16_t)(t.len > 65535 ? 65535 : t.len) };
+}
+
+/* erros de parse/runtime: mensagem com arquivo:linha:coluna, trecho do fonte e
+   a pilha de chamadas, depois longjmp pro parse_source/run_program, que
+   devolvem erro pro main (ou pro filho do --serve) em vez de exit no meio. */
+#define KC_TRACE_DEPTH 64
+
+static Node *volatile g_cur_node = NULL;     /* nó em execução (exec_node/exec_expr) */
+static Node *g_call_sites[KC_TRACE_DEPTH];   /* chamadas de fuktion em andamento */
+static int g_call_depth = 0;
+static jmp_buf *g_error_jmp = NULL;
+static const char *g_script_name = "script";
+static const char *g_source = NULL;          /* pra mostrar a linha do erro, se ainda existe */
+
+static void kc_print_span(SrcSpan sp) {
+    if (sp.line) fprintf(stderr, "%s:%u:%u", g_script_name, sp.line, sp.col);
+    else fprintf(stderr, "%s:?", g_script_name);
+}
+
+static void kc_print_source_line(SrcSpan sp) {
+    if (!g_source || !sp.line) return;
+    const char *p = g_source;
+    for (uint32_t l = 1; l < sp.line && p; ++l) { p = strchr(p, '\n'); if (p) p++; }
+    if (!p) return;
+    const char *e = strchr(p, '\n');
+    int len = e ? (int)(e - p) : (int)strlen(p);
+    fprintf(stderr, "    %.*s\n    %*s^", len, p, sp.col > 1 ? sp.col - 1 : 0, "");
+    for (int i = 1; i < sp.len && sp.col + i <= len; ++i) fputc('~', stderr);
+    fputc('\n', stderr);
+}
+
+static void kc_fail(SrcSpan sp, int trace, const char *fmt, va_list ap) __attribute__((noreturn));
+static void kc_fail(SrcSpan sp, int trace, const char *fmt, va_list ap) {
+    fflush(stdout);
+    kc_print_span(sp);
+    fputs(": ", stderr);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    kc_print_source_line(sp);
+
+    /* frame mais interno primeiro; a posição de cada um é onde ele estava */
+    int recorded = g_call_depth < KC_TRACE_DEPTH ? g_call_depth : KC_TRACE_DEPTH;
+    if (!trace) recorded = -2;
+    else if (g_call_depth > recorded) fprintf(stderr, "  ... %d more frames\n", g_call_depth - recorded);
+    int repeat = 0;
+    for (int k = recorded - 1; k >= -1; --k) {
+        /* recursão: frames iguais seguidos viram uma linha só */
+        if (k >= 1 && k + 1 < recorded && g_call_sites[k] == g_call_sites[k - 1] && g_call_sites[k + 1] == g_call_sites[k]) {
+            repeat++;
+            continue;
+        }
+        if (repeat) { fprintf(stderr, "  ... %d more\n", repeat); repeat = 0; }
+        SrcSpan at = k + 1 < recorded ? node_span(g_call_sites[k + 1]) : g_call_depth > recorded ? (SrcSpan){ 0, 0, 0 } : sp;
+        fprintf(stderr, "  at %s (", k >= 0 ? g_call_sites[k]->data.call.func_name : "main");
+        kc_print_span(at);
+        fputs(")\n", stderr);
+    }
+    if (g_error_jmp) longjmp(*g_error_jmp, 1);
+    exit(1);
+}
+
+/* at = nó do erro; NULL usa o que está executando */
+static void kc_error(const Node *at, const char *fmt, ...) __attribute__((noreturn, format(printf, 2, 3)));
+static void kc_error(const Node *at, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    kc_fail(node_span(at ? at : g_cur_node), 1, fmt, ap);
+}
+
 /*=====================================================================
  * 2.   TOKEN STREAM / LEXER
  *===================================================================== */
@@ -202,13 +618,116 @@ static void skip_ws_and_comments(const char **src) {
     *src = p;
 }
 
+/* potências exatas de 10 em double (até 1e22) */
+static const double kc_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* parser de double sem alocação: [+-]digitos[.digitos][e[+-]digitos] em [p, end).
+   mantissa < 2^53 e |exp| <= 22 dá resultado exato (Clinger); o resto vai pro strtod.
+   retorna quantos bytes consumiu, 0 se não tem número ali */
+static size_t kc_parse_double(const char *p, const char *end, double *out) {
+    const char *s = p;
+    int neg = 0;
+    if (s < end && (*s == '-' || *s == '+')) { neg = (*s == '-'); s++; }
+
+    uint64_t mant = 0;
+    int ndig = 0, exp10 = 0, any = 0, exact = 1;
+    while (s < end && (unsigned)(*s - '0') < 10) {
+        any = 1;
+        if (mant || *s != '0') {
+            if (ndig < 19) { mant = mant * 10 + (uint64_t)(*s - '0'); ndig++; }
+            else { exp10++; exact = 0; }
+        }
+        s++;
+    }
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && (unsigned)(*s - '0') < 10) {
+            any = 1;
+            if (mant || *s != '0') {
+                if (ndig < 19) { mant = mant * 10 + (uint64_t)(*s - '0'); ndig++; exp10--; }
+                else exact = 0;
+            } else {
+                exp10--;
+            }
+            s++;
+        }
+    }
+    if (!any) return 0;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        int eneg = 0, ev = 0, edig = 0;
+        if (e < end && (*e == '-' || *e == '+')) { eneg = (*e == '-'); e++; }
+        while (e < end && (unsigned)(*e - '0') < 10) {
+            if (ev < 100000) ev = ev * 10 + (*e - '0');
+            e++; edig++;
+        }
+        if (edig) { exp10 += eneg ? -ev : ev; s = e; }
+    }
+
+    if (exact && mant < (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double v = (double)mant;
+        v = exp10 < 0 ? v / kc_pow10[-exp10] : v * kc_pow10[exp10];
+        *out = neg ? -v : v;
+        return (size_t)(s - p);
+    }
+
+    /* caminho lento: strtod precisa de string terminada */
+    char small[64];
+    size_t len = (size_t)(s - p);
+    char *tmp = len < sizeof(small) ? small : malloc(len + 1);
+    memcpy(tmp, p, len);
+    tmp[len] = '\0';
+    *out = strtod(tmp, NULL);
+    if (tmp != small) free(tmp);
+    return len;
+}
+
+/* utilidades de OPcode :D */
+static OpCode sym_to_binop(const char *lex) {
+    if (!lex) return OP_UNKNOWN;
+    if (strcmp(lex, "+")  == 0) return OP_ADD;
+    if (strcmp(lex, "-")  == 0) return OP_SUB;
+    if (strcmp(lex, "*")  == 0) return OP_MUL;
+    if (strcmp(lex, "/")  == 0) return OP_DIV;
+    if (strcmp(lex, "%")  == 0) return OP_MOD;
+    if (strcmp(lex, "**") == 0) return OP_POW;
+    if (strcmp(lex, "<")  == 0) return OP_LT;
+    if (strcmp(lex, "<=") == 0) return OP_LE;
+    if (strcmp(lex, ">")  == 0) return OP_GT;
+    if (strcmp(lex, ">=") == 0) return OP_GE;
+    if (strcmp(lex, "==") == 0) return OP_EQ;
+    if (strcmp(lex, "!=") == 0 || strcmp(lex, "~=") == 0) return OP_NE;
+    if (strcmp(lex, "&")  == 0) return OP_BITAND;
+    if (strcmp(lex, "|")  == 0) return OP_BITOR;
+    if (strcmp(lex, "^")  == 0) return OP_BITXOR;
+    if (strcmp(lex, "<<") == 0) return OP_SHL;
+    if (strcmp(lex, ">>") == 0) return OP_SHR;
+    if (strcmp(lex, "&&") == 0) return OP_LOGICAL_AND;
+    if (strcmp(lex, "||") == 0) return OP_LOGICAL_OR;
+    if (strcmp(lex, "=")  == 0) return OP_ASSIGN;
+    return OP_UNKNOWN;
+}
+
+/* operador binário do token: o parser consulta a tabela de precedência por ele */
+static OpCode token_binop(const Token *t) {
+    if (t->type == TT_SYMBOL) return sym_to_binop(t->lexeme);
+    if (t->type == TT_IDENTIFIER) {
+        if (strcmp(t->lexeme, "and") == 0) return OP_LOGICAL_AND;
+        if (strcmp(t->lexeme, "or")  == 0) return OP_LOGICAL_OR;
+    }
+    return OP_UNKNOWN;
+}
+
 static Token next_token(const char **src) {
     const char *p = *src;
     skip_ws_and_comments(&p);
 
     if (*p == '\0') {
         *src = p;
-        return (Token){ TT_EOF, NULL, 0 };
+        return (Token){ TT_EOF, NULL, 0, 0, 0, 0, OP_UNKNOWN };
     }
 
     if (isalpha((unsigned char)*p) || *p == '_') {
@@ -217,7 +736,7 @@ static Token next_token(const char **src) {
         size_t len = p - start;
         char *lex = strndup(start, len);
         *src = p;
-        return (Token){ TT_IDENTIFIER, lex, 0 };
+        return (Token){ TT_IDENTIFIER, lex, 0, 0, 0, 0, OP_UNKNOWN };
     }
 
     if (isdigit((unsigned char)*p) ||
@@ -228,12 +747,10 @@ static Token next_token(const char **src) {
             p++;
             while (isdigit((unsigned char)*p)) p++;
         }
-        size_t len = p - start;
-        char *numstr = strndup(start, len);
-        double num = strtod(numstr, NULL);
-        free(numstr);
+        double num = 0.0;
+        kc_parse_double(start, p, &num);
         *src = p;
-        return (Token){ TT_NUMBER, NULL, num };
+        return (Token){ TT_NUMBER, NULL, num, 0, 0, 0, OP_UNKNOWN };
     }
 
     if (*p == '\"') {
@@ -244,7 +761,7 @@ static Token next_token(const char **src) {
         char *str = strndup(start, len);
         if (*p == '\"') p++;
         *src = p;
-        return (Token){ TT_STRING, str, 0 };
+        return (Token){ TT_STRING, str, 0, 0, 0, 0, OP_UNKNOWN };
     }
 
     {
@@ -260,7 +777,7 @@ static Token next_token(const char **src) {
                 char *lex = strndup(p, len);
                 p += len;
                 *src = p;
-                return (Token){ TT_SYMBOL, lex, 0 };
+                return (Token){ TT_SYMBOL, lex, 0, 0, 0, 0, OP_UNKNOWN };
             }
         }
     }
@@ -271,7 +788,7 @@ static Token next_token(const char **src) {
         lex[1] = '\0';
         p++;
         *src = p;
-        return (Token){ TT_SYMBOL, lex, 0 };
+        return (Token){ TT_SYMBOL, lex, 0, 0, 0, 0, OP_UNKNOWN };
     }
 
     fprintf(stderr, "Lexical error near '%c'\n", *p);
@@ -283,15 +800,26 @@ static Token next_token(const char **src) {
 static TokenStream tokenize(const char *src) {
     TokenStream ts;
     tokens_init(&ts);
+    const char *seen = src, *line_start = src;
+    int line = 1;
     while (1) {
+        skip_ws_and_comments(&src);
+        for (; seen < src; ++seen)
+            if (*seen == '\n') { line++; line_start = seen + 1; }
+        int col = (int)(src - line_start) + 1;
+        const char *start = src;
         Token tk = next_token(&src);
+        tk.line = line;
+        tk.col = col;
+        tk.len = (int)(src - start);
+        tk.op = token_binop(&tk);
         if (tk.type == TT_EOF) {
             token_free(&tk);
             break;
         }
         tokens_append(&ts, tk);
     }
-    Token eof_tok = { TT_EOF, NULL, 0 };
+    Token eof_tok = { TT_EOF, NULL, 0, line, (int)(src - line_start) + 1, 0, OP_UNKNOWN };
     tokens_append(&ts, eof_tok);
     return ts;
 }
@@ -306,13 +834,21 @@ static size_t global_tok_pos;
 static Token peek(void)          { return global_ts->tokens[global_tok_pos]; }
 static Token consume(void)       { return global_ts->tokens[global_tok_pos++]; }
 static Token peek_next(void) {
-    if (global_tok_pos + 1 >= global_ts->size) return (Token){ TT_EOF, NULL, 0 };
+    if (global_tok_pos + 1 >= global_ts->size) return (Token){ TT_EOF, NULL, 0, 0, 0, 0, OP_UNKNOWN };
     return global_ts->tokens[global_tok_pos + 1];
 }
+/* erro de sintaxe no token atual */
+static void parse_error(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+static void parse_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    kc_fail(tok_span(peek()), 0, fmt, ap);
+}
+
 static int match(TokenType type, const char *lexeme) {
-    Token t = peek();
-    if (t.type != type) return 0;
-    if (lexeme && (!t.lexeme || strcmp(t.lexeme, lexeme) != 0)) return 0;
+    const Token *t = &global_ts->tokens[global_tok_pos];
+    if (t->type != type) return 0;
+    if (lexeme && (!t->lexeme || strcmp(t->lexeme, lexeme) != 0)) return 0;
     return 1;
 }
 static void advance(void) {
@@ -334,17 +870,7 @@ static int is_assign_operator(const char *lex) {
 static Node *parse_expression(void);
 static Node *parse_primary(void);
 static Node *parse_unary(void);
-static Node *parse_exponent(void);
-static Node *parse_mul_div_mod(void);
-static Node *parse_add_sub(void);
-static Node *parse_shift(void);
-static Node *parse_relational(void);
-static Node *parse_equality(void);
-static Node *parse_bitwise_and(void);
-static Node *parse_bitwise_xor(void);
-static Node *parse_bitwise_or(void);
-static Node *parse_logical_and(void);
-static Node *parse_logical_or(void);
+static Node *parse_binary(int min_prec);
 static Node *parse_assignment(void);
 static Node *parse_block(void);
 static Node *parse_if(void);
@@ -356,39 +882,32 @@ static Node *parse_function_decl(void);
 static Node *parse_return_stmt(void);
 static void free_node(Node *node);
 
-/* utilidades de OPcode :D */
-static OpCode sym_to_binop(const char *lex) {
-    if (!lex) return OP_UNKNOWN;
-    if (strcmp(lex, "+")  == 0) return OP_ADD;
-    if (strcmp(lex, "-")  == 0) return OP_SUB;
-    if (strcmp(lex, "*")  == 0) return OP_MUL;
-    if (strcmp(lex, "/")  == 0) return OP_DIV;
-    if (strcmp(lex, "%")  == 0) return OP_MOD;
-    if (strcmp(lex, "**") == 0) return OP_POW;
-    if (strcmp(lex, "<")  == 0) return OP_LT;
-    if (strcmp(lex, "<=") == 0) return OP_LE;
-    if (strcmp(lex, ">")  == 0) return OP_GT;
-    if (strcmp(lex, ">=") == 0) return OP_GE;
-    if (strcmp(lex, "==") == 0) return OP_EQ;
-    if (strcmp(lex, "!=") == 0 || strcmp(lex, "~=") == 0) return OP_NE;
-    if (strcmp(lex, "&")  == 0) return OP_BITAND;
-    if (strcmp(lex, "|")  == 0) return OP_BITOR;
-    if (strcmp(lex, "^")  == 0) return OP_BITXOR;
-    if (strcmp(lex, "<<") == 0) return OP_SHL;
-    if (strcmp(lex, ">>") == 0) return OP_SHR;
-    if (strcmp(lex, "&&") == 0) return OP_LOGICAL_AND;
-    if (strcmp(lex, "||") == 0) return OP_LOGICAL_OR;
-    if (strcmp(lex, "=")  == 0) return OP_ASSIGN;
-    return OP_UNKNOWN;
+/* id novo em g_spans pra esta posição */
+static uint32_t span_new(SrcSpan sp) {
+    if (g_nspans == g_spans_cap) {
+        g_spans_cap = g_spans_cap ? g_spans_cap * 2 : 4096;
+        g_spans = realloc(g_spans, g_spans_cap * sizeof(SrcSpan));
+        if (!g_nspans) g_spans[g_nspans++] = (SrcSpan){ 0, 0, 0 };   /* id 0 = sem posição */
+    }
+    g_spans[g_nspans] = sp;
+    return g_nspans++;
+}
+
+/* nó novo com id próprio e a posição dele em g_spans */
+static Node *node_alloc(SrcSpan sp) {
+    Node *n = malloc(sizeof(Node));
+    n->id = span_new(sp);
+    return n;
 }
 
+
 /* ---------- parse_primary ---------- */
 static Node *parse_primary(void) {
     Token t = peek();
 
     if (t.type == TT_NUMBER) {
         consume();
-        Node *n = malloc(sizeof(Node));
+        Node *n = node_alloc(tok_span(t));
         n->type = NODE_NUMBER;
         n->data.num = t.num;
         return n;
@@ -396,7 +915,7 @@ static Node *parse_primary(void) {
 
     if (t.type == TT_STRING) {
         consume();
-        Node *n = malloc(sizeof(Node));
+        Node *n = node_alloc(tok_span(t));
         n->type = NODE_STRING;
         n->data.str = strdup(t.lexeme);
         return n;
@@ -427,20 +946,21 @@ static Node *parse_primary(void) {
                 }
             }
             if (!match(TT_SYMBOL, ")")) {
-                fprintf(stderr, "Expected ')' after argument list\n");
-                exit(1);
+                parse_error("Expected ')' after argument list");
             }
             consume();
 
-            Node *call = malloc(sizeof(Node));
+            Node *call = node_alloc(tok_span(id));
             call->type = NODE_CALL;
             call->data.call.func_name = strdup(id.lexeme);
             call->data.call.args = args;
             call->data.call.nargs = len;
+            call->data.call.stat_id = 0;
+            call->data.call.fe_cache = NULL;
             return call;
         }
 
-        Node *var = malloc(sizeof(Node));
+        Node *var = node_alloc(tok_span(id));
         var->type = NODE_VAR;
         var->data.var_name = strdup(id.lexeme);
         return var;
@@ -450,37 +970,32 @@ static Node *parse_primary(void) {
         consume();
         Node *inner = parse_expression();
         if (!match(TT_SYMBOL, ")")) {
-            fprintf(stderr, "Expected ')' after expression\n");
-            exit(1);
+            parse_error("Expected ')' after expression");
         }
         consume();
         return inner;
     }
 
-    fprintf(stderr, "Parse error (unexpected token \"%s\")\n",
-            t.lexeme ? t.lexeme : "<EOF>");
-    exit(1);
+    parse_error("Parse error (unexpected token \"%s\")", t.lexeme ? t.lexeme : "<EOF>");
 }
 
 /* ---------- parse_unary ---------- */
 static Node *parse_unary(void) {
-    if (match(TT_SYMBOL, "!") || match(TT_SYMBOL, "~") ||
-        match(TT_SYMBOL, "-") || match(TT_SYMBOL, "+")) {
+    const Token *t = &global_ts->tokens[global_tok_pos];
+    if (t->type == TT_SYMBOL && t->lexeme[1] == '\0' && strchr("!~-+", t->lexeme[0])) {
         Token op = consume();
         Node *operand = parse_unary();
-        Node *n = malloc(sizeof(Node));
+        Node *n = node_alloc(tok_span(op));
         n->type = NODE_UNARY;
-        n->data.unary.op = (strcmp(op.lexeme, "!") == 0) ? OP_NOT :
-                           (strcmp(op.lexeme, "~") == 0) ? OP_BITNOT :
-                           (strcmp(op.lexeme, "-") == 0) ? OP_NEG :
-                           (strcmp(op.lexeme, "+") == 0) ? OP_NEG : OP_UNKNOWN;
+        n->data.unary.op = op.lexeme[0] == '!' ? OP_NOT :
+                           op.lexeme[0] == '~' ? OP_BITNOT : OP_NEG;   /* "+" unário também é OP_NEG */
         n->data.unary.operand = operand;
         return n;
     }
     if (match(TT_IDENTIFIER, "not")) {
-        consume();
+        Token op = consume();
         Node *operand = parse_unary();
-        Node *n = malloc(sizeof(Node));
+        Node *n = node_alloc(tok_span(op));
         n->type = NODE_UNARY;
         n->data.unary.op = OP_NOT;
         n->data.unary.operand = operand;
@@ -489,233 +1004,102 @@ static Node *parse_unary(void) {
     return parse_primary();
 }
 
-static Node *parse_exponent(void) {
+/* ---------- expressões binárias ----------
+ * precedence climbing: uma tabela por OpCode no lugar de um nível de função
+ * por precedência. Um literal sozinho custa parse_binary -> parse_unary ->
+ * parse_primary em vez de descer os 12 níveis. Maior = liga mais forte;
+ * 0 = não é operador binário (inclui "=", que é tratado em parse_assignment). */
+static const unsigned char g_binop_prec[OP_UNKNOWN + 1] = {
+    [OP_LOGICAL_OR]  = 1,
+    [OP_LOGICAL_AND] = 2,
+    [OP_BITOR]       = 3,
+    [OP_BITXOR]      = 4,
+    [OP_BITAND]      = 5,
+    [OP_EQ] = 6, [OP_NE] = 6,
+    [OP_LT] = 7, [OP_LE] = 7, [OP_GT] = 7, [OP_GE] = 7,
+    [OP_SHL] = 8, [OP_SHR] = 8,
+    [OP_ADD] = 9, [OP_SUB] = 9,
+    [OP_MUL] = 10, [OP_DIV] = 10, [OP_MOD] = 10,
+    [OP_POW] = 11,               /* único associativo à direita */
+};
+
+static Node *parse_binary(int min_prec) {
     Node *node = parse_unary();
-    if (match(TT_SYMBOL, "**")) {
-        consume();
-        Node *right = parse_exponent();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_POW;
-        return n;
-    }
-    return node;
-}
-
-static Node *parse_mul_div_mod(void) {
-    Node *node = parse_exponent();
-    while (match(TT_SYMBOL, "*") || match(TT_SYMBOL, "/") ||
-           match(TT_SYMBOL, "%")) {
-        Token op = consume();
-        Node *right = parse_exponent();
-        Node *n = malloc(sizeof(Node));
+    for (;;) {
+        OpCode op = global_ts->tokens[global_tok_pos].op;
+        int prec = g_binop_prec[op];
+        if (prec == 0 || prec < min_prec) break;
+        advance();
+        /* associa à esquerda: o lado direito só leva operadores mais fortes;
+           ** leva o mesmo nível, então 2**3**2 = 2**(3**2) */
+        Node *right = parse_binary(op == OP_POW ? prec : prec + 1);
+        Node *n = node_alloc(node_span(node));
         n->type = NODE_BINARY;
         n->data.bin.left  = node;
         n->data.bin.right = right;
-        n->data.bin.op    = sym_to_binop(op.lexeme);
+        n->data.bin.op    = op;
         node = n;
     }
     return node;
 }
 
-static Node *parse_add_sub(void) {
-    Node *node = parse_mul_div_mod();
-    while (match(TT_SYMBOL, "+") || match(TT_SYMBOL, "-")) {
-        Token op = consume();
-        Node *right = parse_mul_div_mod();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = sym_to_binop(op.lexeme);
-        node = n;
-    }
-    return node;
+static Node *parse_expression(void) {
+    return parse_binary(1);
 }
 
-static Node *parse_shift(void) {
-    Node *node = parse_add_sub();
-    while (match(TT_SYMBOL, "<<") || match(TT_SYMBOL, ">>")) {
-        Token op = consume();
-        Node *right = parse_add_sub();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = sym_to_binop(op.lexeme);
-        node = n;
-    }
-    return node;
-}
+static Node *parse_assignment(void) {
+    Token id = consume();
 
-static Node *parse_relational(void) {
-    Node *node = parse_shift();
-    while (match(TT_SYMBOL, "<")  || match(TT_SYMBOL, "<=") ||
-           match(TT_SYMBOL, ">")  || match(TT_SYMBOL, ">=")) {
-        Token op = consume();
-        Node *right = parse_shift();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = sym_to_binop(op.lexeme);
-        node = n;
+    if (!match(TT_SYMBOL, "=") && !is_assign_operator(peek().lexeme)) {
+        Node *var = node_alloc(tok_span(id));
+        var->type = NODE_VAR;
+        var->data.var_name = strdup(id.lexeme);
+        return var;
     }
-    return node;
-}
 
-static Node *parse_equality(void) {
-    Node *node = parse_relational();
-    while (match(TT_SYMBOL, "==") || match(TT_SYMBOL, "~=") ||
-           match(TT_SYMBOL, "!=")) {
-        Token op = consume();
-        Node *right = parse_relational();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = sym_to_binop(op.lexeme);
-        node = n;
-    }
-    return node;
-}
+    Token opTok = consume();
+    Node *right = parse_expression();
 
-static Node *parse_bitwise_and(void) {
-    Node *node = parse_equality();
-    while (match(TT_SYMBOL, "&")) {
-        consume();
-        Node *right = parse_equality();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_BITAND;
-        node = n;
+    Node *leftVar = node_alloc(tok_span(id));
+    leftVar->type = NODE_VAR;
+    leftVar->data.var_name = strdup(id.lexeme);
+
+    if (strcmp(opTok.lexeme, "=") == 0) {
+        Node *assign = node_alloc(tok_span(id));
+        assign->type = NODE_BINARY;
+        assign->data.bin.left  = leftVar;
+        assign->data.bin.right = right;
+        assign->data.bin.op    = OP_ASSIGN;
+        return assign;
     }
-    return node;
-}
 
-static Node *parse_bitwise_xor(void) {
-    Node *node = parse_bitwise_and();
-    while (match(TT_SYMBOL, "^")) {
-        consume();
-        Node *right = parse_bitwise_and();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_BITXOR;
-        node = n;
+    OpCode simpleOp = OP_UNKNOWN;
+    if (strcmp(opTok.lexeme, "+=") == 0) simpleOp = OP_ADD;
+    else if (strcmp(opTok.lexeme, "-=") == 0) simpleOp = OP_SUB;
+    else if (strcmp(opTok.lexeme, "*=") == 0) simpleOp = OP_MUL;
+    else if (strcmp(opTok.lexeme, "/=") == 0) simpleOp = OP_DIV;
+    else if (strcmp(opTok.lexeme, "%=") == 0) simpleOp = OP_MOD;
+    else if (strcmp(opTok.lexeme, "&=") == 0) simpleOp = OP_BITAND;
+    else if (strcmp(opTok.lexeme, "|=") == 0) simpleOp = OP_BITOR;
+    else if (strcmp(opTok.lexeme, "^=") == 0) simpleOp = OP_BITXOR;
+    else if (strcmp(opTok.lexeme, "<<=") == 0) simpleOp = OP_SHL;
+    else if (strcmp(opTok.lexeme, ">>=") == 0) simpleOp = OP_SHR;
+    else if (strcmp(opTok.lexeme, "**=") == 0) simpleOp = OP_POW;
+    else {
+        parse_error("Operador de atribuição desconhecido \"%s\"", opTok.lexeme);
     }
-    return node;
-}
 
-static Node *parse_bitwise_or(void) {
-    Node *node = parse_bitwise_xor();
-    while (match(TT_SYMBOL, "|")) {
-        consume();
-        Node *right = parse_bitwise_xor();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_BITOR;
-        node = n;
-    }
-    return node;
-}
-
-static Node *parse_logical_and(void) {
-    Node *node = parse_bitwise_or();
-    while (match(TT_SYMBOL, "&&") || match(TT_IDENTIFIER, "and")) {
-        if (match(TT_SYMBOL, "&&")) consume(); else consume();
-        Node *right = parse_bitwise_or();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_LOGICAL_AND;
-        node = n;
-    }
-    return node;
-}
-
-static Node *parse_logical_or(void) {
-    Node *node = parse_logical_and();
-    while (match(TT_SYMBOL, "||") || match(TT_IDENTIFIER, "or")) {
-        if (match(TT_SYMBOL, "||")) consume(); else consume();
-        Node *right = parse_logical_and();
-        Node *n = malloc(sizeof(Node));
-        n->type = NODE_BINARY;
-        n->data.bin.left  = node;
-        n->data.bin.right = right;
-        n->data.bin.op    = OP_LOGICAL_OR;
-        node = n;
-    }
-    return node;
-}
-
-static Node *parse_expression(void) {
-    return parse_logical_or();
-}
-
-static Node *parse_assignment(void) {
-    Token id = consume();
-
-    if (!match(TT_SYMBOL, "=") && !is_assign_operator(peek().lexeme)) {
-        Node *var = malloc(sizeof(Node));
-        var->type = NODE_VAR;
-        var->data.var_name = strdup(id.lexeme);
-        return var;
-    }
-
-    Token opTok = consume();
-    Node *right = parse_expression();
-
-    Node *leftVar = malloc(sizeof(Node));
-    leftVar->type = NODE_VAR;
-    leftVar->data.var_name = strdup(id.lexeme);
-
-    if (strcmp(opTok.lexeme, "=") == 0) {
-        Node *assign = malloc(sizeof(Node));
-        assign->type = NODE_BINARY;
-        assign->data.bin.left  = leftVar;
-        assign->data.bin.right = right;
-        assign->data.bin.op    = OP_ASSIGN;
-        return assign;
-    }
-
-    OpCode simpleOp = OP_UNKNOWN;
-    if (strcmp(opTok.lexeme, "+=") == 0) simpleOp = OP_ADD;
-    else if (strcmp(opTok.lexeme, "-=") == 0) simpleOp = OP_SUB;
-    else if (strcmp(opTok.lexeme, "*=") == 0) simpleOp = OP_MUL;
-    else if (strcmp(opTok.lexeme, "/=") == 0) simpleOp = OP_DIV;
-    else if (strcmp(opTok.lexeme, "%=") == 0) simpleOp = OP_MOD;
-    else if (strcmp(opTok.lexeme, "&=") == 0) simpleOp = OP_BITAND;
-    else if (strcmp(opTok.lexeme, "|=") == 0) simpleOp = OP_BITOR;
-    else if (strcmp(opTok.lexeme, "^=") == 0) simpleOp = OP_BITXOR;
-    else if (strcmp(opTok.lexeme, "<<=") == 0) simpleOp = OP_SHL;
-    else if (strcmp(opTok.lexeme, ">>=") == 0) simpleOp = OP_SHR;
-    else if (strcmp(opTok.lexeme, "**=") == 0) simpleOp = OP_POW;
-    else {
-        fprintf(stderr, "Operador de atribuição desconhecido \"%s\"\n",
-                opTok.lexeme);
-        exit(1);
-    }
-
-    Node *leftCopy = malloc(sizeof(Node));
+    Node *leftCopy = node_alloc(tok_span(id));
     leftCopy->type = NODE_VAR;
     leftCopy->data.var_name = strdup(id.lexeme);
 
-    Node *bin = malloc(sizeof(Node));
+    Node *bin = node_alloc(tok_span(id));
     bin->type = NODE_BINARY;
     bin->data.bin.left  = leftCopy;
     bin->data.bin.right = right;
     bin->data.bin.op    = simpleOp;
 
-    Node *assign = malloc(sizeof(Node));
+    Node *assign = node_alloc(tok_span(id));
     assign->type = NODE_BINARY;
     assign->data.bin.left  = leftVar;
     assign->data.bin.right = bin;
@@ -726,18 +1110,16 @@ static Node *parse_assignment(void) {
 /* ---------- bloco ---------- */
 static Node *parse_block(void) {
     if (!match(TT_SYMBOL, "{")) {
-        fprintf(stderr, "Expected '{' to start a block\n");
-        exit(1);
+        parse_error("Expected '{' to start a block");
     }
-    consume();
+    Token open = consume();
 
     size_t cap = 8, len = 0;
     Node **stmts = calloc(cap, sizeof(Node *));
 
     while (!match(TT_SYMBOL, "}")) {
         if (match(TT_EOF, NULL)) {
-            fprintf(stderr, "Unexpected EOF inside block\n");
-            exit(1);
+            parse_error("Unexpected EOF inside block");
         }
         skip_separators();
         if (match(TT_SYMBOL, "}")) break;
@@ -754,7 +1136,7 @@ static Node *parse_block(void) {
     if (len == cap) stmts = realloc(stmts, (cap + 1) * sizeof(Node *));
     stmts[len] = NULL;
 
-    Node *blk = malloc(sizeof(Node));
+    Node *blk = node_alloc(tok_span(open));
     blk->type = NODE_BLOCK;
     blk->data.block.stmts = stmts;
     return blk;
@@ -762,15 +1144,14 @@ static Node *parse_block(void) {
 
 /* ---------- while/loop ---------- */
 static Node *parse_while(void) {
-    consume();
+    Token kw = consume();
 
     Node *cond = NULL;
     if (match(TT_SYMBOL, "(")) {
         consume();
         cond = parse_expression();
         if (!match(TT_SYMBOL, ")")) {
-            fprintf(stderr, "Expected ')' after while condition\n");
-            exit(1);
+            parse_error("Expected ')' after while condition");
         }
         consume();
     } else {
@@ -784,39 +1165,38 @@ static Node *parse_while(void) {
         body = parse_statement();
     }
 
-    Node *w = malloc(sizeof(Node));
+    Node *w = node_alloc(tok_span(kw));
     w->type = NODE_WHILE;
     w->data.while_node.cond = cond;
     w->data.while_node.body = body;
+    w->data.while_node.incr = NULL;
+    w->data.while_node.epoch = 0;
     return w;
 }
 
 /* ---------- class decl (kept) ---------- */
 static Node *parse_class_decl(void) {
-    consume();
+    Token kw = consume();
 
     Token className = consume();
     if (className.type != TT_IDENTIFIER) {
-        fprintf(stderr, "Expected class name after 'class'\n");
-        exit(1);
+        parse_error("Expected class name after 'class'");
     }
 
     if (!match(TT_SYMBOL, "{")) {
-        fprintf(stderr, "Expected '{' after class name\n");
-        exit(1);
+        parse_error("Expected '{' after class name");
     }
     consume();
 
     while (!match(TT_SYMBOL, "}")) {
         if (match(TT_EOF, NULL)) {
-            fprintf(stderr, "Unexpected EOF inside class body\n");
-            exit(1);
+            parse_error("Unexpected EOF inside class body");
         }
         advance();
     }
     consume();
 
-    Node *cl = malloc(sizeof(Node));
+    Node *cl = node_alloc(tok_span(kw));
     cl->type = NODE_CLASS_DECL;
     cl->data.class_decl.class_name = strdup(className.lexeme);
     cl->data.class_decl.body = NULL;
@@ -825,7 +1205,7 @@ static Node *parse_class_decl(void) {
 
 /* ---------- if statement ---------- */
 static Node *parse_if(void) {
-    consume();
+    Token kw = consume();
 
     /* condição (opcional os parênteses) */
     int has_parens = 0;
@@ -838,8 +1218,7 @@ static Node *parse_if(void) {
 
     if (has_parens) {
         if (!match(TT_SYMBOL, ")")) {
-            fprintf(stderr, "Expected ')' after if condition\n");
-            exit(1);
+            parse_error("Expected ')' after if condition");
         }
         consume();
     }
@@ -865,7 +1244,7 @@ static Node *parse_if(void) {
         }
     }
 
-    Node *if_node = malloc(sizeof(Node));
+    Node *if_node = node_alloc(tok_span(kw));
     if_node->type = NODE_IF;
     if_node->data.if_node.cond = cond;
     if_node->data.if_node.then_body = then_body;
@@ -875,17 +1254,15 @@ static Node *parse_if(void) {
 
 /* ---------- function: 'fuktion name(a,b) { ... }' ---------- */
 static Node *parse_function_decl(void) {
-    consume();
+    Token kw = consume();
 
     Token nameTok = consume();
     if (nameTok.type != TT_IDENTIFIER) {
-        fprintf(stderr, "Expected function name after 'fuktion'\n");
-        exit(1);
+        parse_error("Expected function name after 'fuktion'");
     }
 
     if (!match(TT_SYMBOL, "(")) {
-        fprintf(stderr, "Expected '(' after function name\n");
-        exit(1);
+        parse_error("Expected '(' after function name");
     }
     consume(); /* '(' */
 
@@ -896,8 +1273,7 @@ static Node *parse_function_decl(void) {
         while (1) {
             Token p = consume();
             if (p.type != TT_IDENTIFIER) {
-                fprintf(stderr, "Expected parameter name in function declaration\n");
-                exit(1);
+                parse_error("Expected parameter name in function declaration");
             }
             if (nparams == cap) { cap *= 2; params = realloc(params, cap * sizeof(char *)); }
             params[nparams++] = strdup(p.lexeme);
@@ -908,8 +1284,7 @@ static Node *parse_function_decl(void) {
     }
 
     if (!match(TT_SYMBOL, ")")) {
-        fprintf(stderr, "Expected ')' after parameter list\n");
-        exit(1);
+        parse_error("Expected ')' after parameter list");
     }
     consume(); /* ')' */
 
@@ -917,11 +1292,10 @@ static Node *parse_function_decl(void) {
     if (match(TT_SYMBOL, "{")) {
         body = parse_block();
     } else {
-        fprintf(stderr, "Expected '{' for function body\n");
-        exit(1);
+        parse_error("Expected '{' for function body");
     }
 
-    Node *fn = malloc(sizeof(Node));
+    Node *fn = node_alloc(tok_span(kw));
     fn->type = NODE_FUNC_DECL;
     fn->data.func_decl.name = strdup(nameTok.lexeme);
     fn->data.func_decl.params = params;
@@ -932,12 +1306,12 @@ static Node *parse_function_decl(void) {
 
 /* ---------- return statement ---------- */
 static Node *parse_return_stmt(void) {
-    consume();
+    Token kw = consume();
     Node *expr = NULL;
     if (!match(TT_SYMBOL, ";") && !match(TT_SYMBOL, "}")) {
         expr = parse_expression();
     }
-    Node *ret = malloc(sizeof(Node));
+    Node *ret = node_alloc(tok_span(kw));
     ret->type = NODE_RETURN;
     ret->data.return_node.expr = expr;
     return ret;
@@ -992,6 +1366,484 @@ static Node **parse_program(void) {
     return stmts;
 }
 
+/*=====================================================================
+ * 3b.  Otimizador: invariantes de laço e laços contados
+ *===================================================================== */
+
+/* Roda depois do parser (e depois de gravar o cache, que guarda a árvore
+   crua). Dentro de cada while, a maior subexpressão sem chamada e cujas
+   variáveis não são atribuídas no laço vira NODE_INVARIANT: calcula na
+   primeira vez que é usada depois de entrar no laço e reaproveita até sair.
+   Chamadas não mudam variáveis de quem chama (env_set só escreve no Env
+   local), então só as atribuições do próprio laço contam. O corpo de
+   fuktion declarada lá dentro roda em outro Env e fica de fora. */
+
+typedef struct { const char **names; size_t len, cap; } OptNames;
+
+static int opt_has_name(const OptNames *a, const char *name) {
+    for (size_t i = 0; i < a->len; ++i) if (strcmp(a->names[i], name) == 0) return 1;
+    return 0;
+}
+
+/* nomes atribuídos em n; *count_of conta quantas vezes `count_name` aparece */
+static void opt_collect_assigned(Node *n, OptNames *a, const char *count_name, int *count_of) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_BINARY: case NODE_INC:
+            if (n->data.bin.op == OP_ASSIGN && n->data.bin.left->type == NODE_VAR) {
+                const char *name = n->data.bin.left->data.var_name;
+                if (count_name && strcmp(name, count_name) == 0) (*count_of)++;
+                if (!opt_has_name(a, name)) {
+                    if (a->len == a->cap) {
+                        a->cap = a->cap ? a->cap * 2 : 16;
+                        a->names = realloc(a->names, a->cap * sizeof(char *));
+                    }
+                    a->names[a->len++] = name;
+                }
+            }
+            opt_collect_assigned(n->data.bin.left, a, count_name, count_of);
+            opt_collect_assigned(n->data.bin.right, a, count_name, count_of);
+            break;
+        case NODE_UNARY: opt_collect_assigned(n->data.unary.operand, a, count_name, count_of); break;
+        case NODE_CALL:
+            for (size_t i = 0; i < n->data.call.nargs; ++i)
+                opt_collect_assigned(n->data.call.args[i], a, count_name, count_of);
+            break;
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_collect_assigned(*p, a, count_name, count_of);
+            break;
+        case NODE_WHILE:
+            opt_collect_assigned(n->data.while_node.cond, a, count_name, count_of);
+            opt_collect_assigned(n->data.while_node.body, a, count_name, count_of);
+            break;
+        case NODE_IF:
+            opt_collect_assigned(n->data.if_node.cond, a, count_name, count_of);
+            opt_collect_assigned(n->data.if_node.then_body, a, count_name, count_of);
+            opt_collect_assigned(n->data.if_node.else_body, a, count_name, count_of);
+            break;
+        case NODE_RETURN: opt_collect_assigned(n->data.return_node.expr, a, count_name, count_of); break;
+        case NODE_INVARIANT: opt_collect_assigned(n->data.inv.expr, a, count_name, count_of); break;
+        default: break;
+    }
+}
+
+static int opt_invariant(const Node *n, const OptNames *assigned) {
+    switch (n->type) {
+        case NODE_NUMBER: return 1;
+        case NODE_VAR: return !opt_has_name(assigned, n->data.var_name);
+        case NODE_UNARY: return opt_invariant(n->data.unary.operand, assigned);
+        case NODE_BINARY:
+            return n->data.bin.op != OP_ASSIGN && opt_invariant(n->data.bin.left, assigned) &&
+                   opt_invariant(n->data.bin.right, assigned);
+        default: return 0;
+    }
+}
+
+static Node *opt_wrap(Node *e, Node *loop) {
+    Node *inv = node_alloc(node_span(e));
+    inv->type = NODE_INVARIANT;
+    inv->data.inv.expr = e;
+    inv->data.inv.loop = loop;
+    inv->data.inv.value = 0.0;
+    inv->data.inv.ival = 0;
+    inv->data.inv.is_int = 0;
+    inv->data.inv.epoch = 0;
+    return inv;
+}
+
+/* troca as maiores subexpressões invariantes de *slot por NODE_INVARIANT */
+static void opt_hoist(Node **slot, Node *loop, const OptNames *assigned) {
+    Node *n = *slot;
+    if (!n) return;
+    switch (n->type) {
+        case NODE_UNARY:
+        case NODE_BINARY:
+            if (opt_invariant(n, assigned)) { *slot = opt_wrap(n, loop); return; }
+            if (n->type == NODE_UNARY) { opt_hoist(&n->data.unary.operand, loop, assigned); return; }
+            if (n->data.bin.op != OP_ASSIGN) opt_hoist(&n->data.bin.left, loop, assigned);
+            opt_hoist(&n->data.bin.right, loop, assigned);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < n->data.call.nargs; ++i) opt_hoist(&n->data.call.args[i], loop, assigned);
+            break;
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_hoist(p, loop, assigned);
+            break;
+        case NODE_WHILE:
+            opt_hoist(&n->data.while_node.cond, loop, assigned);
+            opt_hoist(&n->data.while_node.body, loop, assigned);
+            break;
+        case NODE_IF:
+            opt_hoist(&n->data.if_node.cond, loop, assigned);
+            opt_hoist(&n->data.if_node.then_body, loop, assigned);
+            opt_hoist(&n->data.if_node.else_body, loop, assigned);
+            break;
+        case NODE_RETURN: opt_hoist(&n->data.return_node.expr, loop, assigned); break;
+        default: break;
+    }
+}
+
+/* while i < n { ... i = i + k } com i atribuído só ali e n, k invariantes */
+static Node *opt_counted_incr(Node *loop, const OptNames *assigned) {
+    Node *cond = loop->data.while_node.cond, *body = loop->data.while_node.body;
+    if (cond->type != NODE_BINARY || cond->data.bin.left->type != NODE_VAR) return NULL;
+    switch (cond->data.bin.op) {
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_NE: break;
+        default: return NULL;
+    }
+    Node *bound = cond->data.bin.right;
+    if (bound->type != NODE_INVARIANT && !opt_invariant(bound, assigned)) return NULL;
+    if (!body || body->type != NODE_BLOCK || !body->data.block.stmts[0]) return NULL;
+
+    Node **last = body->data.block.stmts;
+    while (last[1]) last++;
+    const char *name = cond->data.bin.left->data.var_name;
+    Node *st = *last;
+    if (st->type != NODE_BINARY || st->data.bin.op != OP_ASSIGN || st->data.bin.left->type != NODE_VAR ||
+        strcmp(st->data.bin.left->data.var_name, name) != 0) return NULL;
+    Node *incr = st->data.bin.right;
+    if (incr->type != NODE_BINARY || (incr->data.bin.op != OP_ADD && incr->data.bin.op != OP_SUB)) return NULL;
+    Node *var = incr->data.bin.left, *step = incr->data.bin.right;
+    if (incr->data.bin.op == OP_ADD && step->type == NODE_VAR && strcmp(step->data.var_name, name) == 0) {
+        var = incr->data.bin.right;
+        step = incr->data.bin.left;
+    }
+    if (var->type != NODE_VAR || strcmp(var->data.var_name, name) != 0) return NULL;
+    if (step->type != NODE_INVARIANT && !opt_invariant(step, assigned)) return NULL;
+
+    OptNames dummy = { NULL, 0, 0 };
+    int writes = 0;
+    opt_collect_assigned(cond, &dummy, name, &writes);
+    opt_collect_assigned(body, &dummy, name, &writes);
+    free(dummy.names);
+    return writes == 1 ? incr : NULL;
+}
+
+static void opt_walk(Node *n);
+
+static void opt_loop(Node *loop) {
+    OptNames assigned = { NULL, 0, 0 };
+    int unused = 0;
+    opt_collect_assigned(loop->data.while_node.cond, &assigned, NULL, &unused);
+    opt_collect_assigned(loop->data.while_node.body, &assigned, NULL, &unused);
+    opt_hoist(&loop->data.while_node.cond, loop, &assigned);
+    opt_hoist(&loop->data.while_node.body, loop, &assigned);
+    loop->data.while_node.incr = opt_counted_incr(loop, &assigned);
+    free(assigned.names);
+    /* laços de dentro depois: o de fora já levou o que é invariante pros dois */
+    opt_walk(loop->data.while_node.body);
+}
+
+static void opt_walk(Node *n) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_WHILE: opt_loop(n); break;
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_walk(*p);
+            break;
+        case NODE_IF:
+            opt_walk(n->data.if_node.then_body);
+            opt_walk(n->data.if_node.else_body);
+            break;
+        case NODE_FUNC_DECL: opt_walk(n->data.func_decl.body); break;
+        default: break;
+    }
+}
+
+/* Contas inteiras: a maior árvore de + - * % bitwise shift (e - ~ unários)
+   que tem pelo menos um %, bitwise ou shift vira NODE_INT_EXPR e roda em
+   num_eval, em int64 enquanto der. Só + - * ficam em double mesmo. */
+static int opt_int_op(const Node *n) {
+    if (n->type == NODE_UNARY) return n->data.unary.op == OP_NEG || n->data.unary.op == OP_BITNOT;
+    if (n->type != NODE_BINARY) return 0;
+    switch (n->data.bin.op) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+        case OP_BITAND: case OP_BITOR: case OP_BITXOR: case OP_SHL: case OP_SHR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int opt_int_worth(const Node *n) {
+    if (!opt_int_op(n)) return 0;
+    if (n->type == NODE_UNARY)
+        return n->data.unary.op == OP_BITNOT || opt_int_worth(n->data.unary.operand);
+    OpCode op = n->data.bin.op;
+    return op == OP_MOD || (op >= OP_BITAND && op <= OP_SHR) ||
+           opt_int_worth(n->data.bin.left) || opt_int_worth(n->data.bin.right);
+}
+
+static void opt_int(Node **slot);
+
+/* folhas de uma árvore inteira (podem ter contas inteiras dentro, ex.: args) */
+static void opt_int_leaves(Node **slot) {
+    Node *n = *slot;
+    if (!opt_int_op(n)) { opt_int(slot); return; }
+    if (n->type == NODE_UNARY) { opt_int_leaves(&n->data.unary.operand); return; }
+    opt_int_leaves(&n->data.bin.left);
+    opt_int_leaves(&n->data.bin.right);
+}
+
+static void opt_int(Node **slot) {
+    Node *n = *slot;
+    if (!n) return;
+    if (opt_int_worth(n)) {
+        opt_int_leaves(n->type == NODE_UNARY ? &n->data.unary.operand : &n->data.bin.left);
+        if (n->type == NODE_BINARY) opt_int_leaves(&n->data.bin.right);
+        Node *w = node_alloc(node_span(n));
+        w->type = NODE_INT_EXPR;
+        w->data.int_expr.expr = n;
+        *slot = w;
+        return;
+    }
+    switch (n->type) {
+        case NODE_BINARY:
+            if (n->data.bin.op != OP_ASSIGN) opt_int(&n->data.bin.left);
+            opt_int(&n->data.bin.right);
+            break;
+        case NODE_UNARY: opt_int(&n->data.unary.operand); break;
+        case NODE_CALL:
+            for (size_t i = 0; i < n->data.call.nargs; ++i) opt_int(&n->data.call.args[i]);
+            break;
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_int(p);
+            break;
+        case NODE_WHILE:
+            opt_int(&n->data.while_node.cond);
+            opt_int(&n->data.while_node.body);
+            break;
+        case NODE_IF:
+            opt_int(&n->data.if_node.cond);
+            opt_int(&n->data.if_node.then_body);
+            opt_int(&n->data.if_node.else_body);
+            break;
+        case NODE_FUNC_DECL: opt_int(&n->data.func_decl.body); break;
+        case NODE_RETURN: opt_int(&n->data.return_node.expr); break;
+        case NODE_INVARIANT: opt_int(&n->data.inv.expr); break;
+        default: break;
+    }
+}
+
+/* Superinstruções: os formatos que mais aparecem nos scripts viram um tipo
+   de nó próprio (só troca node->type, filhos e bin continuam iguais) e o
+   exec_expr calcula direto, sem chamar exec_expr nos filhos nem passar pela
+   pilha. Condição de if/while nesse formato nem empilha o resultado.
+   Contadores (sites no fonte, disparos em runtime) saem no --stats. */
+enum { SUPER_VAR_NUM, SUPER_VAR_VAR, SUPER_INC, SUPER_COND, SUPER_KINDS };
+
+#ifndef KC_NO_STATS
+static const char *const g_super_names[SUPER_KINDS] = {
+    "var op num", "var op var", "x = x +- num", "if/while var op num|var"
+};
+static uint64_t g_super_sites[SUPER_KINDS];
+static uint64_t g_super_fires[SUPER_KINDS];   /* só a thread do interpretador escreve */
+#define SUPER_SITE(k) (g_super_sites[k]++)
+#define SUPER_FIRE(k) (g_super_fires[k]++)
+#else
+#define SUPER_SITE(k) ((void)0)
+#define SUPER_FIRE(k) ((void)0)
+#endif
+
+/* `var op número` / `var op var` com op aritmético, comparação ou bitwise */
+static int opt_super_bin(Node *n) {
+    if (n->type != NODE_BINARY || n->data.bin.op > OP_SHR || n->data.bin.left->type != NODE_VAR) return 0;
+    NodeType r = n->data.bin.right->type;
+    if (r != NODE_NUMBER && r != NODE_VAR) return 0;
+    n->type = r == NODE_NUMBER ? NODE_VAR_NUM : NODE_VAR_VAR;
+    return 1;
+}
+
+static void opt_super(Node *n);
+
+static void opt_super_cond(Node *c) {
+    if (opt_super_bin(c)) SUPER_SITE(SUPER_COND);
+    else opt_super(c);
+}
+
+static void opt_super(Node *n) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_BINARY: {
+            Node *l = n->data.bin.left, *r = n->data.bin.right;
+            if (n->data.bin.op == OP_ASSIGN) {
+                if (l->type == NODE_VAR && r->type == NODE_BINARY &&
+                    (r->data.bin.op == OP_ADD || r->data.bin.op == OP_SUB) &&
+                    r->data.bin.left->type == NODE_VAR && r->data.bin.right->type == NODE_NUMBER &&
+                    strcmp(r->data.bin.left->data.var_name, l->data.var_name) == 0) {
+                    n->type = NODE_INC;
+                    SUPER_SITE(SUPER_INC);
+                    return;
+                }
+                opt_super(r);
+                return;
+            }
+            if (opt_super_bin(n)) {
+                SUPER_SITE(n->type == NODE_VAR_NUM ? SUPER_VAR_NUM : SUPER_VAR_VAR);
+                return;
+            }
+            opt_super(l);
+            opt_super(r);
+            break;
+        }
+        case NODE_UNARY: opt_super(n->data.unary.operand); break;
+        case NODE_CALL:
+            for (size_t i = 0; i < n->data.call.nargs; ++i) opt_super(n->data.call.args[i]);
+            break;
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_super(*p);
+            break;
+        case NODE_WHILE:
+            opt_super_cond(n->data.while_node.cond);
+            opt_super(n->data.while_node.body);
+            break;
+        case NODE_IF:
+            opt_super_cond(n->data.if_node.cond);
+            opt_super(n->data.if_node.then_body);
+            opt_super(n->data.if_node.else_body);
+            break;
+        case NODE_FUNC_DECL: opt_super(n->data.func_decl.body); break;
+        case NODE_RETURN: opt_super(n->data.return_node.expr); break;
+        case NODE_INVARIANT: opt_super(n->data.inv.expr); break;
+        default: break;   /* NODE_INT_EXPR fica como está: num_eval só conhece os nós normais */
+    }
+}
+
+/* Profundidade da pilha: quantos valores o exec_expr/exec_node de n chega a
+   ter empilhados ao mesmo tempo (limite de cima). Cada chamada de fuktion
+   roda numa pilha própria desse tamanho e o programa numa do tamanho do
+   maior comando de fora, então push/pop não checam nada (ver seção 4).
+   Builtin: pior caso é ter os argumentos anteriores ainda na pilha. */
+static uint32_t stack_depth(const Node *n) {
+    if (!n) return 0;
+    uint32_t d = 1, t;
+    switch (n->type) {
+        case NODE_BINARY: case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC: {
+            uint32_t l = stack_depth(n->data.bin.left), r = stack_depth(n->data.bin.right);
+            if (n->data.bin.op == OP_ASSIGN) return r;
+            if (n->data.bin.op == OP_LOGICAL_AND || n->data.bin.op == OP_LOGICAL_OR) return l > r ? l : r;
+            return l > r + 1 ? l : r + 1;
+        }
+        case NODE_UNARY: return stack_depth(n->data.unary.operand);
+        case NODE_INVARIANT: return stack_depth(n->data.inv.expr);
+        case NODE_INT_EXPR: return stack_depth(n->data.int_expr.expr);
+        case NODE_CALL:
+            for (size_t i = 0; i < n->data.call.nargs; ++i)
+                if ((t = (uint32_t)i + stack_depth(n->data.call.args[i])) > d) d = t;
+            return d;
+        case NODE_BLOCK:
+            d = 0;
+            for (Node **p = n->data.block.stmts; *p; ++p)
+                if ((t = stack_depth(*p)) > d) d = t;
+            return d;
+        case NODE_WHILE:
+            d = stack_depth(n->data.while_node.cond);
+            t = stack_depth(n->data.while_node.body);
+            return d > t ? d : t;
+        case NODE_IF:
+            d = stack_depth(n->data.if_node.cond);
+            if ((t = stack_depth(n->data.if_node.then_body)) > d) d = t;
+            if ((t = stack_depth(n->data.if_node.else_body)) > d) d = t;
+            return d;
+        case NODE_RETURN: return stack_depth(n->data.return_node.expr);
+        case NODE_FUNC_DECL: case NODE_CLASS_DECL: return 0;   /* corpo roda em outra pilha (ou nunca) */
+        default: return 1;
+    }
+}
+
+/* stack_max de toda fuktion, inclusive as declaradas dentro de outras */
+static void opt_stack(Node *n) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_FUNC_DECL: {
+            uint32_t d = stack_depth(n->data.func_decl.body);
+            n->data.func_decl.stack_max = d ? d : 1;
+            opt_stack(n->data.func_decl.body);
+            break;
+        }
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_stack(*p);
+            break;
+        case NODE_WHILE: opt_stack(n->data.while_node.body); break;
+        case NODE_IF:
+            opt_stack(n->data.if_node.then_body);
+            opt_stack(n->data.if_node.else_body);
+            break;
+        default: break;
+    }
+}
+
+#ifndef KC_NO_GRAPHICS
+static int key_code_from_name(const char *name);
+
+/* nome de tecla vira scancode aqui, uma vez: input.key.w() -> input.key(26)
+   e input.key("w") / input.pressed("w") / input.released("w") -> (26).
+   Nome desconhecido fica como está e o builtin avisa quando rodar. */
+static void opt_input(Node *n) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_CALL: {
+            for (size_t i = 0; i < n->data.call.nargs; ++i) opt_input(n->data.call.args[i]);
+            const char *name = n->data.call.func_name;
+            if (strncmp(name, "input.key.", 10) == 0 && n->data.call.nargs == 0) {
+                int code = key_code_from_name(name + 10);
+                if (code < 0) break;
+                Node *num = node_alloc(node_span(n));
+                num->type = NODE_NUMBER;
+                num->data.num = code;
+                free(n->data.call.args);
+                n->data.call.args = calloc(4, sizeof(Node *));   /* como o parser: espaço pra 4 */
+                n->data.call.args[0] = num;
+                n->data.call.nargs = 1;
+                free(n->data.call.func_name);
+                n->data.call.func_name = strdup("input.key");
+            } else if ((strcmp(name, "input.key") == 0 || strcmp(name, "input.pressed") == 0 ||
+                        strcmp(name, "input.released") == 0) &&
+                       n->data.call.nargs >= 1 && n->data.call.args[0]->type == NODE_STRING) {
+                Node *arg = n->data.call.args[0];
+                int code = key_code_from_name(arg->data.str);
+                if (code < 0) break;
+                free(arg->data.str);
+                arg->type = NODE_NUMBER;
+                arg->data.num = code;
+            }
+            break;
+        }
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) opt_input(*p);
+            break;
+        case NODE_WHILE:
+            opt_input(n->data.while_node.cond);
+            opt_input(n->data.while_node.body);
+            break;
+        case NODE_IF:
+            opt_input(n->data.if_node.cond);
+            opt_input(n->data.if_node.then_body);
+            opt_input(n->data.if_node.else_body);
+            break;
+        case NODE_BINARY:
+            opt_input(n->data.bin.left);
+            opt_input(n->data.bin.right);
+            break;
+        case NODE_UNARY: opt_input(n->data.unary.operand); break;
+        case NODE_FUNC_DECL: opt_input(n->data.func_decl.body); break;
+        case NODE_CLASS_DECL: opt_input(n->data.class_decl.body); break;
+        case NODE_RETURN: opt_input(n->data.return_node.expr); break;
+        default: break;
+    }
+}
+#endif
+
+static void optimize_program(Node **program) {
+#ifndef KC_NO_GRAPHICS
+    for (Node **p = program; *p; ++p) opt_input(*p);
+#endif
+    for (Node **p = program; *p; ++p) opt_walk(*p);
+    for (Node **p = program; *p; ++p) opt_int(p);
+    for (Node **p = program; *p; ++p) opt_super(*p);
+    for (Node **p = program; *p; ++p) opt_stack(*p);   /* por último: conta os nós já trocados */
+}
+
 /*=====================================================================
  * 4.   VM:onde vai roda esse treco kk
  *===================================================================== */
@@ -999,32 +1851,43 @@ static Node **parse_program(void) {
 typedef struct {
     double *stack;
     size_t size;
-    size_t capacity;
+    size_t capacity;    /* profundidade máxima deste frame (stack_depth) */
+    double *limit;      /* fim da área onde os frames seguintes cabem */
 } Stack;
 
-static void stack_init(Stack *s) {
+/* A profundidade máxima de cada fuktion e do programa sai da AST
+   (stack_depth, 3b). O programa aloca uma área só; cada chamada abre o seu
+   frame logo acima do que o chamador usa e confere uma vez, na entrada, se
+   cabe (senão o frame vai pro heap). Por isso push/pop não checam limite nem
+   fazem realloc; com -DKC_DEBUG_STACK as checagens voltam e o exec_expr
+   ainda confere que cada nó deixa exatamente 1 valor. */
+#define KC_STACK_AREA 65536   /* doubles: 512 KB, muito mais que a recursão que cabe na pilha do C */
+
+static void stack_init(Stack *s, size_t depth) {
+    size_t area = depth > KC_STACK_AREA ? depth : KC_STACK_AREA;
     s->size = 0;
-    s->capacity = 32;
-    s->stack = calloc(s->capacity, sizeof(double));
+    s->capacity = depth ? depth : 1;
+    s->stack = malloc(area * sizeof(double));
+    s->limit = s->stack + area;
 }
-static void stack_push(Stack *s, double v) {
-    if (s->size == s->capacity) {
-        s->capacity *= 2;
-        s->stack = realloc(s->stack, s->capacity * sizeof(double));
-    }
+static inline void stack_push(Stack *s, double v) {
+#ifdef KC_DEBUG_STACK
+    if (s->size == s->capacity) kc_error(NULL, "Stack overflow (computed depth %zu)", s->capacity);
+#endif
     s->stack[s->size++] = v;
 }
-static double stack_pop(Stack *s) {
-    if (s->size == 0) {
-        fprintf(stderr, "Stack underflow\n");
-        exit(1);
-    }
+static inline double stack_pop(Stack *s) {
+#ifdef KC_DEBUG_STACK
+    if (s->size == 0) kc_error(NULL, "Stack underflow");
+#endif
     return s->stack[--s->size];
 }
 
 typedef struct VarPair {
     char *name;
-    double value;
+    double value;        /* sempre válido, mesmo quando is_int */
+    int64_t ival;        /* valor exato de uma conta inteira (acima de 2^53 o double perde bits) */
+    int is_int;
     struct VarPair *next;
 } VarPair;
 
@@ -1035,27 +1898,46 @@ typedef struct Env {
 
 static void env_init(Env *e, Env *parent) { e->head = NULL; e->parent = parent; }
 
-static void env_set(Env *e, const char *name, double val) {
+/* primeiro caractere antes do strcmp: a maioria dos nomes já difere ali */
+#define VAR_IS(p, nm) ((p)->name[0] == (nm)[0] && strcmp((p)->name, (nm)) == 0)
+
+static VarPair *env_slot(Env *e, const char *name) {
     VarPair *p = e->head;
-    while (p && strcmp(p->name, name) != 0) p = p->next;
-    if (p) { p->value = val; return; }
+    while (p && !VAR_IS(p, name)) p = p->next;
+    if (p) return p;
     p = malloc(sizeof(VarPair));
     p->name = strdup(name);
-    p->value = val;
     p->next = e->head;
     e->head = p;
+    return p;
 }
 
-static double env_get(Env *e, const char *name) {
-    Env *cur = e;
-    while (cur) {
+static void env_set(Env *e, const char *name, double val) {
+    VarPair *p = env_slot(e, name);
+    p->value = val;
+    p->is_int = 0;
+}
+
+static void env_set_int(Env *e, const char *name, int64_t val) {
+    VarPair *p = env_slot(e, name);
+    p->value = (double)val;
+    p->ival = val;
+    p->is_int = 1;
+}
+
+static VarPair *env_lookup(Env *e, const char *name) {
+    for (Env *cur = e; cur; cur = cur->parent) {
         VarPair *p = cur->head;
-        while (p && strcmp(p->name, name) != 0) p = p->next;
-        if (p) return p->value;
-        cur = cur->parent;
+        while (p && !VAR_IS(p, name)) p = p->next;
+        if (p) return p;
     }
-    fprintf(stderr, "Runtime error: undefined variable '%s'\n", name);
-    exit(1);
+    return NULL;
+}
+
+static double env_get(Env *e, const char *name) {
+    VarPair *p = env_lookup(e, name);
+    if (!p) kc_error(NULL, "Runtime error: undefined variable '%s'", name);
+    return p->value;
 }
 
 /*=====================================================================
@@ -1071,21 +1953,82 @@ typedef struct FuncEntry {
     long memlimit_bytes; /* bytes limit, -1 = not set */
     int memlimit_mode;   /* 1 = clear+restart, 0 = FIFO-evict */
     int memlimit_set;    /* 0 = no limit, 1 = set */
-    struct FuncEntry *next;
+    int prof_id;         /* nome internado do --profile, -1 = ainda não */
+    uint64_t hash;
+    struct FuncEntry *newer;   /* redefinição que substituiu esta; NULL = atual */
+    struct FuncEntry *next;    /* todas as versões, pra liberar no fim */
+    struct JitCode *jit;       /* --jit: corpo compilado (seção 7b), NULL = interpretado */
+    unsigned jit_calls;        /* chamadas até compilar */
+    int jit_failed;
+    uint32_t stack_max;        /* pilha do corpo (stack_depth, 3b) */
 } FuncEntry;
 
+/* Endereçamento aberto, nome -> versão atual. Redefinir não libera a versão
+   antiga: ela ganha `newer` e fica viva até free_function_table, então quem
+   guardou o ponteiro (cache do NODE_CALL, chamada em andamento) continua
+   seguro e só olha `newer` pra saber se ainda vale. Escrita é serializada
+   por g_func_lock; leitura não trava (slots e tabela publicados com
+   release, e a tabela velha de um crescimento também fica viva). */
+typedef struct FuncTable {
+    size_t mask;
+    FuncEntry **slots;
+    struct FuncTable *older;
+} FuncTable;
+
+static FuncTable *g_funcs = NULL;
+static size_t g_funcs_count = 0;
 static FuncEntry *func_table = NULL;
+static pthread_mutex_t g_func_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* helper: parse unit strings (kb, mb, gb) -> multiplier */
-static long unit_multiplier_from_string(const char *u) {
-    if (!u) return 1;
-    if (strcasecmp(u, "kb") == 0) return 1024L;
-    if (strcasecmp(u, "mb") == 0) return 1024L * 1024L;
-    if (strcasecmp(u, "gb") == 0) return 1024L * 1024L * 1024L;
-    return 1;
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+    return h;
 }
 
-/* compute approximate memory used */
+/* slot do nome, ou o vazio onde ele entraria */
+static size_t func_slot(FuncTable *t, const char *name, uint64_t hash) {
+    for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+        FuncEntry *e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+        if (!e || (e->hash == hash && strcmp(e->name, name) == 0)) return i;
+    }
+}
+
+/* com g_func_lock; fe já completa */
+static void func_publish(FuncEntry *fe) {
+    FuncTable *t = g_funcs;
+    if (!t || (g_funcs_count + 1) * 2 > t->mask + 1) {
+        FuncTable *nt = malloc(sizeof(FuncTable));
+        size_t cap = t ? (t->mask + 1) * 2 : 64;
+        nt->mask = cap - 1;
+        nt->slots = calloc(cap, sizeof(FuncEntry *));
+        nt->older = t;
+        if (t) {
+            for (size_t i = 0; i <= t->mask; ++i)
+                if (t->slots[i]) nt->slots[func_slot(nt, t->slots[i]->name, t->slots[i]->hash)] = t->slots[i];
+        }
+        __atomic_store_n(&g_funcs, nt, __ATOMIC_RELEASE);
+        t = nt;
+    }
+    size_t i = func_slot(t, fe->name, fe->hash);
+    FuncEntry *old = t->slots[i];
+    __atomic_store_n(&t->slots[i], fe, __ATOMIC_RELEASE);
+    if (old) __atomic_store_n(&old->newer, fe, __ATOMIC_RELEASE);
+    else g_funcs_count++;
+    fe->next = func_table;
+    func_table = fe;
+}
+
+/* helper: parse unit strings (kb, mb, gb) -> multiplier */
+static long unit_multiplier_from_string(const char *u) {
+    if (!u) return 1;
+    if (strcasecmp(u, "kb") == 0) return 1024L;
+    if (strcasecmp(u, "mb") == 0) return 1024L * 1024L;
+    if (strcasecmp(u, "gb") == 0) return 1024L * 1024L * 1024L;
+    return 1;
+}
+
+/* compute approximate memory used */
 static size_t compute_env_mem(Env *e) {
     if (!e) return 0;
     size_t total = 0;
@@ -1178,34 +2121,40 @@ static void scan_memlimit_in_body(Node *body, long *out_bytes, int *out_mode, in
     }
 }
 
+static FuncEntry *find_function(const char *name) {
+    FuncTable *t = __atomic_load_n(&g_funcs, __ATOMIC_ACQUIRE);
+    if (!t) return NULL;
+    return __atomic_load_n(&t->slots[func_slot(t, name, fnv1a(name))], __ATOMIC_ACQUIRE);
+}
+
 static void register_function(Node *fn_node) {
     if (!fn_node || fn_node->type != NODE_FUNC_DECL) return;
-    /* sempre sobrescrever  */
-    FuncEntry **pp = &func_table;
-    while (*pp) {
-        if (strcmp((*pp)->name, fn_node->data.func_decl.name) == 0) {
-            FuncEntry *rem = *pp;
-            *pp = rem->next;
-
-            free(rem->name);
-            for (size_t i = 0; i < rem->nparams; ++i) free(rem->params[i]);
-            free(rem->params);
-            free(rem);
-            break;
-        }
-        pp = &(*pp)->next;
+    /* a mesma declaração rodando de novo (fuktion dentro de fuktion, a cada
+       chamada): a versão atual já é ela, não publica cópia */
+    FuncEntry *cur = find_function(fn_node->data.func_decl.name);
+    if (cur && cur->body == fn_node->data.func_decl.body && cur->nparams == fn_node->data.func_decl.nparams) {
+        size_t i = 0;
+        while (i < cur->nparams && strcmp(cur->params[i], fn_node->data.func_decl.params[i]) == 0) ++i;
+        if (i == cur->nparams) return;
     }
-
+    /* senão sobrescrever (a versão antiga fica, ver func_publish) */
     FuncEntry *fe = malloc(sizeof(FuncEntry));
     fe->name = strdup(fn_node->data.func_decl.name);
+    fe->hash = fnv1a(fe->name);
+    fe->newer = NULL;
     fe->nparams = fn_node->data.func_decl.nparams;
     fe->params = calloc(fe->nparams, sizeof(char *));
     for (size_t i = 0; i < fe->nparams; ++i) fe->params[i] = strdup(fn_node->data.func_decl.params[i]);
     fe->body = fn_node->data.func_decl.body;
+    fe->stack_max = fn_node->data.func_decl.stack_max;
     /* os volor padrão ok */
     fe->memlimit_set = 0;
     fe->memlimit_bytes = -1;
     fe->memlimit_mode = 0;
+    fe->prof_id = -1;
+    fe->jit = NULL;
+    fe->jit_calls = 0;
+    fe->jit_failed = 0;
 
     {
         long bytes = -1; int mode = -1; int set = 0;
@@ -1238,20 +2187,16 @@ static void register_function(Node *fn_node) {
         }
     }
 
-    fe->next = func_table;
-    func_table = fe;
-}
-
-static FuncEntry *find_function(const char *name) {
-    for (FuncEntry *p = func_table; p; p = p->next)
-        if (strcmp(p->name, name) == 0) return p;
-    return NULL;
+    pthread_mutex_lock(&g_func_lock);
+    func_publish(fe);
+    pthread_mutex_unlock(&g_func_lock);
 }
 
 /*=====================================================================
  * 6.   Network 
  *===================================================================== */
 
+#ifndef KC_NO_NETWORK
 /* chamada  */
 static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
@@ -1273,854 +2218,5022 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
     strncat(*response_data, (char *)contents, realsize);
     return realsize;
 }
+#endif
 
-/*=====================================================================
- * 7.   Execution
- *===================================================================== */
+/* envia tudo: trata escrita parcial e EINTR */
+static ssize_t send_all(int sock, const char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(sock, buf + done, len - done, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
 
-static int returning_flag = 0;
-static double returning_value = 0.0;
+/* writev em lotes de IOV_MAX, avançando o iovec quando a escrita é parcial.
+   sendmsg em vez de writev só pelo MSG_NOSIGNAL: par fechado dá EPIPE, não SIGPIPE */
+static ssize_t writev_all(int sock, struct iovec *iov, int iovcnt) {
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+        int batch = iovcnt > IOV_MAX ? IOV_MAX : iovcnt;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = batch;
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++; iovcnt--;
+        }
+        if (iovcnt > 0 && n > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return total;
+}
 
-static void exec_node(Node *node, Stack *stack, Env *env);
-static void exec_expr(Node *node, Stack *stack, Env *env) {
-    if (!node) return;
-    if (returning_flag) return;
+/* manda o arquivo inteiro pro socket sem passar pelo userspace quando dá */
+static long long sendfile_all(int sock, int fd, off_t size) {
+    off_t off = 0;
+#ifdef __linux__
+    /* sendfile não aceita MSG_NOSIGNAL: SIGPIPE fica bloqueado enquanto ele roda e
+       o que ficar pendente por causa dele é consumido antes de desbloquear */
+    sigset_t pipe_set, old_set, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigpending(&pending);
+    int was_pending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    int failed = 0;
+    while (off < size) {
+        ssize_t n = sendfile(sock, fd, &off, (size_t)(size - off));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EINVAL && errno != ENOSYS) failed = 1;
+            break;                                 /* EINVAL/ENOSYS cai no fallback */
+        }
+        if (n == 0) break; /* arquivo encolheu */
+    }
+    if (!was_pending) {
+        struct timespec zero = { 0, 0 };
+        int saved = errno;
+        while (sigtimedwait(&pipe_set, NULL, &zero) == SIGPIPE) {}
+        errno = saved;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    if (failed) return -1;
+    if (off >= size) return (long long)off;
+    if (lseek(fd, off, SEEK_SET) < 0) return -1;
+#endif
+    char buf[64 * 1024];
+    while (off < size) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) break;
+        if (send_all(sock, buf, (size_t)r) < 0) return -1;
+        off += r;
+    }
+    return (long long)off;
+}
 
-    switch (node->type) {
-        case NODE_NUMBER:
-            stack_push(stack, node->data.num);
-            break;
+/*=====================================================================
+ * 6b.  Arquivos (leitura/escrita em streaming)
+ *===================================================================== */
 
-        case NODE_VAR:
-            stack_push(stack, env_get(env, node->data.var_name));
-            break;
+#define KC_MAX_FILES   64
+#define KC_FILE_BUF    (64 * 1024)
+#define KC_MMAP_MIN    (1L << 20)   /* leitura de arquivos >= 1 MB vai por mmap */
+#define KC_MMAP_DROP   (64L << 20)  /* devolve as páginas já lidas a cada 64 MB */
 
-        case NODE_STRING:
-            fprintf(stderr, "String literals not supported outside of 'print'.\n");
-            exit(1);
-            break;
+typedef struct {
+    int fd;
+    int writing;
+    int eof;
+    /* leitura via mmap */
+    char *map;
+    size_t map_len, map_pos, map_dropped;
+    /* buffer de leitura ou de escrita */
+    char *buf;
+    size_t buf_len, buf_pos;
+    /* registro atual (linha ou bloco); aponta pro map, pro buf ou pro rec_buf */
+    const char *rec;
+    size_t rec_len;
+    char *rec_buf;
+    size_t rec_cap;
+} KFile;
+
+static KFile *g_files[KC_MAX_FILES];
+
+static KFile *file_get(double handle) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_FILES) return NULL;
+    return g_files[h - 1];
+}
 
-        case NODE_UNARY: {
-            exec_expr(node->data.unary.operand, stack, env);
-            double v = stack_pop(stack);
-            double res = 0.0;
-            switch (node->data.unary.op) {
-                case OP_NEG:   res = -v; break;
-                case OP_NOT:   res = (v == 0.0) ? 1.0 : 0.0; break;
-                case OP_BITNOT:
-                    res = (double)~(int64_t)v;
-                    break;
-                default:
-                    fprintf(stderr, "Unknown unary operator (code %d)\n", node->data.unary.op);
-                    exit(1);
+static void file_rec_reserve(KFile *f, size_t need) {
+    if (need <= f->rec_cap) return;
+    size_t cap = f->rec_cap ? f->rec_cap : 256;
+    while (cap < need) cap *= 2;
+    f->rec_buf = realloc(f->rec_buf, cap);
+    f->rec_cap = cap;
+}
+
+/* mode: 'r', 'w' ou 'a'. retorna handle 1..KC_MAX_FILES ou 0 */
+static int file_open(const char *path, char mode) {
+    int slot = -1;
+    for (int i = 0; i < KC_MAX_FILES; ++i) if (!g_files[i]) { slot = i; break; }
+    if (slot < 0) { fprintf(stderr, "file.open: too many open files\n"); return 0; }
+
+    int flags = (mode == 'r') ? O_RDONLY
+              : (mode == 'a') ? (O_WRONLY | O_CREAT | O_APPEND)
+              : (O_WRONLY | O_CREAT | O_TRUNC);
+    int fd = open(path, flags, 0644);
+    if (fd < 0) return 0;
+
+    KFile *f = calloc(1, sizeof(KFile));
+    f->fd = fd;
+    f->writing = (mode != 'r');
+    if (!f->writing) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= KC_MMAP_MIN) {
+            void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                f->map = m;
+                f->map_len = (size_t)st.st_size;
+                posix_madvise(m, f->map_len, POSIX_MADV_SEQUENTIAL);
             }
-            stack_push(stack, res);
-            break;
         }
+    }
+    if (!f->map) f->buf = malloc(KC_FILE_BUF);
+    g_files[slot] = f;
+    return slot + 1;
+}
 
-        case NODE_BINARY: {
-            OpCode op = node->data.bin.op;
-            if (op == OP_ASSIGN) {
-                if (node->data.bin.left->type != NODE_VAR) {
-                    fprintf(stderr, "Runtime error: left side of '=' must be a variable\n");
-                    exit(1);
-                }
-                exec_expr(node->data.bin.right, stack, env);
-                double val = stack_pop(stack);
-                env_set(env, node->data.bin.left->data.var_name, val);
-                stack_push(stack, val);
-                break;
-            }
-            exec_expr(node->data.bin.left, stack, env);
-            exec_expr(node->data.bin.right, stack, env);
-            double r = stack_pop(stack);
-            double l = stack_pop(stack);
-            double res = 0.0;
-            switch (op) {
-                case OP_ADD:   res = l + r; break;
-                case OP_SUB:   res = l - r; break;
-                case OP_MUL:   res = l * r; break;
-                case OP_DIV:   res = l / r; break;
-                case OP_MOD:   res = fmod(l, r); break;
-                case OP_POW:   res = pow(l, r); break;
-                case OP_LT:    res = (l <  r) ? 1.0 : 0.0; break;
-                case OP_LE:    res = (l <= r) ? 1.0 : 0.0; break;
-                case OP_GT:    res = (l >  r) ? 1.0 : 0.0; break;
-                case OP_GE:    res = (l >= r) ? 1.0 : 0.0; break;
-                case OP_EQ:    res = (l == r) ? 1.0 : 0.0; break;
-                case OP_NE:    res = (l != r) ? 1.0 : 0.0; break;
-                case OP_BITAND:  res = (double)((int64_t)l & (int64_t)r); break;
-                case OP_BITOR:   res = (double)((int64_t)l | (int64_t)r); break;
-                case OP_BITXOR:  res = (double)((int64_t)l ^ (int64_t)r); break;
-                case OP_SHL:     res = (double)((int64_t)l << (int64_t)r); break;
-                case OP_SHR:     res = (double)((int64_t)l >> (int64_t)r); break;
-                case OP_LOGICAL_AND:
-                    res = (l != 0.0 && r != 0.0) ? 1.0 : 0.0; break;
-                case OP_LOGICAL_OR:
-                    res = (l != 0.0 || r != 0.0) ? 1.0 : 0.0; break;
-                default:
-                    fprintf(stderr, "Runtime error: unknown binary operator code %d\n", op);
-                    exit(1);
-            }
-            stack_push(stack, res);
-            break;
+static int file_flush(KFile *f) {
+    if (!f->writing) return 1;
+    size_t done = 0;
+    while (done < f->buf_len) {
+        ssize_t n = write(f->fd, f->buf + done, f->buf_len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
         }
+        done += (size_t)n;
+    }
+    f->buf_len = 0;
+    return 1;
+}
 
-        case NODE_CALL: {
-            if (strcmp(node->data.call.func_name, "print") == 0) {
-                for (size_t i = 0; i < node->data.call.nargs; ++i) {
-                    Node *arg = node->data.call.args[i];
-                    if (arg->type == NODE_STRING) {
-                        printf("%s ", arg->data.str);
-                    } else {
-                        exec_expr(arg, stack, env);
-                        double v = stack_pop(stack);
-                        printf("%g ", v);
-                    }
+static int file_write(KFile *f, const char *data, size_t len) {
+    if (f->buf_len + len > KC_FILE_BUF) {
+        if (!file_flush(f)) return 0;
+        if (len > KC_FILE_BUF) {
+            /* grande demais pro buffer: escreve direto */
+            size_t done = 0;
+            while (done < len) {
+                ssize_t n = write(f->fd, data + done, len - done);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return 0;
                 }
-                printf("\n");
-                break;
+                done += (size_t)n;
             }
+            return 1;
+        }
+    }
+    memcpy(f->buf + f->buf_len, data, len);
+    f->buf_len += len;
+    return 1;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.init") == 0) {
-                /* inicia o SDL2 + OpenGL se for pedido  */
-                if (g_graphics_initialized) { stack_push(stack, 1); break; }
-                if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-                    fprintf(stderr, "graphics.init: SDL_Init failed: %s\n", SDL_GetError());
-                    stack_push(stack, 0);
-                    break;
-                }
-                /*simple GL attributes */
-                SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
-                SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
-                SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-                g_sdl_window = SDL_CreateWindow("KoalCode", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                               g_window_width, g_window_height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-                if (!g_sdl_window) {
-                    fprintf(stderr, "graphics.init: SDL_CreateWindow failed: %s\n", SDL_GetError());
-                    SDL_Quit();
-                    stack_push(stack, 0);
-                    break;
-                }
-                g_gl_context = SDL_GL_CreateContext(g_sdl_window);
-                if (!g_gl_context) {
-                    fprintf(stderr, "graphics.init: SDL_GL_CreateContext failed: %s\n", SDL_GetError());
-                    SDL_DestroyWindow(g_sdl_window);
-                    g_sdl_window = NULL;
-                    SDL_Quit();
-                    stack_push(stack, 0);
-                    break;
-                }
-                SDL_GL_SetSwapInterval(1); /* vsync if available */
-                glViewport(0, 0, g_window_width, g_window_height);
-
-                glMatrixMode(GL_PROJECTION);
-                glLoadIdentity();
-                {
-                    /*(aqui vc entende o pq do M_PI nos includekkkk) compute aspect ratio and build a frustum for a ~60deg FOV */
-                    double aspect = (double)g_window_width / (double)g_window_height;
-                    double fov_deg = 60.0;
-                    double fov_rad = fov_deg * M_PI / 180.0;
-                    double near = 0.1;
-                    double top = near * tan(fov_rad * 0.5);
-                    double right = top * aspect;
-                    glFrustum(-right, right, -top, top, near, 100.0);
-                }
-                glMatrixMode(GL_MODELVIEW);
-
-                glEnable(GL_DEPTH_TEST);
-                g_graphics_initialized = 1;
-                stack_push(stack, 1);
-                break;
-            }
+static int file_close(double handle) {
+    KFile *f = file_get(handle);
+    if (!f) return 0;
+    int ok = file_flush(f);
+    if (f->map) munmap(f->map, f->map_len);
+    close(f->fd);
+    free(f->buf);
+    free(f->rec_buf);
+    free(f);
+    g_files[(long)handle - 1] = NULL;
+    return ok;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.quit") == 0) {
-                if (!g_graphics_initialized) { stack_push(stack, 0); break; }
-                SDL_GL_DeleteContext(g_gl_context);
-                SDL_DestroyWindow(g_sdl_window);
-                g_gl_context = NULL;
-                g_sdl_window = NULL;
-                SDL_Quit();
-                g_graphics_initialized = 0;
-                stack_push(stack, 1);
-                break;
-            }
+static void file_close_all(void) {
+    for (int i = 0; i < KC_MAX_FILES; ++i)
+        if (g_files[i]) file_close(i + 1);
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.clear") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.clear: not initialized\n"); stack_push(stack, 0); break; }
-                float r = 0.0f, g = 0.0f, b = 0.0f;
-                if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); r = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); g = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); b = (float)stack_pop(stack); }
-                glClearColor(r, g, b, 1.0f);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                stack_push(stack, 1);
-                break;
-            }
+/* recarrega o buffer de leitura; retorna bytes lidos (0 = EOF) */
+static ssize_t file_fill(KFile *f) {
+    ssize_t n;
+    do { n = read(f->fd, f->buf, KC_FILE_BUF); } while (n < 0 && errno == EINTR);
+    if (n <= 0) { f->eof = 1; n = 0; }
+    f->buf_len = (size_t)n;
+    f->buf_pos = 0;
+    return n;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.swap") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.swap: not initialized\n"); stack_push(stack, 0); break; }
-                SDL_GL_SwapWindow(g_sdl_window);
-                stack_push(stack, 1);
-                break;
-            }
+#ifdef MADV_DONTNEED
+/* o que já foi lido não volta: tira do RSS pra arquivos gigantes rodarem em memória constante */
+static void file_drop_consumed(KFile *f) {
+    if (f->map_pos - f->map_dropped < (size_t)KC_MMAP_DROP) return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t upto = f->map_pos & ~(page - 1);
+    if (upto > f->map_dropped) {
+        madvise(f->map + f->map_dropped, upto - f->map_dropped, MADV_DONTNEED);
+        f->map_dropped = upto;
+    }
+}
+#else
+static void file_drop_consumed(KFile *f) { (void)f; }
+#endif
 
-            if (strcmp(node->data.call.func_name, "graphics.color") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.color: not initialized\n"); stack_push(stack, 0); break; }
-                float r = 1.0f, g = 1.0f, b = 1.0f;
-                if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); r = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); g = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); b = (float)stack_pop(stack); }
-                glColor3f(r, g, b);
-                stack_push(stack, 1);
-                break;
-            }
+/* lê a próxima linha (sem '\n' nem '\r') pro registro atual; -1 no fim */
+static long file_readline(KFile *f) {
+    if (f->writing) return -1;
+    if (f->map) {
+        if (f->map_pos >= f->map_len) return -1;
+        const char *start = f->map + f->map_pos;
+        size_t rem = f->map_len - f->map_pos;
+        const char *nl = memchr(start, '\n', rem);
+        size_t len = nl ? (size_t)(nl - start) : rem;
+        f->map_pos += nl ? len + 1 : len;
+        file_drop_consumed(f);
+        if (len > 0 && start[len - 1] == '\r') len--;
+        f->rec = start;
+        f->rec_len = len;
+        return (long)len;
+    }
 
-            if (strcmp(node->data.call.func_name, "graphics.triangle") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.triangle: not initialized\n"); stack_push(stack, 0); break; }
-                double vals[9];
-                for (size_t i = 0; i < 9; ++i) {
-                    if (i < node->data.call.nargs) {
-                        exec_expr(node->data.call.args[i], stack, env);
-                        vals[i] = stack_pop(stack);
-                    } else vals[i] = 0.0;
-                }
-                glBegin(GL_TRIANGLES);
-                    glVertex3f((GLfloat)vals[0], (GLfloat)vals[1], (GLfloat)vals[2]);
-                    glVertex3f((GLfloat)vals[3], (GLfloat)vals[4], (GLfloat)vals[5]);
-                    glVertex3f((GLfloat)vals[6], (GLfloat)vals[7], (GLfloat)vals[8]);
-                glEnd();
-                stack_push(stack, 1);
-                break;
-            }
+    if (f->buf_pos >= f->buf_len && (f->eof || file_fill(f) == 0)) return -1;
+    const char *start = f->buf + f->buf_pos;
+    const char *nl = memchr(start, '\n', f->buf_len - f->buf_pos);
+    size_t len;
+    if (nl) {
+        /* caso comum: a linha inteira está no buffer, sem cópia */
+        len = (size_t)(nl - start);
+        f->buf_pos += len + 1;
+        f->rec = start;
+    } else {
+        /* linha atravessa o buffer: junta os pedaços no rec_buf */
+        len = 0;
+        while (1) {
+            size_t avail = f->buf_len - f->buf_pos;
+            nl = memchr(f->buf + f->buf_pos, '\n', avail);
+            size_t take = nl ? (size_t)(nl - (f->buf + f->buf_pos)) : avail;
+            file_rec_reserve(f, len + take);
+            memcpy(f->rec_buf + len, f->buf + f->buf_pos, take);
+            len += take;
+            f->buf_pos += take;
+            if (nl) { f->buf_pos++; break; }
+            if (file_fill(f) == 0) break;
+        }
+        f->rec = f->rec_buf;
+    }
+    if (len > 0 && f->rec[len - 1] == '\r') len--;
+    f->rec_len = len;
+    return (long)len;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.translate") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.translate: not initialized\n"); stack_push(stack, 0); break; }
-                float x = 0.0f, y = 0.0f, z = 0.0f;
-                if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); x = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); y = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); z = (float)stack_pop(stack); }
-                glTranslatef(x, y, z);
-                stack_push(stack, 1);
-                break;
-            }
+/* lê até n bytes pro registro atual; 0 no fim */
+static long file_read_chunk(KFile *f, size_t n) {
+    if (f->writing || n == 0) return 0;
+    if (f->map) {
+        size_t rem = f->map_len - f->map_pos;
+        size_t len = n < rem ? n : rem;
+        f->rec = f->map + f->map_pos;
+        f->rec_len = len;
+        f->map_pos += len;
+        file_drop_consumed(f);
+        return (long)len;
+    }
+    if (f->buf_pos >= f->buf_len && (f->eof || file_fill(f) == 0)) { f->rec_len = 0; return 0; }
+    size_t avail = f->buf_len - f->buf_pos;
+    if (n <= avail) {
+        f->rec = f->buf + f->buf_pos;
+        f->rec_len = n;
+        f->buf_pos += n;
+        return (long)n;
+    }
+    file_rec_reserve(f, n);
+    size_t len = 0;
+    while (len < n) {
+        if (f->buf_pos >= f->buf_len && file_fill(f) == 0) break;
+        size_t take = f->buf_len - f->buf_pos;
+        if (take > n - len) take = n - len;
+        memcpy(f->rec_buf + len, f->buf + f->buf_pos, take);
+        len += take;
+        f->buf_pos += take;
+    }
+    f->rec = f->rec_buf;
+    f->rec_len = len;
+    return (long)len;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.rotate") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.rotate: not initialized\n"); stack_push(stack, 0); break; }
-                float ang = 0.0f, x = 0.0f, y = 0.0f, z = 1.0f;
-                if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); ang = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); x = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); y = (float)stack_pop(stack); }
-                if (node->data.call.nargs >= 4) { exec_expr(node->data.call.args[3], stack, env); z = (float)stack_pop(stack); }
-                glRotatef(ang, x, y, z);
-                stack_push(stack, 1);
-                break;
-            }
+static int rec_contains(const char *rec, size_t len, const char *needle) {
+    size_t nlen = strlen(needle);
+    if (nlen == 0) return 1;
+    while (len >= nlen) {
+        const char *p = memchr(rec, needle[0], len - nlen + 1);
+        if (!p) return 0;
+        if (memcmp(p, needle, nlen) == 0) return 1;
+        len -= (size_t)(p - rec) + 1;
+        rec = p + 1;
+    }
+    return 0;
+}
 
-            if (strcmp(node->data.call.func_name, "graphics.loadmatrix") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.loadmatrix: not initialized\n"); stack_push(stack, 0); break; }
-                glLoadIdentity();
-                stack_push(stack, 1);
-                break;
-            }
+/*=====================================================================
+ * 6c.  Buffers numéricos (io.loadnums)
+ *===================================================================== */
 
-            if (strcmp(node->data.call.func_name, "graphics.events") == 0) {
-                if (!g_graphics_initialized) { fprintf(stderr, "graphics.events: not initialized\n"); stack_push(stack, 0); break; }
-                int count = 0;
-                SDL_Event ev;
-                while (SDL_PollEvent(&ev)) {
-                    count++;
-                    if (ev.type == SDL_QUIT) {
-                        stack_push(stack, -1);
-                        goto _after_graphics_events;
-                    }
-                }
-                stack_push(stack, count);
-                _after_graphics_events:
-                break;
-            }
+#define KC_MAX_BUFS        256
+#define KC_LOADNUMS_CHUNK  (256 * 1024)  /* menos que isso por thread não compensa */
+#define KC_LOADNUMS_THREADS 8
 
-            /* ========== NETWORK FUNCTIONS ========== */
-            
-            if (strcmp(node->data.call.func_name, "network.init") == 0) {
-                if (g_network_initialized) { stack_push(stack, 1); break; }
-                if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
-                    fprintf(stderr, "network.init: curl_global_init failed\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                g_curl_handle = curl_easy_init();
-                if (!g_curl_handle) {
-                    fprintf(stderr, "network.init: curl_easy_init failed\n");
-                    curl_global_cleanup();
-                    stack_push(stack, 0);
-                    break;
-                }
-                g_network_initialized = 1;
-                stack_push(stack, 1);
-                break;
-            }
+typedef struct {
+    double *data;
+    size_t len, cap;
+} NumBuf;
 
-            /* Limpeza do subsystema */
-            if (strcmp(node->data.call.func_name, "network.quit") == 0) {
-                if (!g_network_initialized) { stack_push(stack, 0); break; }
-                if (g_curl_handle) {
-                    curl_easy_cleanup(g_curl_handle);
-                    g_curl_handle = NULL;
-                }
-                curl_global_cleanup();
-                g_network_initialized = 0;
-                stack_push(stack, 1);
-                break;
-            }
+static NumBuf *g_bufs[KC_MAX_BUFS];
 
-            /* HTTP GET request */
-            if (strcmp(node->data.call.func_name, "http.get") == 0) {
-                if (!g_network_initialized) { fprintf(stderr, "http.get: network not initialized\n"); stack_push(stack, 0); break; }
-                if (node->data.call.nargs < 1) { fprintf(stderr, "http.get: URL required\n"); stack_push(stack, 0); break; }
-                
-                char *url = NULL;
-                if (node->data.call.args[0]->type == NODE_STRING) {
-                    url = strdup(node->data.call.args[0]->data.str);
-                } else {
-                    fprintf(stderr, "http.get: URL must be a string\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                CURLcode res;
-                long response_code;
-                char *response_data = malloc(1);
-                response_data[0] = '\0';
-                size_t response_size = 0;
-                
-                curl_easy_setopt(g_curl_handle, CURLOPT_URL, url);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEDATA, &response_data);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEHEADER, &response_size);
-                curl_easy_setopt(g_curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
-                curl_easy_setopt(g_curl_handle, CURLOPT_TIMEOUT, 30L);
-                
-                res = curl_easy_perform(g_curl_handle);
-                curl_easy_getinfo(g_curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
-                
-                if (res == CURLE_OK) {
-                    printf("HTTP GET Response (%ld): %s\n", response_code, response_data);
-                    stack_push(stack, (double)response_code);
-                } else {
-                    fprintf(stderr, "http.get failed: %s\n", curl_easy_strerror(res));
-                    stack_push(stack, 0);
-                }
-                
-                free(url);
-                free(response_data);
-                break;
-            }
+static NumBuf *buf_get(double handle) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_BUFS) return NULL;
+    return g_bufs[h - 1];
+}
 
-            /* HTTP POST request */
-            if (strcmp(node->data.call.func_name, "http.post") == 0) {
-                if (!g_network_initialized) { fprintf(stderr, "http.post: network not initialized\n"); stack_push(stack, 0); break; }
-                if (node->data.call.nargs < 2) { fprintf(stderr, "http.post: URL and data required\n"); stack_push(stack, 0); break; }
-                
-                char *url = NULL, *data = NULL;
-                if (node->data.call.args[0]->type == NODE_STRING) {
-                    url = strdup(node->data.call.args[0]->data.str);
-                } else {
-                    fprintf(stderr, "http.post: URL must be a string\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (node->data.call.args[1]->type == NODE_STRING) {
-                    data = strdup(node->data.call.args[1]->data.str);
-                } else {
-                    fprintf(stderr, "http.post: data must be a string\n");
-                    free(url);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                CURLcode res;
-                long response_code;
-                char *response_data = malloc(1);
-                response_data[0] = '\0';
-                size_t response_size = 0;
-                
-                curl_easy_setopt(g_curl_handle, CURLOPT_URL, url);
-                curl_easy_setopt(g_curl_handle, CURLOPT_POSTFIELDS, data);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEDATA, &response_data);
-                curl_easy_setopt(g_curl_handle, CURLOPT_WRITEHEADER, &response_size);
-                curl_easy_setopt(g_curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
-                curl_easy_setopt(g_curl_handle, CURLOPT_TIMEOUT, 30L);
-                
-                res = curl_easy_perform(g_curl_handle);
-                curl_easy_getinfo(g_curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
-                
-                if (res == CURLE_OK) {
-                    printf("HTTP POST Response (%ld): %s\n", response_code, response_data);
-                    stack_push(stack, (double)response_code);
-                } else {
-                    fprintf(stderr, "http.post failed: %s\n", curl_easy_strerror(res));
-                    stack_push(stack, 0);
-                }
-                
-                free(url);
-                free(data);
-                free(response_data);
-                break;
-            }
+/* guarda o buffer na tabela; retorna handle ou 0 */
+static int buf_register(NumBuf *b) {
+    for (int i = 0; i < KC_MAX_BUFS; ++i) {
+        if (!g_bufs[i]) { g_bufs[i] = b; return i + 1; }
+    }
+    fprintf(stderr, "buf: too many buffers\n");
+    free(b->data);
+    free(b);
+    return 0;
+}
 
-            /* Socket functions */
-            if (strcmp(node->data.call.func_name, "socket.connect") == 0) {
-                if (node->data.call.nargs < 2) { fprintf(stderr, "socket.connect: host and port required\n"); stack_push(stack, 0); break; }
-                
-                char *host = NULL;
-                int port = 0;
-                
-                if (node->data.call.args[0]->type == NODE_STRING) {
-                    host = strdup(node->data.call.args[0]->data.str);
-                } else {
-                    fprintf(stderr, "socket.connect: host must be a string\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (node->data.call.args[1]->type == NODE_NUMBER) {
-                    port = (int)node->data.call.args[1]->data.num;
-                } else {
-                    fprintf(stderr, "socket.connect: port must be a number\n");
-                    free(host);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                int sock = socket(AF_INET, SOCK_STREAM, 0);
-                if (sock < 0) {
-                    fprintf(stderr, "socket.connect: socket creation failed\n");
-                    free(host);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                struct sockaddr_in server_addr;
-                server_addr.sin_family = AF_INET;
-                server_addr.sin_port = htons(port);
-                
-                if (inet_pton(AF_INET, host, &server_addr.sin_addr) <= 0) {
-                    fprintf(stderr, "socket.connect: invalid address\n");
-                    close(sock);
-                    free(host);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-                    fprintf(stderr, "socket.connect: connection failed\n");
-                    close(sock);
-                    free(host);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                printf("Connected to %s:%d\n", host, port);
-                free(host);
-                stack_push(stack, (double)sock);
-                break;
-            }
+static void buf_free(double handle) {
+    NumBuf *b = buf_get(handle);
+    if (!b) return;
+    free(b->data);
+    free(b);
+    g_bufs[(long)handle - 1] = NULL;
+}
 
-            if (strcmp(node->data.call.func_name, "socket.send") == 0) {
-                if (node->data.call.nargs < 2) { fprintf(stderr, "socket.send: socket and data required\n"); stack_push(stack, 0); break; }
-                
-                int sock = 0;
-                char *data = NULL;
-                
-                if (node->data.call.args[0]->type == NODE_NUMBER) {
-                    sock = (int)node->data.call.args[0]->data.num;
-                } else {
-                    fprintf(stderr, "socket.send: socket must be a number\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (node->data.call.args[1]->type == NODE_STRING) {
-                    data = strdup(node->data.call.args[1]->data.str);
-                } else {
-                    fprintf(stderr, "socket.send: data must be a string\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                ssize_t bytes_sent = send(sock, data, strlen(data), 0);
-                if (bytes_sent < 0) {
-                    fprintf(stderr, "socket.send: send failed\n");
-                    free(data);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                printf("Sent %zd bytes: %s\n", bytes_sent, data);
-                free(data);
-                stack_push(stack, (double)bytes_sent);
-                break;
-            }
+static void buf_free_all(void) {
+    for (int i = 0; i < KC_MAX_BUFS; ++i) if (g_bufs[i]) buf_free(i + 1);
+}
 
-            if (strcmp(node->data.call.func_name, "socket.recv") == 0) {
-                if (node->data.call.nargs < 1) { fprintf(stderr, "socket.recv: socket required\n"); stack_push(stack, 0); break; }
-                
-                int sock = 0;
-                int buffer_size = 1024;
-                
-                if (node->data.call.args[0]->type == NODE_NUMBER) {
-                    sock = (int)node->data.call.args[0]->data.num;
-                } else {
-                    fprintf(stderr, "socket.recv: socket must be a number\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (node->data.call.nargs >= 2 && node->data.call.args[1]->type == NODE_NUMBER) {
-                    buffer_size = (int)node->data.call.args[1]->data.num;
-                }
-                
-                char *buffer = malloc(buffer_size);
-                ssize_t bytes_received = recv(sock, buffer, buffer_size - 1, 0);
-                
-                if (bytes_received < 0) {
-                    fprintf(stderr, "socket.recv: recv failed\n");
-                    free(buffer);
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                buffer[bytes_received] = '\0';
-                printf("Received %zd bytes: %s\n", bytes_received, buffer);
-                free(buffer);
-                stack_push(stack, (double)bytes_received);
-                break;
-            }
+static inline int is_num_sep(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == ';';
+}
 
-            if (strcmp(node->data.call.func_name, "socket.close") == 0) {
-                if (node->data.call.nargs < 1) { fprintf(stderr, "socket.close: socket required\n"); stack_push(stack, 0); break; }
-                
-                int sock = 0;
-                if (node->data.call.args[0]->type == NODE_NUMBER) {
-                    sock = (int)node->data.call.args[0]->data.num;
-                } else {
-                    fprintf(stderr, "socket.close: socket must be a number\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                if (close(sock) < 0) {
-                    fprintf(stderr, "socket.close: close failed\n");
-                    stack_push(stack, 0);
-                    break;
-                }
-                
-                printf("Socket %d closed\n", sock);
-                stack_push(stack, 1);
-                break;
+typedef struct {
+    const char *start, *end;
+    double *out;
+    size_t len, cap;
+} LoadNumsChunk;
+
+static void *loadnums_worker(void *arg) {
+    LoadNumsChunk *c = (LoadNumsChunk *)arg;
+    const char *p = c->start, *end = c->end;
+    c->cap = (size_t)(end - p) / 8 + 16;
+    c->out = malloc(c->cap * sizeof(double));
+    c->len = 0;
+    while (p < end) {
+        while (p < end && is_num_sep(*p)) p++;
+        if (p >= end) break;
+        double v;
+        size_t n = kc_parse_double(p, end, &v);
+        if (n && (p + n == end || is_num_sep(p[n]))) {
+            if (c->len == c->cap) {
+                c->cap *= 2;
+                c->out = realloc(c->out, c->cap * sizeof(double));
             }
+            c->out[c->len++] = v;
+            p += n;
+        } else {
+            /* cabeçalho de CSV ou lixo: pula o campo */
+            while (p < end && !is_num_sep(*p)) p++;
+        }
+    }
+    return NULL;
+}
 
-            /* Network utility functions */
-            if (strcmp(node->data.call.func_name, "network.ping") == 0) {
-                if (node->data.call.nargs < 1) { fprintf(stderr, "network.ping: host required\n"); stack_push(stack, 0); break; }
-                
-                char *host = NULL;
-                if (node->data.call.args[0]->type == NODE_STRING) {
-                    host = strdup(node->data.call.args[0]->data.str);
+/* mapeia o arquivo e parseia em paralelo, um pedaço por thread */
+static int loadnums(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "io.loadnums: cannot open '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return 0; }
+    size_t size = (size_t)st.st_size;
+
+    NumBuf *b = calloc(1, sizeof(NumBuf));
+    if (size == 0) { close(fd); return buf_register(b); }
+
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "io.loadnums: mmap failed: %s\n", strerror(errno));
+        free(b);
+        return 0;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = size / KC_LOADNUMS_CHUNK;
+    if (nthreads > (size_t)ncpu) nthreads = (size_t)ncpu;
+    if (nthreads > KC_LOADNUMS_THREADS) nthreads = KC_LOADNUMS_THREADS;
+    if (nthreads < 1) nthreads = 1;
+
+    /* corta nos separadores pra nenhum número ficar dividido entre threads */
+    LoadNumsChunk chunks[KC_LOADNUMS_THREADS];
+    const char *end = map + size;
+    const char *cur = map;
+    for (size_t i = 0; i < nthreads; ++i) {
+        const char *stop = (i == nthreads - 1) ? end : map + size * (i + 1) / nthreads;
+        if (stop < cur) stop = cur;
+        while (stop < end && !is_num_sep(*stop)) stop++;
+        chunks[i].start = cur;
+        chunks[i].end = stop;
+        cur = stop;
+    }
+
+    pthread_t tids[KC_LOADNUMS_THREADS];
+    int started[KC_LOADNUMS_THREADS] = {0};
+    for (size_t i = 1; i < nthreads; ++i)
+        started[i] = pthread_create(&tids[i], NULL, loadnums_worker, &chunks[i]) == 0;
+    loadnums_worker(&chunks[0]);
+    for (size_t i = 1; i < nthreads; ++i) {
+        if (started[i]) pthread_join(tids[i], NULL);
+        else loadnums_worker(&chunks[i]);
+    }
+    munmap(map, size);
+
+    size_t total = 0;
+    for (size_t i = 0; i < nthreads; ++i) total += chunks[i].len;
+    if (nthreads == 1) {
+        b->data = chunks[0].out;
+    } else {
+        b->data = malloc((total ? total : 1) * sizeof(double));
+        size_t off = 0;
+        for (size_t i = 0; i < nthreads; ++i) {
+            memcpy(b->data + off, chunks[i].out, chunks[i].len * sizeof(double));
+            off += chunks[i].len;
+            free(chunks[i].out);
+        }
+    }
+    b->len = b->cap = total;
+    return buf_register(b);
+}
+
+/*=====================================================================
+ * 6d.  Geometria em lote (graphics.triangle/line/point)
+ *===================================================================== */
+
+#ifndef KC_NO_GRAPHICS
+/* em vez de glBegin/glEnd por primitiva, os vértices vão pra um buffer
+   intercalado no CPU e saem num único glDrawArrays no swap ou quando
+   o estado muda (matriz, tipo de primitiva, clear) */
+#define KC_BATCH_MAX_VERTS 65535
+
+typedef struct { GLfloat x, y, z, r, g, b; } BatchVertex;
+
+static BatchVertex *g_batch = NULL;
+static size_t g_batch_len = 0;
+static GLenum g_batch_mode = GL_TRIANGLES;
+static GLfloat g_cur_color[3] = { 1.0f, 1.0f, 1.0f };
+
+/* chamadas de desenho e vértices do frame atual (graphics.stats) */
+static unsigned long g_frame_draws = 0;
+static unsigned long g_frame_verts = 0;
+
+static void batch_flush(void) {
+    if (g_batch_len == 0) return;
+    g_frame_draws++;
+    g_frame_verts += g_batch_len;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(BatchVertex), &g_batch[0].x);
+    glColorPointer(3, GL_FLOAT, sizeof(BatchVertex), &g_batch[0].r);
+    glDrawArrays(g_batch_mode, 0, (GLsizei)g_batch_len);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    /* a cor corrente fica indefinida depois de usar GL_COLOR_ARRAY */
+    glColor3fv(g_cur_color);
+    g_batch_len = 0;
+}
+
+/* reserva n vértices da primitiva mode, descarregando o lote se precisar */
+static BatchVertex *batch_reserve(GLenum mode, size_t n) {
+    if (mode != g_batch_mode || g_batch_len + n > KC_BATCH_MAX_VERTS) {
+        batch_flush();
+        g_batch_mode = mode;
+    }
+    BatchVertex *v = g_batch + g_batch_len;
+    g_batch_len += n;
+    return v;
+}
+
+static void batch_vertex(BatchVertex *v, double x, double y, double z) {
+    v->x = (GLfloat)x; v->y = (GLfloat)y; v->z = (GLfloat)z;
+    v->r = g_cur_color[0]; v->g = g_cur_color[1]; v->b = g_cur_color[2];
+}
+#endif /* KC_NO_GRAPHICS */
+
+/*=====================================================================
+ * 6e.  Contexto GL: janela SDL ou headless (EGL), captura de quadros
+ *===================================================================== */
+
+/* --headless / KOALCODE_HEADLESS=1: pbuffer EGL sem display, sem vsync.
+   --dump-frames arq / KOALCODE_DUMP_FRAMES=arq: cada graphics.swap vira um
+   quadro P6 concatenado no arquivo (".raw" = só os bytes RGB) */
+static int g_headless = 0;
+static const char *g_dump_path = NULL;
+
+/* relógio monotônico em segundos (também é o time.now) */
+static double kc_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#ifndef KC_NO_GRAPHICS
+#ifdef KC_WITH_EGL
+static EGLDisplay g_egl_display = EGL_NO_DISPLAY;
+static EGLSurface g_egl_surface = EGL_NO_SURFACE;
+static EGLContext g_egl_context = EGL_NO_CONTEXT;
+
+static void *egl_proc_address(const char *name) {
+    return (void *)eglGetProcAddress(name);
+}
+
+static int egl_open(int width, int height) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (get_platform_display)
+        g_egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#else
+    (void)get_platform_display;
+#endif
+    if (g_egl_display == EGL_NO_DISPLAY) g_egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (g_egl_display == EGL_NO_DISPLAY || !eglInitialize(g_egl_display, NULL, NULL)) {
+        fprintf(stderr, "graphics.init: no EGL display (0x%x)\n", eglGetError());
+        return 0;
+    }
+    static const EGLint config_attrs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint n = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(g_egl_display, config_attrs, &config, 1, &n) || n < 1) {
+        fprintf(stderr, "graphics.init: no EGL pbuffer config for desktop GL (0x%x)\n", eglGetError());
+        eglTerminate(g_egl_display);
+        g_egl_display = EGL_NO_DISPLAY;
+        return 0;
+    }
+    const EGLint pbuffer_attrs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    g_egl_surface = eglCreatePbufferSurface(g_egl_display, config, pbuffer_attrs);
+    g_egl_context = eglCreateContext(g_egl_display, config, EGL_NO_CONTEXT, NULL);
+    if (g_egl_surface == EGL_NO_SURFACE || g_egl_context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(g_egl_display, g_egl_surface, g_egl_surface, g_egl_context)) {
+        fprintf(stderr, "graphics.init: EGL context failed (0x%x)\n", eglGetError());
+        if (g_egl_context != EGL_NO_CONTEXT) eglDestroyContext(g_egl_display, g_egl_context);
+        if (g_egl_surface != EGL_NO_SURFACE) eglDestroySurface(g_egl_display, g_egl_surface);
+        eglTerminate(g_egl_display);
+        g_egl_display = EGL_NO_DISPLAY;
+        g_egl_surface = EGL_NO_SURFACE;
+        g_egl_context = EGL_NO_CONTEXT;
+        return 0;
+    }
+    eglSwapInterval(g_egl_display, 0);
+    return 1;
+}
+
+static void egl_close(void) {
+    if (g_egl_display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(g_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(g_egl_display, g_egl_context);
+    eglDestroySurface(g_egl_display, g_egl_surface);
+    eglTerminate(g_egl_display);
+    g_egl_display = EGL_NO_DISPLAY;
+    g_egl_surface = EGL_NO_SURFACE;
+    g_egl_context = EGL_NO_CONTEXT;
+}
+#endif
+
+static int gfx_open(void) {
+    if (g_headless) {
+#ifdef KC_WITH_EGL
+        if (!egl_open(g_window_width, g_window_height)) return 0;
+        gl_load_procs(egl_proc_address);
+        return 1;
+#else
+        fprintf(stderr, "graphics.init: headless mode needs a build with -DKC_WITH_EGL -lEGL\n");
+        return 0;
+#endif
+    }
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "graphics.init: SDL_Init failed: %s\n", SDL_GetError());
+        return 0;
+    }
+    /*simple GL attributes */
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    g_sdl_window = SDL_CreateWindow("KoalCode", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                   g_window_width, g_window_height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+    if (!g_sdl_window) {
+        fprintf(stderr, "graphics.init: SDL_CreateWindow failed: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 0;
+    }
+    g_gl_context = SDL_GL_CreateContext(g_sdl_window);
+    if (!g_gl_context) {
+        fprintf(stderr, "graphics.init: SDL_GL_CreateContext failed: %s\n", SDL_GetError());
+        SDL_DestroyWindow(g_sdl_window);
+        g_sdl_window = NULL;
+        SDL_Quit();
+        return 0;
+    }
+    SDL_GL_SetSwapInterval(1); /* vsync if available */
+    gl_load_procs(SDL_GL_GetProcAddress);
+    return 1;
+}
+
+/* leitura assíncrona: o quadro N vai pra um PBO e só é mapeado no swap N+1,
+   quando a GPU já terminou de copiar; sem PBO cai no glReadPixels direto */
+static FILE *g_dump_file = NULL;
+static int g_dump_raw = 0;
+static GLuint g_dump_pbo[2];
+static int g_dump_pending[2];
+static unsigned g_dump_index = 0;
+static unsigned char *g_dump_pixels = NULL;
+
+static void dump_open(void) {
+    if (!g_dump_path || g_dump_file) return;
+    g_dump_file = strcmp(g_dump_path, "-") == 0 ? stdout : fopen(g_dump_path, "wb");
+    if (!g_dump_file) { perror(g_dump_path); g_dump_path = NULL; return; }
+    size_t len = strlen(g_dump_path);
+    g_dump_raw = len > 4 && strcmp(g_dump_path + len - 4, ".raw") == 0;
+    size_t bytes = (size_t)g_window_width * (size_t)g_window_height * 3;
+    if (gl_has_buffers() && kc_glMapBuffer && kc_glUnmapBuffer) {
+        kc_glGenBuffers(2, g_dump_pbo);
+        for (int i = 0; i < 2; ++i) {
+            kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, g_dump_pbo[i]);
+            kc_glBufferData(GL_PIXEL_PACK_BUFFER, (ptrdiff_t)bytes, NULL, GL_STREAM_READ);
+        }
+        kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else {
+        g_dump_pixels = malloc(bytes);
+    }
+    g_dump_pending[0] = g_dump_pending[1] = 0;
+    g_dump_index = 0;
+}
+
+/* GL lê de baixo pra cima; PPM é de cima pra baixo */
+static void dump_write(const unsigned char *pixels) {
+    size_t row = (size_t)g_window_width * 3;
+    if (!g_dump_raw) fprintf(g_dump_file, "P6\n%d %d\n255\n", g_window_width, g_window_height);
+    for (int y = g_window_height - 1; y >= 0; --y)
+        fwrite(pixels + (size_t)y * row, 1, row, g_dump_file);
+}
+
+static void dump_collect(int slot) {
+    if (!g_dump_pending[slot]) return;
+    kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, g_dump_pbo[slot]);
+    const unsigned char *pixels = kc_glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        dump_write(pixels);
+        kc_glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    g_dump_pending[slot] = 0;
+}
+
+/* chamado antes do swap, com o quadro completo no back buffer */
+static void dump_frame(void) {
+    dump_open();
+    if (!g_dump_file) return;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (g_dump_pixels) {
+        glReadPixels(0, 0, g_window_width, g_window_height, GL_RGB, GL_UNSIGNED_BYTE, g_dump_pixels);
+        dump_write(g_dump_pixels);
+        return;
+    }
+    int slot = g_dump_index & 1;
+    kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, g_dump_pbo[slot]);
+    glReadPixels(0, 0, g_window_width, g_window_height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    kc_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    g_dump_pending[slot] = 1;
+    g_dump_index++;
+    dump_collect(g_dump_index & 1);
+}
+
+static void dump_close(void) {
+    if (!g_dump_file) return;
+    if (!g_dump_pixels) {
+        dump_collect(g_dump_index & 1);
+        dump_collect((g_dump_index + 1) & 1);
+        kc_glDeleteBuffers(2, g_dump_pbo);
+    }
+    free(g_dump_pixels);
+    g_dump_pixels = NULL;
+    if (g_dump_file == stdout) fflush(stdout);
+    else fclose(g_dump_file);
+    g_dump_file = NULL;
+}
+
+/* ---------- tempo de frame e limitador ---------- */
+
+#define KC_FRAME_HISTORY 240   /* ~4 s a 60 fps */
+
+static double g_frame_ms[KC_FRAME_HISTORY];
+static size_t g_frame_count = 0;       /* total de frames medidos */
+static double g_last_swap = 0.0;
+static unsigned long g_last_draws = 0, g_last_verts = 0;
+static double g_fps_target = 0.0;
+static double g_next_deadline = 0.0;
+
+static void sleep_until(double t) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - (double)ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static int gfx_set_swap_interval(int interval) {
+#ifdef KC_WITH_EGL
+    if (g_headless) return eglSwapInterval(g_egl_display, interval) ? 1 : 0;
+#endif
+    return SDL_GL_SetSwapInterval(interval) == 0;
+}
+
+/* fecha o frame: limita o fps, registra o tempo desde o swap anterior */
+static void frame_end(void) {
+    double now = kc_now();
+    if (g_fps_target > 0) {
+        double period = 1.0 / g_fps_target;
+        if (g_next_deadline == 0.0 || now - g_next_deadline > period) g_next_deadline = now; /* atrasou: não tenta recuperar */
+        g_next_deadline += period;
+        if (g_next_deadline > now) { sleep_until(g_next_deadline); now = kc_now(); }
+    }
+    if (g_last_swap > 0.0)
+        g_frame_ms[g_frame_count++ % KC_FRAME_HISTORY] = (now - g_last_swap) * 1000.0;
+    g_last_swap = now;
+    g_last_draws = g_frame_draws;
+    g_last_verts = g_frame_verts;
+    g_frame_draws = 0;
+    g_frame_verts = 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* métrica sobre os últimos KC_FRAME_HISTORY frames; -1 se o nome não existe */
+static double frame_stat(const char *metric) {
+    if (strcmp(metric, "draws") == 0) return (double)g_last_draws;
+    if (strcmp(metric, "verts") == 0) return (double)g_last_verts;
+    if (strcmp(metric, "frames") == 0) return (double)g_frame_count;
+
+    size_t n = g_frame_count < KC_FRAME_HISTORY ? g_frame_count : KC_FRAME_HISTORY;
+    if (n == 0) return 0.0;
+    double sorted[KC_FRAME_HISTORY];
+    double sum = 0.0;
+    memcpy(sorted, g_frame_ms, n * sizeof(double));
+    for (size_t i = 0; i < n; ++i) sum += sorted[i];
+    if (strcmp(metric, "avg") == 0) return sum / (double)n;
+    if (strcmp(metric, "fps") == 0) return sum > 0 ? 1000.0 * (double)n / sum : 0.0;
+    if (strcmp(metric, "last") == 0) return g_frame_ms[(g_frame_count - 1) % KC_FRAME_HISTORY];
+
+    double p;
+    if (strcmp(metric, "p50") == 0) p = 0.50;
+    else if (strcmp(metric, "p95") == 0) p = 0.95;
+    else if (strcmp(metric, "p99") == 0) p = 0.99;
+    else if (strcmp(metric, "max") == 0) p = 1.0;
+    else if (strcmp(metric, "min") == 0) p = 0.0;
+    else return -1.0;
+    qsort(sorted, n, sizeof(double), cmp_double);
+    return sorted[(size_t)(p * (double)(n - 1) + 0.5)];
+}
+
+static void gfx_swap(void) {
+    if (g_dump_path) dump_frame();
+#ifdef KC_WITH_EGL
+    if (g_headless) { eglSwapBuffers(g_egl_display, g_egl_surface); frame_end(); return; }
+#endif
+    SDL_GL_SwapWindow(g_sdl_window);
+    frame_end();
+}
+
+static void gfx_close(void) {
+    dump_close();
+#ifdef KC_WITH_EGL
+    if (g_headless) { egl_close(); return; }
+#endif
+    SDL_GL_DeleteContext(g_gl_context);
+    SDL_DestroyWindow(g_sdl_window);
+    g_gl_context = NULL;
+    g_sdl_window = NULL;
+    SDL_Quit();
+}
+
+/* ---------- entrada: um retrato do teclado/mouse por graphics.events ---------- */
+
+/* bits de g_input.keys[scancode] */
+enum { KEY_DOWN = 1, KEY_PRESSED = 2, KEY_RELEASED = 4 };
+
+typedef struct {
+    uint8_t keys[SDL_NUM_SCANCODES];
+    uint16_t changed[SDL_NUM_SCANCODES];   /* teclas com bits de borda a limpar */
+    int nchanged;
+    int mouse_x, mouse_y;
+    int rel_x, rel_y;                      /* acumulados no frame */
+    int wheel;
+    uint8_t buttons;                       /* bit (botão - 1) */
+} InputState;
+
+static InputState g_input;
+
+static void input_key_event(int code, int down) {
+    if (code < 0 || code >= SDL_NUM_SCANCODES) return;
+    uint8_t k = g_input.keys[code];
+    if (down == (k & KEY_DOWN)) return;    /* auto-repeat */
+    if (!(k & (KEY_PRESSED | KEY_RELEASED))) g_input.changed[g_input.nchanged++] = (uint16_t)code;
+    g_input.keys[code] = down ? (uint8_t)(k | KEY_DOWN | KEY_PRESSED) : (uint8_t)((k & ~KEY_DOWN) | KEY_RELEASED);
+}
+
+/* esvazia a fila do SDL; retorna o número de eventos ou -1 se pediram pra fechar */
+static int input_pump(void) {
+    for (int i = 0; i < g_input.nchanged; ++i) g_input.keys[g_input.changed[i]] &= KEY_DOWN;
+    g_input.nchanged = 0;
+    g_input.rel_x = g_input.rel_y = g_input.wheel = 0;
+    if (g_headless) return 0;   /* headless não tem fila de eventos */
+
+    int count = 0, quit = 0;
+    SDL_Event ev;
+    while (SDL_PollEvent(&ev)) {
+        count++;
+        switch (ev.type) {
+            case SDL_QUIT: quit = 1; break;
+            case SDL_KEYDOWN: input_key_event(ev.key.keysym.scancode, 1); break;
+            case SDL_KEYUP: input_key_event(ev.key.keysym.scancode, 0); break;
+            case SDL_MOUSEMOTION:
+                g_input.mouse_x = ev.motion.x;
+                g_input.mouse_y = ev.motion.y;
+                g_input.rel_x += ev.motion.xrel;
+                g_input.rel_y += ev.motion.yrel;
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEBUTTONUP:
+                if (ev.button.button >= 1 && ev.button.button <= 8) {
+                    uint8_t bit = (uint8_t)(1u << (ev.button.button - 1));
+                    if (ev.type == SDL_MOUSEBUTTONDOWN) g_input.buttons |= bit;
+                    else g_input.buttons &= (uint8_t)~bit;
+                }
+                break;
+            case SDL_MOUSEWHEEL: g_input.wheel += ev.wheel.y; break;
+            default: break;
+        }
+    }
+    return quit ? -1 : count;
+}
+
+static const struct { const char *name; int code; } g_key_names[] = {
+    { "space", SDL_SCANCODE_SPACE }, { "enter", SDL_SCANCODE_RETURN }, { "return", SDL_SCANCODE_RETURN },
+    { "escape", SDL_SCANCODE_ESCAPE }, { "esc", SDL_SCANCODE_ESCAPE }, { "tab", SDL_SCANCODE_TAB },
+    { "backspace", SDL_SCANCODE_BACKSPACE },
+    { "up", SDL_SCANCODE_UP }, { "down", SDL_SCANCODE_DOWN }, { "left", SDL_SCANCODE_LEFT }, { "right", SDL_SCANCODE_RIGHT },
+    { "shift", SDL_SCANCODE_LSHIFT }, { "lshift", SDL_SCANCODE_LSHIFT }, { "rshift", SDL_SCANCODE_RSHIFT },
+    { "ctrl", SDL_SCANCODE_LCTRL }, { "lctrl", SDL_SCANCODE_LCTRL }, { "rctrl", SDL_SCANCODE_RCTRL },
+    { "alt", SDL_SCANCODE_LALT }, { "lalt", SDL_SCANCODE_LALT }, { "ralt", SDL_SCANCODE_RALT },
+};
+
+/* "w", "7", "f5", "space"... -> scancode; -1 se não conhece */
+static int key_code_from_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 1 && isalpha((unsigned char)name[0])) return SDL_SCANCODE_A + (tolower((unsigned char)name[0]) - 'a');
+    if (len == 1 && name[0] >= '1' && name[0] <= '9') return SDL_SCANCODE_1 + (name[0] - '1');
+    if (len == 1 && name[0] == '0') return SDL_SCANCODE_0;
+    if ((name[0] == 'f' || name[0] == 'F') && len >= 2 && len <= 3 && isdigit((unsigned char)name[1])) {
+        int n = atoi(name + 1);
+        if (n >= 1 && n <= 12) return SDL_SCANCODE_F1 + n - 1;
+    }
+    for (size_t i = 0; i < sizeof g_key_names / sizeof g_key_names[0]; ++i)
+        if (strcasecmp(name, g_key_names[i].name) == 0) return g_key_names[i].code;
+    return -1;
+}
+#endif /* KC_NO_GRAPHICS */
+
+/*=====================================================================
+ * 6f.  Matrizes 4x4, vetores e quatérnios (mat.* / vec.* / quat.*)
+ *===================================================================== */
+
+/* matrizes em double, coluna por coluna (mesma ordem do OpenGL), vão direto
+   pro glLoadMatrixd; vec3 e quat usam os primeiros 3/4 elementos */
+enum { MATH_MAT4 = 1, MATH_VEC3, MATH_QUAT };
+
+typedef struct {
+    int kind;
+    double v[16];
+} MathObj;
+
+#define KC_MAX_MATH 4096
+
+static MathObj *g_math[KC_MAX_MATH];
+
+static MathObj *math_get(double handle, int kind) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_MATH || !g_math[h - 1] || g_math[h - 1]->kind != kind) return NULL;
+    return g_math[h - 1];
+}
+
+static int math_new(int kind) {
+    for (int i = 0; i < KC_MAX_MATH; ++i) {
+        if (g_math[i]) continue;
+        MathObj *o = calloc(1, sizeof(MathObj));
+        o->kind = kind;
+        g_math[i] = o;
+        return i + 1;
+    }
+    return 0;
+}
+
+static int math_free(double handle) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_MATH || !g_math[h - 1]) return 0;
+    free(g_math[h - 1]);
+    g_math[h - 1] = NULL;
+    return 1;
+}
+
+static void math_free_all(void) {
+    for (int i = 0; i < KC_MAX_MATH; ++i) { free(g_math[i]); g_math[i] = NULL; }
+}
+
+static void mat4_identity(double *m) {
+    memset(m, 0, 16 * sizeof(double));
+    m[0] = m[5] = m[10] = m[15] = 1.0;
+}
+
+/* out = a * b (out pode ser a ou b) */
+static void mat4_mul(double *out, const double *a, const double *b) {
+    double r[16];
+#ifdef KC_SSE2
+    /* cada coluna do resultado = combinação das colunas de a; 2 doubles por registrador */
+    __m128d a0l = _mm_loadu_pd(a + 0),  a0h = _mm_loadu_pd(a + 2);
+    __m128d a1l = _mm_loadu_pd(a + 4),  a1h = _mm_loadu_pd(a + 6);
+    __m128d a2l = _mm_loadu_pd(a + 8),  a2h = _mm_loadu_pd(a + 10);
+    __m128d a3l = _mm_loadu_pd(a + 12), a3h = _mm_loadu_pd(a + 14);
+    for (int j = 0; j < 4; ++j) {
+        __m128d b0 = _mm_set1_pd(b[j * 4 + 0]), b1 = _mm_set1_pd(b[j * 4 + 1]);
+        __m128d b2 = _mm_set1_pd(b[j * 4 + 2]), b3 = _mm_set1_pd(b[j * 4 + 3]);
+        __m128d lo = _mm_add_pd(_mm_add_pd(_mm_mul_pd(a0l, b0), _mm_mul_pd(a1l, b1)),
+                                _mm_add_pd(_mm_mul_pd(a2l, b2), _mm_mul_pd(a3l, b3)));
+        __m128d hi = _mm_add_pd(_mm_add_pd(_mm_mul_pd(a0h, b0), _mm_mul_pd(a1h, b1)),
+                                _mm_add_pd(_mm_mul_pd(a2h, b2), _mm_mul_pd(a3h, b3)));
+        _mm_storeu_pd(r + j * 4, lo);
+        _mm_storeu_pd(r + j * 4 + 2, hi);
+    }
+#else
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+            r[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] + a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+#endif
+    memcpy(out, r, sizeof r);
+}
+
+/* m = m * T, igual ao glTranslate */
+static void mat4_translate(double *m, double x, double y, double z) {
+    for (int i = 0; i < 4; ++i) m[12 + i] += m[i] * x + m[4 + i] * y + m[8 + i] * z;
+}
+
+static void mat4_scale(double *m, double x, double y, double z) {
+    for (int i = 0; i < 4; ++i) { m[i] *= x; m[4 + i] *= y; m[8 + i] *= z; }
+}
+
+static void mat4_from_quat(double *m, const double *q) {
+    double x = q[0], y = q[1], z = q[2], w = q[3];
+    mat4_identity(m);
+    m[0] = 1 - 2 * (y * y + z * z); m[4] = 2 * (x * y - z * w);     m[8] = 2 * (x * z + y * w);
+    m[1] = 2 * (x * y + z * w);     m[5] = 1 - 2 * (x * x + z * z); m[9] = 2 * (y * z - x * w);
+    m[2] = 2 * (x * z - y * w);     m[6] = 2 * (y * z + x * w);     m[10] = 1 - 2 * (x * x + y * y);
+}
+
+static void quat_from_axis(double *q, double deg, double x, double y, double z) {
+    double len = sqrt(x * x + y * y + z * z);
+    double half = deg * M_PI / 360.0;
+    double s = len > 0 ? sin(half) / len : 0.0;
+    q[0] = x * s; q[1] = y * s; q[2] = z * s; q[3] = cos(half);
+}
+
+/* m = m * R(deg, eixo), igual ao glRotate */
+static void mat4_rotate(double *m, double deg, double x, double y, double z) {
+    double q[4], r[16];
+    quat_from_axis(q, deg, x, y, z);
+    mat4_from_quat(r, q);
+    mat4_mul(m, m, r);
+}
+
+static void mat4_perspective(double *m, double fov_deg, double aspect, double near, double far) {
+    double f = 1.0 / tan(fov_deg * M_PI / 360.0);
+    memset(m, 0, 16 * sizeof(double));
+    m[0] = f / aspect;
+    m[5] = f;
+    m[10] = (far + near) / (near - far);
+    m[11] = -1.0;
+    m[14] = 2.0 * far * near / (near - far);
+}
+
+static void vec3_cross(double *out, const double *a, const double *b) {
+    double r0 = a[1] * b[2] - a[2] * b[1];
+    double r1 = a[2] * b[0] - a[0] * b[2];
+    double r2 = a[0] * b[1] - a[1] * b[0];
+    out[0] = r0; out[1] = r1; out[2] = r2;
+}
+
+static void vec3_normalize(double *out, const double *a) {
+    double len = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    double inv = len > 0 ? 1.0 / len : 0.0;
+    out[0] = a[0] * inv; out[1] = a[1] * inv; out[2] = a[2] * inv;
+}
+
+/* câmera igual ao gluLookAt */
+static void mat4_lookat(double *m, const double *eye, const double *target, const double *up) {
+    double f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    double side[3], u[3];
+    vec3_normalize(f, f);
+    vec3_cross(side, f, up);
+    vec3_normalize(side, side);
+    vec3_cross(u, side, f);
+    mat4_identity(m);
+    m[0] = side[0]; m[4] = side[1]; m[8] = side[2];
+    m[1] = u[0];    m[5] = u[1];    m[9] = u[2];
+    m[2] = -f[0];   m[6] = -f[1];   m[10] = -f[2];
+    mat4_translate(m, -eye[0], -eye[1], -eye[2]);
+}
+
+/* inversa geral por cofatores; 0 se a matriz é singular */
+static int mat4_invert(double *out, const double *m) {
+    double inv[16];
+    inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+    double det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det == 0.0) return 0;
+    det = 1.0 / det;
+    for (int i = 0; i < 16; ++i) out[i] = inv[i] * det;
+    return 1;
+}
+
+static void quat_mul(double *out, const double *a, const double *b) {
+    double x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+    double y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+    double z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+    double w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+    out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+}
+
+static void quat_slerp(double *out, const double *a, const double *b, double t) {
+    double d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    double sign = 1.0;
+    if (d < 0) { d = -d; sign = -1.0; }   /* caminho mais curto */
+    double wa, wb;
+    if (d > 0.9995) {
+        wa = 1.0 - t; wb = t;              /* quase iguais: lerp */
+    } else {
+        double th = acos(d), sn = sin(th);
+        wa = sin((1.0 - t) * th) / sn;
+        wb = sin(t * th) / sn;
+    }
+    double r[4], len = 0;
+    for (int i = 0; i < 4; ++i) { r[i] = wa * a[i] + sign * wb * b[i]; len += r[i] * r[i]; }
+    len = len > 0 ? 1.0 / sqrt(len) : 0.0;
+    for (int i = 0; i < 4; ++i) out[i] = r[i] * len;
+}
+
+/* aplica m em count pontos xyz guardados a cada stride doubles; divide por w
+   só se a matriz for projetiva (última linha != 0 0 0 1) */
+static void mat4_transform_points(const double *m, double *p, size_t count, size_t stride) {
+    int projective = m[3] != 0.0 || m[7] != 0.0 || m[11] != 0.0 || m[15] != 1.0;
+#ifdef KC_SSE2
+    __m128d c0l = _mm_loadu_pd(m + 0),  c0h = _mm_loadu_pd(m + 2);
+    __m128d c1l = _mm_loadu_pd(m + 4),  c1h = _mm_loadu_pd(m + 6);
+    __m128d c2l = _mm_loadu_pd(m + 8),  c2h = _mm_loadu_pd(m + 10);
+    __m128d c3l = _mm_loadu_pd(m + 12), c3h = _mm_loadu_pd(m + 14);
+    for (size_t i = 0; i < count; ++i, p += stride) {
+        __m128d x = _mm_set1_pd(p[0]), y = _mm_set1_pd(p[1]), z = _mm_set1_pd(p[2]);
+        __m128d xy = _mm_add_pd(_mm_add_pd(_mm_mul_pd(c0l, x), _mm_mul_pd(c1l, y)), _mm_add_pd(_mm_mul_pd(c2l, z), c3l));
+        __m128d zw = _mm_add_pd(_mm_add_pd(_mm_mul_pd(c0h, x), _mm_mul_pd(c1h, y)), _mm_add_pd(_mm_mul_pd(c2h, z), c3h));
+        if (projective) {
+            __m128d w = _mm_unpackhi_pd(zw, zw);
+            xy = _mm_div_pd(xy, w);
+            zw = _mm_div_pd(zw, w);
+        }
+        _mm_storeu_pd(p, xy);
+        _mm_store_sd(p + 2, zw);
+    }
+#else
+    for (size_t i = 0; i < count; ++i, p += stride) {
+        double x = p[0], y = p[1], z = p[2];
+        double rx = m[0] * x + m[4] * y + m[8] * z + m[12];
+        double ry = m[1] * x + m[5] * y + m[9] * z + m[13];
+        double rz = m[2] * x + m[6] * y + m[10] * z + m[14];
+        if (projective) {
+            double w = m[3] * x + m[7] * y + m[11] * z + m[15];
+            rx /= w; ry /= w; rz /= w;
+        }
+        p[0] = rx; p[1] = ry; p[2] = rz;
+    }
+#endif
+}
+
+/*=====================================================================
+ * 6g.  Profiler por amostragem (--profile)
+ *===================================================================== */
+
+/* SIGPROF a cada 1 ms de CPU: o handler só soma contadores já alocados.
+   A pilha de chamadas é uma árvore (pai, função) -> nó; cada chamada de
+   fuktion desce um nó e a volta restaura o anterior, então o handler só
+   precisa do nó atual. O nó da AST em execução dá a linha. O timer anda
+   na granularidade do tick do kernel, então o tempo por amostra sai do
+   CPU total medido dividido pelo número de amostras. */
+#define KC_PROF_HZ     1000
+#define KC_PROF_NODES  65536            /* cheio = conta no chamador */
+#define KC_PROF_HASH   (KC_PROF_NODES * 2)
+
+typedef struct {
+    int parent, func;                   /* func: índice em g_prof_names (0 = topo do script) */
+    unsigned long self;                 /* amostras com esse nó no topo */
+    unsigned long calls;
+} ProfNode;
+
+static int g_profiling = 0;
+static ProfNode g_prof_tree[KC_PROF_NODES];
+static int g_prof_tree_len = 1;
+static int g_prof_child[KC_PROF_HASH];  /* nó+1; 0 = vazio */
+static volatile int g_prof_cur = 0;
+static volatile unsigned long g_prof_samples = 0;
+static unsigned long *g_prof_line_hits = NULL;
+static size_t g_prof_nlines = 0;
+static char **g_prof_names = NULL;
+static size_t g_prof_nnames = 0, g_prof_cap_names = 0;
+static const char *g_prof_src = NULL;   /* pro texto das linhas no relatório */
+static const char *g_prof_out = "koalcode.folded";
+static double g_prof_cpu_start = 0.0;
+
+static double prof_cpu_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void prof_on_sigprof(int sig) {
+    (void)sig;
+    g_prof_tree[g_prof_cur].self++;
+    Node *n = g_cur_node;
+    uint32_t line = n && n->id < g_nspans ? g_spans[n->id].line : 0;
+    if (line > 0 && line <= g_prof_nlines) g_prof_line_hits[line - 1]++;
+    g_prof_samples++;
+}
+
+static int prof_intern(const char *name) {
+    for (size_t i = 0; i < g_prof_nnames; ++i)
+        if (strcmp(g_prof_names[i], name) == 0) return (int)i;
+    if (g_prof_nnames == g_prof_cap_names) {
+        g_prof_cap_names = g_prof_cap_names ? g_prof_cap_names * 2 : 64;
+        g_prof_names = realloc(g_prof_names, g_prof_cap_names * sizeof(char *));
+    }
+    g_prof_names[g_prof_nnames] = strdup(name);
+    return (int)g_prof_nnames++;
+}
+
+/* entra na função: acha/cria o filho (nó atual, fe) na árvore */
+static void prof_enter(FuncEntry *fe) {
+    if (fe->prof_id < 0) fe->prof_id = prof_intern(fe->name);
+    int parent = g_prof_cur, func = fe->prof_id;
+    size_t h = ((size_t)parent * 2654435761u + (size_t)func) & (KC_PROF_HASH - 1);
+    while (g_prof_child[h]) {
+        int c = g_prof_child[h] - 1;
+        if (g_prof_tree[c].parent == parent && g_prof_tree[c].func == func) {
+            g_prof_tree[c].calls++;
+            g_prof_cur = c;
+            return;
+        }
+        h = (h + 1) & (KC_PROF_HASH - 1);
+    }
+    if (g_prof_tree_len >= KC_PROF_NODES) return;
+    int c = g_prof_tree_len;
+    g_prof_tree[c].parent = parent;
+    g_prof_tree[c].func = func;
+    g_prof_tree[c].self = 0;
+    g_prof_tree[c].calls = 1;
+    g_prof_tree_len = c + 1;
+    g_prof_child[h] = c + 1;
+    g_prof_cur = c;
+}
+
+static void prof_report(void);
+
+static void prof_start(const char *src, size_t len) {
+    size_t lines = 1;
+    for (size_t i = 0; i < len; ++i) if (src[i] == '\n') lines++;
+    g_prof_src = src;
+    g_prof_nlines = lines;
+    g_prof_line_hits = calloc(lines, sizeof(unsigned long));
+    prof_intern("main");
+    g_prof_tree[0].parent = -1;
+    g_prof_tree[0].calls = 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = prof_on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &sa, NULL);
+    struct itimerval it;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / KC_PROF_HZ;
+    it.it_value = it.it_interval;
+    g_prof_cpu_start = prof_cpu_time();
+    setitimer(ITIMER_PROF, &it, NULL);
+    g_profiling = 1;
+    atexit(prof_report);   /* exit() de dentro do script também gera relatório */
+}
+
+typedef struct { int func; unsigned long self, total, calls; } ProfFunc;
+
+static int prof_cmp_total(const void *a, const void *b) {
+    const ProfFunc *x = a, *y = b;
+    if (x->total != y->total) return x->total < y->total ? 1 : -1;
+    return x->self < y->self ? 1 : x->self > y->self ? -1 : 0;
+}
+
+static int prof_cmp_line(const void *a, const void *b) {
+    unsigned long x = g_prof_line_hits[*(const size_t *)a], y = g_prof_line_hits[*(const size_t *)b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* início da linha n (0-based) no fonte */
+static const char *prof_line_text(size_t n, int *len) {
+    const char *p = g_prof_src;
+    for (size_t i = 0; i < n && p; ++i) { p = strchr(p, '\n'); if (p) p++; }
+    if (!p) { *len = 0; return ""; }
+    while (*p == ' ' || *p == '\t') p++;
+    const char *e = strchr(p, '\n');
+    size_t l = e ? (size_t)(e - p) : strlen(p);
+    *len = l > 60 ? 60 : (int)l;
+    return p;
+}
+
+/* relatório plano (stderr) + pilhas colapsadas "main;f;g N" pro flamegraph.pl */
+static void prof_report(void) {
+    if (!g_profiling) return;
+    g_profiling = 0;
+    struct itimerval off;
+    memset(&off, 0, sizeof off);
+    setitimer(ITIMER_PROF, &off, NULL);
+    signal(SIGPROF, SIG_IGN);
+    fflush(stdout);
+
+    unsigned long total = g_prof_samples;
+    double cpu = prof_cpu_time() - g_prof_cpu_start;
+    double ms = total ? cpu * 1000.0 / (double)total : 0.0;
+    ProfFunc *funcs = calloc(g_prof_nnames, sizeof(ProfFunc));
+    int *seen = malloc(g_prof_nnames * sizeof(int));
+    int *path = malloc((size_t)g_prof_tree_len * sizeof(int));
+    for (size_t f = 0; f < g_prof_nnames; ++f) { funcs[f].func = (int)f; seen[f] = -1; }
+
+    FILE *out = fopen(g_prof_out, "w");
+    if (!out) fprintf(stderr, "profile: cannot write %s: %s\n", g_prof_out, strerror(errno));
+    for (int i = 0; i < g_prof_tree_len; ++i) {
+        ProfNode *pn = &g_prof_tree[i];
+        funcs[pn->func].calls += pn->calls;
+        if (!pn->self) continue;
+        funcs[pn->func].self += pn->self;
+        /* inclusivo: cada função conta uma vez por caminho (recursão não duplica) */
+        int depth = 0;
+        for (int c = i; c >= 0; c = g_prof_tree[c].parent) {
+            path[depth++] = g_prof_tree[c].func;
+            if (seen[g_prof_tree[c].func] != i) {
+                seen[g_prof_tree[c].func] = i;
+                funcs[g_prof_tree[c].func].total += pn->self;
+            }
+        }
+        if (out) {
+            for (int d = depth - 1; d >= 0; --d) fprintf(out, "%s%s", g_prof_names[path[d]], d ? ";" : "");
+            fprintf(out, " %lu\n", pn->self);
+        }
+    }
+    if (out) fclose(out);
+
+    qsort(funcs, g_prof_nnames, sizeof(ProfFunc), prof_cmp_total);
+    double pct = total ? 100.0 / (double)total : 0.0;
+    fprintf(stderr, "\n--- profile: %lu samples, %.3f s CPU (stacks in %s) ---\n",
+            total, cpu, g_prof_out);
+    fprintf(stderr, "%8s %10s %8s %10s %10s  %s\n", "self%", "self ms", "total%", "total ms", "calls", "function");
+    for (size_t f = 0; f < g_prof_nnames; ++f) {
+        if (!funcs[f].total && !funcs[f].calls) continue;
+        fprintf(stderr, "%7.2f%% %10.1f %7.2f%% %10.1f %10lu  %s\n",
+                (double)funcs[f].self * pct, (double)funcs[f].self * ms,
+                (double)funcs[f].total * pct, (double)funcs[f].total * ms,
+                funcs[f].calls, g_prof_names[funcs[f].func]);
+    }
+
+    size_t nhot = 0;
+    size_t *lines = malloc(g_prof_nlines * sizeof(size_t));
+    for (size_t l = 0; l < g_prof_nlines; ++l) if (g_prof_line_hits[l]) lines[nhot++] = l;
+    qsort(lines, nhot, sizeof(size_t), prof_cmp_line);
+    fprintf(stderr, "\n%8s %10s %6s  %s\n", "samples%", "ms", "line", "source");
+    for (size_t k = 0; k < nhot && k < 20; ++k) {
+        int tl;
+        const char *text = prof_line_text(lines[k], &tl);
+        fprintf(stderr, "%7.2f%% %10.1f %6zu  %.*s\n", (double)g_prof_line_hits[lines[k]] * pct,
+                (double)g_prof_line_hits[lines[k]] * ms, lines[k] + 1, tl, text);
+    }
+
+    free(lines);
+    free(path);
+    free(seen);
+    free(funcs);
+}
+
+/*=====================================================================
+ * 6h.  Contadores por builtin/fuktion (stats.dump / --stats)
+ *===================================================================== */
+
+#ifndef KC_NO_STATS
+/* Cada NODE_CALL resolve um id pelo nome na primeira execução. Cada thread
+   escreve só no seu shard (load+store relaxed, sem lock nem xadd) e quem lê
+   soma os shards. Toda chamada conta; o tempo só é medido em ~1 de cada
+   KC_STATS_SAMPLE chamadas (sorteio por thread, sem privilegiar a primeira) e o
+   total é extrapolado. O tempo é self: a chamada medida cronometra as chamadas
+   filhas diretas (argumentos incluídos) e desconta, então recursão não conta a
+   mesma coisa várias vezes e a extrapolação fecha com o tempo de parede.
+   Histograma log-linear estilo HDR: 8 faixas por potência de 2 de ns, então
+   p50/p99 saem com erro de no máximo 12.5%. */
+#define KC_STATS_MAX     1024            /* nomes distintos; depois disso não conta */
+#define KC_STATS_SAMPLE  64              /* potência de 2 */
+#define KC_STATS_SUB     3
+#define KC_STATS_BUCKETS (40 << KC_STATS_SUB)   /* até ~2^42 ns */
+
+typedef struct KcStatShard {
+    uint64_t calls[KC_STATS_MAX];
+    uint64_t timed[KC_STATS_MAX];
+    uint64_t ns[KC_STATS_MAX];
+    uint64_t max_ns[KC_STATS_MAX];
+    uint32_t (*hist)[KC_STATS_BUCKETS];  /* uma linha por id; calloc, página só quando usada */
+    struct KcStatShard *next;
+} KcStatShard;
+
+static char *g_stat_names[KC_STATS_MAX];
+static unsigned char g_stat_is_fn[KC_STATS_MAX];   /* 1 = fuktion do script (a tabela já sumiu na saída) */
+static int g_stat_count = 1;             /* id 0 fica livre */
+static KcStatShard *g_stat_shards = NULL;
+static pthread_mutex_t g_stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread KcStatShard *t_stat_shard = NULL;
+
+/* chamada cronometrada. Ficam numa pilha por thread (não no frame C do
+   exec_expr, que limita a profundidade da recursão) */
+typedef struct {
+    uint64_t t0, child_ns;
+    int prev;               /* t_stat_open de quando abriu */
+    uint32_t nchild;
+    int sampled;            /* 0 = só cronometrada pro pai descontar */
+} KcStatFrame;
+static __thread KcStatFrame *t_stat_frames = NULL;
+static __thread int t_stat_top = 0, t_stat_cap = 0;
+static __thread int t_stat_open = -1;   /* medida mais interna: os filhos diretos somam nela */
+static __thread uint32_t t_stat_skip = KC_STATS_SAMPLE / 2, t_stat_rng = 0x9e3779b9u;
+
+#define STAT_LOAD(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STAT_ADD(p, v)   __atomic_store_n((p), STAT_LOAD(p) + (v), __ATOMIC_RELAXED)
+
+static uint64_t stats_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* custo de um stats_ns(), descontado do self de cada amostra (uma leitura
+   própria + uma por filho cronometrado); senão uma fuktion curta parece mais lenta */
+static uint64_t g_stat_clock_ns = 0;
+
+static KcStatShard *stats_shard(void) {
+    if (!t_stat_shard) {
+        uint64_t best = UINT64_MAX, prev = stats_ns();
+        for (int i = 0; i < 64; ++i) {
+            uint64_t now = stats_ns();
+            if (now - prev < best) best = now - prev;
+            prev = now;
+        }
+        __atomic_store_n(&g_stat_clock_ns, best, __ATOMIC_RELAXED);
+        KcStatShard *sh = calloc(1, sizeof *sh);
+        sh->hist = calloc(KC_STATS_MAX, sizeof *sh->hist);
+        pthread_mutex_lock(&g_stat_lock);
+        sh->next = g_stat_shards;
+        g_stat_shards = sh;
+        pthread_mutex_unlock(&g_stat_lock);
+        t_stat_shard = sh;
+    }
+    return t_stat_shard;
+}
+
+/* -1 = tabela cheia (o nó para de tentar) */
+static int stats_intern(const char *name) {
+    int id = -1;
+    pthread_mutex_lock(&g_stat_lock);
+    for (int i = 1; i < g_stat_count; ++i)
+        if (strcmp(g_stat_names[i], name) == 0) { id = i; break; }
+    if (id < 0 && g_stat_count < KC_STATS_MAX) {
+        id = g_stat_count;
+        g_stat_names[id] = strdup(name);
+        __atomic_store_n(&g_stat_count, id + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_stat_lock);
+    return id;
+}
+
+static int stats_bucket(uint64_t d) {
+    if (d < (1u << KC_STATS_SUB)) return (int)d;
+    int shift = 63 - __builtin_clzll(d) - KC_STATS_SUB;
+    int b = ((shift + 1) << KC_STATS_SUB) + (int)((d >> shift) & ((1u << KC_STATS_SUB) - 1));
+    return b < KC_STATS_BUCKETS ? b : KC_STATS_BUCKETS - 1;
+}
+
+/* meio da faixa, em ns */
+static double stats_bucket_mid(int b) {
+    if (b < (1 << KC_STATS_SUB)) return (double)b;
+    int shift = (b >> KC_STATS_SUB) - 1;
+    double lo = (double)(((uint64_t)(1u << KC_STATS_SUB) + (uint64_t)(b & ((1 << KC_STATS_SUB) - 1))) << shift);
+    return lo + (double)((uint64_t)1 << shift) * 0.5;
+}
+
+/* conta a chamada; 1 = cronometrada (stats_end tem que fechar), 0 = não */
+static inline int stats_begin(Node *node) {
+    int id = node->data.call.stat_id;
+    if (id <= 0) {
+        if (id < 0) return 0;
+        id = node->data.call.stat_id = stats_intern(node->data.call.func_name);
+        if (id < 0) return 0;
+    }
+    KcStatShard *sh = t_stat_shard ? t_stat_shard : stats_shard();
+    STAT_ADD(&sh->calls[id], 1);
+    int sampled = 0;
+    if (t_stat_skip-- == 0) {
+        /* próximo intervalo sorteado em [0, 2*SAMPLE-2]: média SAMPLE, sem casar com o período de um laço */
+        uint32_t x = t_stat_rng;
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        t_stat_rng = x;
+        t_stat_skip = x % (2 * KC_STATS_SAMPLE - 1);
+        sampled = 1;
+    }
+    if (!sampled && t_stat_open < 0) return 0;
+    if (t_stat_top == t_stat_cap) {
+        t_stat_cap = t_stat_cap ? t_stat_cap * 2 : 64;
+        t_stat_frames = realloc(t_stat_frames, (size_t)t_stat_cap * sizeof(KcStatFrame));
+    }
+    KcStatFrame *f = &t_stat_frames[t_stat_top];
+    f->prev = t_stat_open;
+    f->child_ns = 0;
+    f->nchild = 0;
+    f->sampled = sampled;
+    t_stat_open = sampled ? t_stat_top : -1;   /* netos de uma chamada não medida não precisam de relógio */
+    t_stat_top++;
+    f->t0 = stats_ns();
+    return 1;
+}
+
+static void stats_end(Node *node) {
+    KcStatFrame *f = &t_stat_frames[--t_stat_top];
+    uint64_t d = stats_ns() - f->t0;
+    t_stat_open = f->prev;
+    if (f->prev >= 0) { t_stat_frames[f->prev].child_ns += d; t_stat_frames[f->prev].nchild++; }
+    if (!f->sampled) return;
+    uint64_t spent = f->child_ns + (1 + (uint64_t)f->nchild) * g_stat_clock_ns;
+    d = d > spent ? d - spent : 0;
+    int id = node->data.call.stat_id;
+    KcStatShard *sh = t_stat_shard;
+    STAT_ADD(&sh->timed[id], 1);
+    STAT_ADD(&sh->ns[id], d);
+    if (d > STAT_LOAD(&sh->max_ns[id])) __atomic_store_n(&sh->max_ns[id], d, __ATOMIC_RELAXED);
+    STAT_ADD(&sh->hist[id][stats_bucket(d)], 1);
+}
+
+typedef struct { int id; uint64_t calls, timed, ns, max_ns; double total_ns; } StatRow;
+
+static int stats_cmp_total(const void *a, const void *b) {
+    double x = ((const StatRow *)a)->total_ns, y = ((const StatRow *)b)->total_ns;
+    return (x < y) - (x > y);
+}
+
+static double stats_percentile(const uint32_t *hist, uint64_t timed, uint64_t max_ns, double q) {
+    uint64_t rank = (uint64_t)ceil(q * (double)timed), seen = 0;
+    if (rank < 1) rank = 1;
+    for (int b = 0; b < KC_STATS_BUCKETS; ++b) {
+        seen += hist[b];
+        if (seen >= rank) return fmin(stats_bucket_mid(b), (double)max_ns);
+    }
+    return 0.0;
+}
+
+/* soma os shards e imprime, do maior tempo total pro menor; devolve quantos nomes */
+static int stats_dump(FILE *out) {
+    int n = __atomic_load_n(&g_stat_count, __ATOMIC_ACQUIRE);
+    StatRow *rows = calloc((size_t)n, sizeof(StatRow));
+    uint32_t (*hist)[KC_STATS_BUCKETS] = calloc((size_t)n, sizeof *hist);
+    uint64_t all = 0;
+    pthread_mutex_lock(&g_stat_lock);
+    for (KcStatShard *sh = g_stat_shards; sh; sh = sh->next) {
+        for (int id = 1; id < n; ++id) {
+            uint64_t c = STAT_LOAD(&sh->calls[id]);
+            if (!c) continue;
+            rows[id].calls += c;
+            rows[id].timed += STAT_LOAD(&sh->timed[id]);
+            rows[id].ns += STAT_LOAD(&sh->ns[id]);
+            uint64_t mx = STAT_LOAD(&sh->max_ns[id]);
+            if (mx > rows[id].max_ns) rows[id].max_ns = mx;
+            for (int b = 0; b < KC_STATS_BUCKETS; ++b) hist[id][b] += STAT_LOAD(&sh->hist[id][b]);
+        }
+    }
+    pthread_mutex_unlock(&g_stat_lock);
+
+    int used = 0;
+    for (int id = 1; id < n; ++id) {
+        if (!rows[id].calls) continue;
+        rows[id].id = id;
+        rows[id].total_ns = rows[id].timed ? (double)rows[id].ns * (double)rows[id].calls / (double)rows[id].timed : 0.0;
+        all += rows[id].calls;
+        rows[used++] = rows[id];
+    }
+    qsort(rows, (size_t)used, sizeof(StatRow), stats_cmp_total);
+
+    fflush(stdout);
+    fprintf(out, "\n--- stats: %d names, %llu calls (self time, sampled ~1/%d) ---\n",
+            used, (unsigned long long)all, KC_STATS_SAMPLE);
+    fprintf(out, "%12s %11s %10s %10s %10s %10s  %-7s %s\n",
+            "calls", "self ms", "mean us", "p50 us", "p99 us", "max us", "kind", "name");
+    for (int r = 0; r < used; ++r) {
+        StatRow *row = &rows[r];
+        const char *kind = g_stat_is_fn[row->id] ? "fn" : "builtin";
+        if (!row->timed) {   /* poucas chamadas: o sorteio ainda não caiu em nenhuma */
+            fprintf(out, "%12llu %11s %10s %10s %10s %10s  %-7s %s\n", (unsigned long long)row->calls,
+                    "-", "-", "-", "-", "-", kind, g_stat_names[row->id]);
+            continue;
+        }
+        double mean = (double)row->ns / (double)row->timed;
+        fprintf(out, "%12llu %11.3f %10.3f %10.3f %10.3f %10.3f  %-7s %s\n",
+                (unsigned long long)row->calls, row->total_ns * 1e-6, mean * 1e-3,
+                stats_percentile(hist[row->id], row->timed, row->max_ns, 0.50) * 1e-3,
+                stats_percentile(hist[row->id], row->timed, row->max_ns, 0.99) * 1e-3,
+                (double)row->max_ns * 1e-3,
+                kind, g_stat_names[row->id]);
+    }
+    fprintf(out, "%12s %11s  %s\n", "fires", "sites", "superinstruction");
+    for (int k = 0; k < SUPER_KINDS; ++k)
+        if (g_super_sites[k])
+            fprintf(out, "%12llu %11llu  %s\n", (unsigned long long)g_super_fires[k],
+                    (unsigned long long)g_super_sites[k], g_super_names[k]);
+    fflush(out);
+    free(hist);
+    free(rows);
+    return used;
+}
+
+static void stats_report(void) { stats_dump(stderr); }
+#endif
+
+/*=====================================================================
+ * 7.   Execution
+ *===================================================================== */
+
+static int returning_flag = 0;
+static double returning_value = 0.0;
+
+static void exec_node(Node *node, Stack *stack, Env *env);
+static void exec_expr(Node *node, Stack *stack, Env *env);
+static int g_jit = 0;   /* --jit */
+#ifdef KC_JIT
+static int jit_run(FuncEntry *fe, Env *local, Stack *stack);
+static void jit_free(struct JitCode *jc);
+#endif
+#ifndef KC_NO_GRAPHICS
+static int model_load(const char *path);
+static Model3D *model_get(double handle);
+static int model_draw(Model3D *m);
+static void model_free(double handle);
+static void model_free_all(void);
+static int texture_load(const char *path);
+static Texture *texture_get(double handle);
+static int texture_state(Texture *t);
+static int texture_bind(double handle);
+static int texture_release(double handle);
+static void texture_pump(void);
+static void texture_free_all(void);
+static size_t g_tex_budget;
+#endif
+
+/* builtins que precisam de SDL/GL carregados */
+static int gfx_builtin_name(const char *name) {
+    return strncmp(name, "graphics.", 9) == 0 || strncmp(name, "texture.", 8) == 0 || strncmp(name, "model.", 6) == 0;
+}
+
+/* avalia o argumento i da chamada como número (def se não foi passado) */
+static double call_arg_num(Node *node, size_t i, Stack *stack, Env *env, double def) {
+    if (i >= node->data.call.nargs) return def;
+    exec_expr(node->data.call.args[i], stack, env);
+    return stack_pop(stack);
+}
+
+/* mat.* / vec.* / quat.*: os argumentos são todos números (valores ou handles) */
+static void math_builtin(const char *name, Node *node, Stack *stack, Env *env) {
+    double a[6] = { 0, 0, 0, 0, 0, 0 };
+    size_t nargs = node->data.call.nargs;
+    for (size_t i = 0; i < nargs; ++i) {
+        double v = call_arg_num(node, i, stack, env, 0);
+        if (i < 6) a[i] = v;
+    }
+    MathObj *m, *x, *y, *z;
+
+    if (strcmp(name, "mat.free") == 0 || strcmp(name, "vec.free") == 0 || strcmp(name, "quat.free") == 0) {
+        stack_push(stack, math_free(a[0]));
+        return;
+    }
+
+    /* ---------- mat ---------- */
+    if (strcmp(name, "mat.new") == 0) {
+        int h = math_new(MATH_MAT4);
+        if (!h) fprintf(stderr, "mat.new: too many objects\n");
+        else mat4_identity(g_math[h - 1]->v);
+        stack_push(stack, h);
+        return;
+    }
+    if (strncmp(name, "mat.", 4) == 0 && strcmp(name, "mat.mul") != 0 && strcmp(name, "mat.copy") != 0 &&
+        strcmp(name, "mat.invert") != 0) {
+        if (!(m = math_get(a[0], MATH_MAT4))) { fprintf(stderr, "%s: invalid matrix\n", name); stack_push(stack, 0); return; }
+        if (strcmp(name, "mat.identity") == 0) mat4_identity(m->v);
+        else if (strcmp(name, "mat.translate") == 0) mat4_translate(m->v, a[1], a[2], a[3]);
+        else if (strcmp(name, "mat.rotate") == 0) mat4_rotate(m->v, a[1], a[2], a[3], a[4]);
+        else if (strcmp(name, "mat.scale") == 0) {
+            if (nargs <= 2) a[2] = a[3] = a[1];   /* escala uniforme */
+            mat4_scale(m->v, a[1], a[2], a[3]);
+        }
+        else if (strcmp(name, "mat.perspective") == 0) mat4_perspective(m->v, a[1], a[2], a[3], a[4]);
+        else if (strcmp(name, "mat.lookat") == 0) {
+            if (!(x = math_get(a[1], MATH_VEC3)) || !(y = math_get(a[2], MATH_VEC3)) || !(z = math_get(a[3], MATH_VEC3))) {
+                fprintf(stderr, "mat.lookat: eye, target and up must be vectors\n"); stack_push(stack, 0); return;
+            }
+            mat4_lookat(m->v, x->v, y->v, z->v);
+        }
+        else if (strcmp(name, "mat.fromquat") == 0) {
+            if (!(x = math_get(a[1], MATH_QUAT))) { fprintf(stderr, "mat.fromquat: invalid quaternion\n"); stack_push(stack, 0); return; }
+            mat4_from_quat(m->v, x->v);
+        }
+        else if (strcmp(name, "mat.get") == 0 || strcmp(name, "mat.set") == 0) {
+            int row = (int)a[1], col = (int)a[2];
+            if (row < 0 || row > 3 || col < 0 || col > 3) { fprintf(stderr, "%s: row/col out of range\n", name); stack_push(stack, 0); return; }
+            if (name[4] == 'g') { stack_push(stack, m->v[col * 4 + row]); return; }
+            m->v[col * 4 + row] = a[3];
+        }
+        else if (strcmp(name, "mat.transform") == 0) {
+            /* transforma em lugar os pontos xyz de um buffer; retorna quantos */
+            NumBuf *b = buf_get(a[1]);
+            size_t stride = nargs >= 3 ? (size_t)a[2] : 3;
+            if (!b) { fprintf(stderr, "mat.transform: invalid buffer\n"); stack_push(stack, 0); return; }
+            if (stride < 3) { fprintf(stderr, "mat.transform: stride must be >= 3\n"); stack_push(stack, 0); return; }
+            size_t count = b->len >= 3 ? (b->len - 3) / stride + 1 : 0;
+            mat4_transform_points(m->v, b->data, count, stride);
+            stack_push(stack, (double)count);
+            return;
+        }
+        else { fprintf(stderr, "Unknown function: %s\n", name); stack_push(stack, 0); return; }
+        stack_push(stack, 1);
+        return;
+    }
+    if (strncmp(name, "mat.", 4) == 0) {
+        if (!(m = math_get(a[0], MATH_MAT4)) || !(x = math_get(a[1], MATH_MAT4)) ||
+            (strcmp(name, "mat.mul") == 0 && !(y = math_get(a[2], MATH_MAT4)))) {
+            fprintf(stderr, "%s: invalid matrix\n", name); stack_push(stack, 0); return;
+        }
+        if (strcmp(name, "mat.mul") == 0) mat4_mul(m->v, x->v, y->v);
+        else if (strcmp(name, "mat.copy") == 0) memcpy(m->v, x->v, sizeof m->v);
+        else if (!mat4_invert(m->v, x->v)) { stack_push(stack, 0); return; }   /* singular */
+        stack_push(stack, 1);
+        return;
+    }
+
+    /* ---------- vec ---------- */
+    if (strcmp(name, "vec.new") == 0) {
+        int h = math_new(MATH_VEC3);
+        if (!h) fprintf(stderr, "vec.new: too many objects\n");
+        else { g_math[h - 1]->v[0] = a[0]; g_math[h - 1]->v[1] = a[1]; g_math[h - 1]->v[2] = a[2]; }
+        stack_push(stack, h);
+        return;
+    }
+    if (strncmp(name, "vec.", 4) == 0) {
+        if (!(m = math_get(a[0], MATH_VEC3))) { fprintf(stderr, "%s: invalid vector\n", name); stack_push(stack, 0); return; }
+        const char *op = name + 4;
+        if (strcmp(op, "x") == 0) { stack_push(stack, m->v[0]); return; }
+        if (strcmp(op, "y") == 0) { stack_push(stack, m->v[1]); return; }
+        if (strcmp(op, "z") == 0) { stack_push(stack, m->v[2]); return; }
+        if (strcmp(op, "len") == 0) { stack_push(stack, sqrt(m->v[0] * m->v[0] + m->v[1] * m->v[1] + m->v[2] * m->v[2])); return; }
+        if (strcmp(op, "set") == 0) { m->v[0] = a[1]; m->v[1] = a[2]; m->v[2] = a[3]; stack_push(stack, 1); return; }
+        if (strcmp(op, "transform") == 0) {
+            /* vec.transform(dst, m, v): ponto com w = 1 */
+            if (!(x = math_get(a[1], MATH_MAT4)) || !(y = math_get(a[2], MATH_VEC3))) {
+                fprintf(stderr, "vec.transform: expected (vec, mat, vec)\n"); stack_push(stack, 0); return;
+            }
+            double p[3] = { y->v[0], y->v[1], y->v[2] };
+            mat4_transform_points(x->v, p, 1, 3);
+            memcpy(m->v, p, sizeof p);
+            stack_push(stack, 1);
+            return;
+        }
+        if (!(x = math_get(a[1], MATH_VEC3))) { fprintf(stderr, "%s: invalid vector\n", name); stack_push(stack, 0); return; }
+        if (strcmp(op, "dot") == 0) { stack_push(stack, m->v[0] * x->v[0] + m->v[1] * x->v[1] + m->v[2] * x->v[2]); return; }
+        if (strcmp(op, "normalize") == 0) vec3_normalize(m->v, x->v);
+        else if (strcmp(op, "scale") == 0) { for (int i = 0; i < 3; ++i) m->v[i] = x->v[i] * a[2]; }
+        else {
+            if (!(y = math_get(a[2], MATH_VEC3))) { fprintf(stderr, "%s: invalid vector\n", name); stack_push(stack, 0); return; }
+            if (strcmp(op, "add") == 0) { for (int i = 0; i < 3; ++i) m->v[i] = x->v[i] + y->v[i]; }
+            else if (strcmp(op, "sub") == 0) { for (int i = 0; i < 3; ++i) m->v[i] = x->v[i] - y->v[i]; }
+            else if (strcmp(op, "cross") == 0) vec3_cross(m->v, x->v, y->v);
+            else { fprintf(stderr, "Unknown function: %s\n", name); stack_push(stack, 0); return; }
+        }
+        stack_push(stack, 1);
+        return;
+    }
+
+    /* ---------- quat ---------- */
+    if (strcmp(name, "quat.new") == 0) {
+        int h = math_new(MATH_QUAT);
+        if (!h) fprintf(stderr, "quat.new: too many objects\n");
+        else g_math[h - 1]->v[3] = 1.0;
+        stack_push(stack, h);
+        return;
+    }
+    if (!(m = math_get(a[0], MATH_QUAT))) { fprintf(stderr, "%s: invalid quaternion\n", name); stack_push(stack, 0); return; }
+    if (strcmp(name, "quat.axis") == 0) quat_from_axis(m->v, a[1], a[2], a[3], a[4]);
+    else if (strcmp(name, "quat.normalize") == 0) {
+        double len = sqrt(m->v[0] * m->v[0] + m->v[1] * m->v[1] + m->v[2] * m->v[2] + m->v[3] * m->v[3]);
+        if (len > 0) for (int i = 0; i < 4; ++i) m->v[i] /= len;
+    }
+    else if (strcmp(name, "quat.mul") == 0 || strcmp(name, "quat.slerp") == 0) {
+        if (!(x = math_get(a[1], MATH_QUAT)) || !(y = math_get(a[2], MATH_QUAT))) {
+            fprintf(stderr, "%s: invalid quaternion\n", name); stack_push(stack, 0); return;
+        }
+        if (name[5] == 'm') quat_mul(m->v, x->v, y->v);
+        else quat_slerp(m->v, x->v, y->v, a[3]);
+    }
+    else { fprintf(stderr, "Unknown function: %s\n", name); stack_push(stack, 0); return; }
+    stack_push(stack, 1);
+}
+
+/* double -> int64 só quando é exatamente o mesmo número (-0.0, NaN, fração e
+   fora de faixa ficam double) */
+static inline int num_to_int(double d, int64_t *out) {
+    if (!(d > -9223372036854775808.0 && d < 9223372036854775808.0)) return 0;
+    int64_t i = (int64_t)d;
+    if ((double)i != d || (i == 0 && signbit(d))) return 0;
+    *out = i;
+    return 1;
+}
+
+static double kc_mod(double l, double r) {
+    int64_t a, b;
+    /* resto 0 com dividendo negativo é -0.0 no fmod */
+    if (num_to_int(l, &a) && num_to_int(r, &b) && b != 0 && b != -1 && (a >= 0 || a % b != 0))
+        return (double)(a % b);
+    return fmod(l, r);
+}
+
+/* ops de OP_ADD até OP_SHR (o resto o exec_expr trata antes). Este e o
+   super_bin ficam fora de linha: inline eles crescem o frame do exec_expr,
+   que é recursivo, e o arith.kc fica ~5% mais lento. */
+static __attribute__((noinline)) double kc_binop(OpCode op, double l, double r) {
+    switch (op) {
+        case OP_ADD:   return l + r;
+        case OP_SUB:   return l - r;
+        case OP_MUL:   return l * r;
+        case OP_DIV:   return l / r;
+        case OP_MOD:   return kc_mod(l, r);
+        case OP_POW:   return pow(l, r);
+        case OP_LT:    return (l <  r) ? 1.0 : 0.0;
+        case OP_LE:    return (l <= r) ? 1.0 : 0.0;
+        case OP_GT:    return (l >  r) ? 1.0 : 0.0;
+        case OP_GE:    return (l >= r) ? 1.0 : 0.0;
+        case OP_EQ:    return (l == r) ? 1.0 : 0.0;
+        case OP_NE:    return (l != r) ? 1.0 : 0.0;
+        case OP_BITAND:  return (double)((int64_t)l & (int64_t)r);
+        case OP_BITOR:   return (double)((int64_t)l | (int64_t)r);
+        case OP_BITXOR:  return (double)((int64_t)l ^ (int64_t)r);
+        case OP_SHL:     return (double)((int64_t)l << (int64_t)r);
+        case OP_SHR:     return (double)((int64_t)l >> (int64_t)r);
+        default:         return 0.0;
+    }
+}
+
+/* NODE_VAR sem pilha; o erro aponta pro próprio nome */
+static inline double var_value(Node *v, Env *env) {
+    VarPair *p = env_lookup(env, v->data.var_name);
+    if (!p) kc_error(v, "Runtime error: undefined variable '%s'", v->data.var_name);
+    return p->value;
+}
+
+/* NODE_VAR_NUM / NODE_VAR_VAR */
+static __attribute__((noinline)) double super_bin(Node *n, Env *env) {
+    Node *r = n->data.bin.right;
+    double l = var_value(n->data.bin.left, env);
+    return kc_binop(n->data.bin.op, l, r->type == NODE_NUMBER ? r->data.num : var_value(r, env));
+}
+
+/* NODE_INC: mesma coisa que `x = x + c` (lê pela cadeia, escreve no Env local) */
+static double exec_inc(Node *n, Env *env) {
+    Node *x = n->data.bin.left, *rhs = n->data.bin.right;
+    double c = rhs->data.bin.right->data.num;
+    int sub = rhs->data.bin.op == OP_SUB;
+    VarPair *p = env->head;
+    while (p && !VAR_IS(p, x->data.var_name)) p = p->next;
+    if (p) {
+        p->value = sub ? p->value - c : p->value + c;
+        p->is_int = 0;
+        return p->value;
+    }
+    double v = var_value(rhs->data.bin.left, env);
+    v = sub ? v - c : v + c;
+    env_set(env, x->data.var_name, v);
+    return v;
+}
+
+/* condição de if/while: superinstrução sem pilha, o resto pelo exec_expr */
+static inline double cond_value(Node *c, Stack *stack, Env *env) {
+    if (c->type == NODE_VAR_NUM || c->type == NODE_VAR_VAR) {
+        SUPER_FIRE(SUPER_COND);
+        g_cur_node = c;
+        return super_bin(c, env);
+    }
+    exec_expr(c, stack, env);
+    return stack_pop(stack);
+}
+
+/* Avalia a árvore de um NODE_INT_EXPR sem passar pela pilha: enquanto os
+   valores são inteiros exatos eles ficam em int64 (*iv, retorna 1); estouro,
+   fração ou um caso em que o double daria outro resultado (-0.0) cai pra
+   conta em double (*dv, retorna 0). *dv vem sempre preenchido. Bitwise e
+   shift convertem o operando como antes, (int64_t)double. */
+static int num_eval(Node *n, Stack *stack, Env *env, int64_t *iv, double *dv);
+
+/* NODE_INVARIANT velho (o laço mudou de época): recalcula. Conta inteira guarda
+   também o int64 exato, senão acima de 2^53 o laço daria outro resultado que fora dele */
+static __attribute__((noinline)) void inv_refresh(Node *n, Stack *stack, Env *env) {
+    Node *e = n->data.inv.expr;
+    if (e->type == NODE_INT_EXPR) {
+        n->data.inv.is_int = num_eval(e->data.int_expr.expr, stack, env, &n->data.inv.ival, &n->data.inv.value);
+    } else {
+        exec_expr(e, stack, env);
+        n->data.inv.value = stack_pop(stack);
+        n->data.inv.is_int = 0;
+    }
+    n->data.inv.epoch = n->data.inv.loop->data.while_node.epoch;
+}
+
+/* lado direito de atribuição que guarda o int64 exato (env_set_int) */
+static int int_value_node(const Node *n) {
+    return n->type == NODE_INT_EXPR ||
+           (n->type == NODE_INVARIANT && n->data.inv.expr->type == NODE_INT_EXPR);
+}
+
+static int num_eval(Node *n, Stack *stack, Env *env, int64_t *iv, double *dv) {
+    switch (n->type) {
+        case NODE_NUMBER:
+            *dv = n->data.num;
+            return num_to_int(*dv, iv);
+
+        case NODE_INT_EXPR:
+            return num_eval(n->data.int_expr.expr, stack, env, iv, dv);
+
+        case NODE_INVARIANT:
+            if (n->data.inv.epoch != n->data.inv.loop->data.while_node.epoch) inv_refresh(n, stack, env);
+            *dv = n->data.inv.value;
+            if (n->data.inv.is_int) { *iv = n->data.inv.ival; return 1; }
+            return num_to_int(*dv, iv);
+
+        case NODE_VAR: {
+            VarPair *p = env_lookup(env, n->data.var_name);
+            if (!p) kc_error(n, "Runtime error: undefined variable '%s'", n->data.var_name);
+            *dv = p->value;
+            if (p->is_int) { *iv = p->ival; return 1; }
+            return num_to_int(*dv, iv);
+        }
+
+        case NODE_UNARY: {
+            OpCode op = n->data.unary.op;
+            if (op != OP_NEG && op != OP_BITNOT) break;
+            int64_t a;
+            double x;
+            int ka = num_eval(n->data.unary.operand, stack, env, &a, &x);
+            if (op == OP_BITNOT) {
+                *iv = ~(ka ? a : (int64_t)x);
+                *dv = (double)*iv;
+                return 1;
+            }
+            *dv = -x;
+            if (ka && a != 0 && a != INT64_MIN) { *iv = -a; return 1; }
+            return 0;
+        }
+
+        case NODE_BINARY: {
+            OpCode op = n->data.bin.op;
+            switch (op) {
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+                case OP_BITAND: case OP_BITOR: case OP_BITXOR: case OP_SHL: case OP_SHR:
+                    break;
+                default:
+                    goto generic;
+            }
+            int64_t a, b, r;
+            double x, y;
+            int ka = num_eval(n->data.bin.left, stack, env, &a, &x);
+            int kb = num_eval(n->data.bin.right, stack, env, &b, &y);
+            int both = ka && kb;
+            if (op >= OP_BITAND && op <= OP_SHR) {
+                if (!ka) a = (int64_t)x;
+                if (!kb) b = (int64_t)y;
+                switch (op) {
+                    case OP_BITAND: r = a & b; break;
+                    case OP_BITOR:  r = a | b; break;
+                    case OP_BITXOR: r = a ^ b; break;
+                    case OP_SHL:    r = a << b; break;
+                    default:        r = a >> b; break;
+                }
+                *iv = r;
+                *dv = (double)r;
+                return 1;
+            }
+            switch (op) {
+                case OP_ADD:
+                    if (both && !__builtin_add_overflow(a, b, &r)) break;
+                    *dv = x + y;
+                    return 0;
+                case OP_SUB:
+                    if (both && !__builtin_sub_overflow(a, b, &r)) break;
+                    *dv = x - y;
+                    return 0;
+                case OP_MUL:
+                    /* 0 * negativo = -0.0 */
+                    if (both && !__builtin_mul_overflow(a, b, &r) && (r != 0 || (a >= 0 && b >= 0))) break;
+                    *dv = x * y;
+                    return 0;
+                default:
+                    if (both && b != 0 && b != -1 && (a >= 0 || a % b != 0)) { r = a % b; break; }
+                    *dv = fmod(x, y);
+                    return 0;
+            }
+            *iv = r;
+            *dv = (double)r;
+            return 1;
+        }
+
+        default:
+            break;
+    }
+generic:
+    exec_expr(n, stack, env);
+    *dv = stack_pop(stack);
+    return num_to_int(*dv, iv);
+}
+
+/* chama uma fuktion do script: args, Env local, memlimit, retorno na pilha */
+static void call_function(FuncEntry *fe, Node *node, Stack *stack, Env *env) {
+    double *argvals = calloc(fe->nparams, sizeof(double));
+    for (size_t i = 0; i < fe->nparams; ++i) {
+        if (i < node->data.call.nargs) {
+            exec_expr(node->data.call.args[i], stack, env);
+            argvals[i] = stack_pop(stack);
+        } else {
+            argvals[i] = 0.0;
+        }
+    }
+    Env local;
+    env_init(&local, env);
+
+    for (size_t i = 0; i < fe->nparams; ++i)
+        env_set(&local, fe->params[i], argvals[i]);
+
+    /* frame do corpo logo acima do chamador: a única checagem de limite */
+    Stack frame = { stack->stack + stack->size, 0, fe->stack_max, stack->limit };
+    double *heap_frame = NULL;
+    if (frame.stack + fe->stack_max > stack->limit) {
+        heap_frame = malloc(fe->stack_max * sizeof(double));
+        frame.stack = heap_frame;
+        frame.limit = heap_frame + fe->stack_max;
+    }
+
+    int prof_caller = g_prof_cur;
+    if (g_profiling) prof_enter(fe);
+#ifndef KC_NO_STATS
+    if (node->data.call.stat_id > 0) g_stat_is_fn[node->data.call.stat_id] = 1;
+#endif
+    if (g_call_depth < KC_TRACE_DEPTH) g_call_sites[g_call_depth] = node;
+    g_call_depth++;
+
+    int attempts = 0;
+    const int max_attempts = 3;
+    double retv = 0.0;
+    while (1) {
+        returning_flag = 0;
+        returning_value = 0.0;
+#ifdef KC_JIT
+        if (!(g_jit && jit_run(fe, &local, &frame)))
+#endif
+        exec_node(fe->body, &frame, &local);
+        frame.size = 0;
+
+        if (returning_flag) retv = returning_value;
+        else retv = 0.0;
+
+        if (fe->memlimit_set) {
+            size_t used = compute_env_mem(&local);
+            if ((long)used > fe->memlimit_bytes) {
+                if (fe->memlimit_mode == 1) {
+                    attempts++;
+                    if (attempts > max_attempts) {
+                        kc_error(node, "Runtime error: memlimit exceeded after %d restarts in function '%s'", max_attempts, fe->name);
+                    }
+                    clear_env_vars(&local);
+                    continue;
+                } else { 
+                    while ((long)used > fe->memlimit_bytes) {
+                        if (!evict_oldest_var(&local)) break;
+                        used = compute_env_mem(&local);
+                    }
+                }
+            }
+        }
+
+        break;
+    }
+
+
+    returning_flag = 0;
+    returning_value = 0.0;
+    stack_push(stack, retv);
+    g_prof_cur = prof_caller;
+    g_cur_node = node;
+    g_call_depth--;
+
+    free(argvals);
+    free(heap_frame);
+
+    clear_env_vars(&local);
+}
+
+/* NODE_CALL: builtins e fuktions. Fora de linha: o exec_expr aparece duas
+   vezes por nível de recursão e não carrega os locais daqui; a chamada de
+   fuktion no fim vira jmp, então este frame também sai da pilha */
+static __attribute__((noinline)) void exec_call(Node *node, Stack *stack, Env *env) {
+    do {
+        /* já resolvida aqui e não redefinida desde então: pula os builtins */
+        FuncEntry *fe = node->data.call.fe_cache;
+        if (fe && !__atomic_load_n(&fe->newer, __ATOMIC_ACQUIRE)) {
+            call_function(fe, node, stack, env);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "print") == 0) {
+            for (size_t i = 0; i < node->data.call.nargs; ++i) {
+                Node *arg = node->data.call.args[i];
+                if (arg->type == NODE_STRING) {
+                    printf("%s ", arg->data.str);
+                } else {
+                    exec_expr(arg, stack, env);
+                    double v = stack_pop(stack);
+                    printf("%g ", v);
+                }
+            }
+            printf("\n");
+            stack_push(stack, 0);   /* toda chamada deixa um valor (stack_depth conta com isso) */
+            break;
+        }
+
+        /* segundos (relógio monotônico, resolução de ns) */
+        if (strcmp(node->data.call.func_name, "time.now") == 0) {
+            stack_push(stack, kc_now());
+            break;
+        }
+
+        /* contadores de chamadas (6h) no stderr; devolve quantos nomes */
+        if (strcmp(node->data.call.func_name, "stats.dump") == 0) {
+#ifndef KC_NO_STATS
+            stack_push(stack, stats_dump(stderr));
+#else
+            fprintf(stderr, "stats.dump: built without stats support\n");
+            stack_push(stack, 0);
+#endif
+            break;
+        }
+
+        if (strncmp(node->data.call.func_name, "mat.", 4) == 0 ||
+            strncmp(node->data.call.func_name, "vec.", 4) == 0 ||
+            strncmp(node->data.call.func_name, "quat.", 5) == 0) {
+            math_builtin(node->data.call.func_name, node, stack, env);
+            break;
+        }
+
+#ifndef KC_NO_GRAPHICS
+        /* primeiro graphics.* / texture.* / model.*: carrega SDL e GL */
+        if (g_gfx_libs <= 0 && gfx_builtin_name(node->data.call.func_name) && !kc_load_graphics()) {
+            fprintf(stderr, "%s: cannot load graphics libraries (%s)\n", node->data.call.func_name, kc_load_error());
+            stack_push(stack, 0);
+            break;
+        }
+#else
+        if (gfx_builtin_name(node->data.call.func_name) || strncmp(node->data.call.func_name, "input.", 6) == 0) {
+            fprintf(stderr, "%s: built without graphics support\n", node->data.call.func_name);
+            stack_push(stack, 0);
+            break;
+        }
+#endif
+
+#ifndef KC_NO_GRAPHICS
+        if (strcmp(node->data.call.func_name, "graphics.init") == 0) {
+            /* inicia o SDL2 + OpenGL se for pedido  */
+            if (g_graphics_initialized) { stack_push(stack, 1); break; }
+            if (!gfx_open()) { stack_push(stack, 0); break; }
+            glViewport(0, 0, g_window_width, g_window_height);
+
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            {
+                /*(aqui vc entende o pq do M_PI nos includekkkk) compute aspect ratio and build a frustum for a ~60deg FOV */
+                double aspect = (double)g_window_width / (double)g_window_height;
+                double fov_deg = 60.0;
+                double fov_rad = fov_deg * M_PI / 180.0;
+                double near = 0.1;
+                double top = near * tan(fov_rad * 0.5);
+                double right = top * aspect;
+                glFrustum(-right, right, -top, top, near, 100.0);
+            }
+            glMatrixMode(GL_MODELVIEW);
+
+            glEnable(GL_DEPTH_TEST);
+            if (!g_batch) g_batch = malloc(KC_BATCH_MAX_VERTS * sizeof(BatchVertex));
+            g_batch_len = 0;
+            g_frame_draws = g_frame_verts = 0;
+            g_last_swap = kc_now();
+            g_graphics_initialized = 1;
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.quit") == 0) {
+            if (!g_graphics_initialized) { stack_push(stack, 0); break; }
+            g_batch_len = 0;
+            free(g_batch);
+            g_batch = NULL;
+            model_free_all();
+            texture_free_all();
+            gfx_close();
+            g_graphics_initialized = 0;
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.clear") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.clear: not initialized\n"); stack_push(stack, 0); break; }
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); r = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); g = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); b = (float)stack_pop(stack); }
+            batch_flush();
+            glClearColor(r, g, b, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.swap") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.swap: not initialized\n"); stack_push(stack, 0); break; }
+            batch_flush();
+            gfx_swap();
+            texture_pump();
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* graphics.stats() imprime o resumo e retorna o p95; graphics.stats("p99") retorna só a métrica */
+        if (strcmp(node->data.call.func_name, "graphics.stats") == 0) {
+            if (node->data.call.nargs >= 1 && node->data.call.args[0]->type == NODE_STRING) {
+                double v = frame_stat(node->data.call.args[0]->data.str);
+                if (v < 0) fprintf(stderr, "graphics.stats: unknown metric '%s'\n", node->data.call.args[0]->data.str);
+                stack_push(stack, v);
+                break;
+            }
+            printf("frame ms: avg %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f (%.1f fps) | draws %lu verts %lu\n",
+                   frame_stat("avg"), frame_stat("p50"), frame_stat("p95"), frame_stat("p99"), frame_stat("max"),
+                   frame_stat("fps"), g_last_draws, g_last_verts);
+            stack_push(stack, frame_stat("p95"));
+            break;
+        }
+
+        /* 0 = sem vsync, 1 = vsync, -1 = adaptativo */
+        if (strcmp(node->data.call.func_name, "graphics.vsync") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.vsync: not initialized\n"); stack_push(stack, 0); break; }
+            int interval = (int)call_arg_num(node, 0, stack, env, 1);
+            int ok = gfx_set_swap_interval(interval);
+            if (!ok) fprintf(stderr, "graphics.vsync: swap interval %d not supported\n", interval);
+            stack_push(stack, ok);
+            break;
+        }
+
+        /* limita o graphics.swap a n frames por segundo (0 = sem limite) */
+        if (strcmp(node->data.call.func_name, "graphics.fps") == 0) {
+            double target = call_arg_num(node, 0, stack, env, 0);
+            g_fps_target = target > 0 ? target : 0.0;
+            g_next_deadline = 0.0;
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.color") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.color: not initialized\n"); stack_push(stack, 0); break; }
+            float r = 1.0f, g = 1.0f, b = 1.0f;
+            if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); r = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); g = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); b = (float)stack_pop(stack); }
+            g_cur_color[0] = r; g_cur_color[1] = g; g_cur_color[2] = b;
+            glColor3f(r, g, b);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.triangle") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.triangle: not initialized\n"); stack_push(stack, 0); break; }
+            double vals[9];
+            for (size_t i = 0; i < 9; ++i) {
+                if (i < node->data.call.nargs) {
+                    exec_expr(node->data.call.args[i], stack, env);
+                    vals[i] = stack_pop(stack);
+                } else vals[i] = 0.0;
+            }
+            BatchVertex *v = batch_reserve(GL_TRIANGLES, 3);
+            batch_vertex(&v[0], vals[0], vals[1], vals[2]);
+            batch_vertex(&v[1], vals[3], vals[4], vals[5]);
+            batch_vertex(&v[2], vals[6], vals[7], vals[8]);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.line") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.line: not initialized\n"); stack_push(stack, 0); break; }
+            double vals[6];
+            for (size_t i = 0; i < 6; ++i) vals[i] = call_arg_num(node, i, stack, env, 0.0);
+            BatchVertex *v = batch_reserve(GL_LINES, 2);
+            batch_vertex(&v[0], vals[0], vals[1], vals[2]);
+            batch_vertex(&v[1], vals[3], vals[4], vals[5]);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.point") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.point: not initialized\n"); stack_push(stack, 0); break; }
+            double x = call_arg_num(node, 0, stack, env, 0.0);
+            double y = call_arg_num(node, 1, stack, env, 0.0);
+            double z = call_arg_num(node, 2, stack, env, 0.0);
+            batch_vertex(batch_reserve(GL_POINTS, 1), x, y, z);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.translate") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.translate: not initialized\n"); stack_push(stack, 0); break; }
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); x = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); y = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); z = (float)stack_pop(stack); }
+            batch_flush();
+            glTranslatef(x, y, z);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.rotate") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.rotate: not initialized\n"); stack_push(stack, 0); break; }
+            float ang = 0.0f, x = 0.0f, y = 0.0f, z = 1.0f;
+            if (node->data.call.nargs >= 1) { exec_expr(node->data.call.args[0], stack, env); ang = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 2) { exec_expr(node->data.call.args[1], stack, env); x = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 3) { exec_expr(node->data.call.args[2], stack, env); y = (float)stack_pop(stack); }
+            if (node->data.call.nargs >= 4) { exec_expr(node->data.call.args[3], stack, env); z = (float)stack_pop(stack); }
+            batch_flush();
+            glRotatef(ang, x, y, z);
+            stack_push(stack, 1);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "graphics.loadmatrix") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.loadmatrix: not initialized\n"); stack_push(stack, 0); break; }
+            batch_flush();
+            glLoadIdentity();
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* carrega uma matriz do mat.* (substitui a modelview atual) */
+        if (strcmp(node->data.call.func_name, "graphics.setmatrix") == 0 ||
+            strcmp(node->data.call.func_name, "graphics.multmatrix") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "%s: not initialized\n", node->data.call.func_name); stack_push(stack, 0); break; }
+            MathObj *m = math_get(call_arg_num(node, 0, stack, env, 0), MATH_MAT4);
+            if (!m) { fprintf(stderr, "%s: invalid matrix\n", node->data.call.func_name); stack_push(stack, 0); break; }
+            batch_flush();
+            if (node->data.call.func_name[9] == 's') glLoadMatrixd(m->v);
+            else glMultMatrixd(m->v);
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* lê todos os eventos pendentes pro retrato do input.* */
+        if (strcmp(node->data.call.func_name, "graphics.events") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "graphics.events: not initialized\n"); stack_push(stack, 0); break; }
+            texture_pump();
+            stack_push(stack, input_pump());
+            break;
+        }
+
+        /* ========== INPUT ========== */
+
+        /* input.key.w() conhecido já virou input.key(<scancode>) no opt_input */
+        if (strncmp(node->data.call.func_name, "input.key.", 10) == 0 && node->data.call.nargs == 0) {
+            fprintf(stderr, "%s: unknown key\n", node->data.call.func_name);
+            stack_push(stack, 0);
+            break;
+        }
+
+        /* estado lido do retrato: sem chamada ao SDL */
+        if (strcmp(node->data.call.func_name, "input.key") == 0 ||
+            strcmp(node->data.call.func_name, "input.pressed") == 0 ||
+            strcmp(node->data.call.func_name, "input.released") == 0) {
+            if (node->data.call.nargs < 1) { fprintf(stderr, "%s: missing key\n", node->data.call.func_name); stack_push(stack, 0); break; }
+            Node *arg = node->data.call.args[0];
+            if (arg->type == NODE_STRING) {
+                /* nome conhecido já virou o scancode no opt_input */
+                fprintf(stderr, "%s: unknown key '%s'\n", node->data.call.func_name, arg->data.str);
+                stack_push(stack, 0);
+                break;
+            }
+        int code = (int)call_arg_num(node, 0, stack, env, -1);
+            uint8_t bit = node->data.call.func_name[6] == 'k' ? KEY_DOWN : node->data.call.func_name[6] == 'p' ? KEY_PRESSED : KEY_RELEASED;
+            stack_push(stack, code >= 0 && code < SDL_NUM_SCANCODES && (g_input.keys[code] & bit) ? 1 : 0);
+            break;
+        }
+
+        if (strncmp(node->data.call.func_name, "input.mouse.", 12) == 0) {
+            const char *what = node->data.call.func_name + 12;
+            if (strcmp(what, "x") == 0) stack_push(stack, g_input.mouse_x);
+            else if (strcmp(what, "y") == 0) stack_push(stack, g_input.mouse_y);
+            else if (strcmp(what, "relx") == 0) stack_push(stack, g_input.rel_x);
+            else if (strcmp(what, "rely") == 0) stack_push(stack, g_input.rel_y);
+            else if (strcmp(what, "wheel") == 0) stack_push(stack, g_input.wheel);
+            else if (strcmp(what, "left") == 0) stack_push(stack, (g_input.buttons >> 0) & 1);
+            else if (strcmp(what, "middle") == 0) stack_push(stack, (g_input.buttons >> 1) & 1);
+            else if (strcmp(what, "right") == 0) stack_push(stack, (g_input.buttons >> 2) & 1);
+            else kc_error(node, "Runtime error: unknown function '%s'", node->data.call.func_name);
+            break;
+        }
+#endif /* KC_NO_GRAPHICS */
+
+        /* ========== FILE FUNCTIONS ========== */
+
+        if (strcmp(node->data.call.func_name, "readf") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "readf: file name must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, access(node->data.call.args[0]->data.str, R_OK) == 0 ? 1 : 0);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "writef") == 0) {
+            if (node->data.call.nargs < 2 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "writef: file name and content required\n");
+                stack_push(stack, 0);
+                break;
+            }
+            int h = file_open(node->data.call.args[0]->data.str, 'w');
+            if (!h) { stack_push(stack, 0); break; }
+            KFile *f = file_get(h);
+            int ok = 1;
+            for (size_t i = 1; i < node->data.call.nargs && ok; ++i) {
+                Node *arg = node->data.call.args[i];
+                if (arg->type == NODE_STRING) {
+                    ok = file_write(f, arg->data.str, strlen(arg->data.str));
+                } else {
+                    char num[32];
+                    exec_expr(arg, stack, env);
+                    int len = snprintf(num, sizeof(num), "%g", stack_pop(stack));
+                    ok = file_write(f, num, (size_t)len);
+                }
+            }
+            ok = file_close(h) && ok;
+            stack_push(stack, ok);
+            break;
+        }
+
+        /* conta linhas em streaming, sem carregar o arquivo */
+        if (strcmp(node->data.call.func_name, "readlines") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "readlines: file name must be a string\n");
+                stack_push(stack, -1);
+                break;
+            }
+            int h = file_open(node->data.call.args[0]->data.str, 'r');
+            if (!h) { stack_push(stack, -1); break; }
+            KFile *f = file_get(h);
+            long count = 0;
+            while (file_readline(f) >= 0) count++;
+            file_close(h);
+            stack_push(stack, (double)count);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.open") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "file.open: file name must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            char mode = 'r';
+            if (node->data.call.nargs >= 2 && node->data.call.args[1]->type == NODE_STRING)
+                mode = node->data.call.args[1]->data.str[0];
+            if (mode != 'r' && mode != 'w' && mode != 'a') {
+                fprintf(stderr, "file.open: mode must be \"r\", \"w\" or \"a\"\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, file_open(node->data.call.args[0]->data.str, mode));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.readline") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f) { fprintf(stderr, "file.readline: invalid handle\n"); stack_push(stack, -1); break; }
+            stack_push(stack, (double)file_readline(f));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.read") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            double n = call_arg_num(node, 1, stack, env, KC_FILE_BUF);
+            if (!f) { fprintf(stderr, "file.read: invalid handle\n"); stack_push(stack, 0); break; }
+            stack_push(stack, (double)file_read_chunk(f, n > 0 ? (size_t)n : 0));
+            break;
+        }
+
+        /* 1 se o registro atual contém o texto */
+        if (strcmp(node->data.call.func_name, "file.contains") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f || node->data.call.nargs < 2 || node->data.call.args[1]->type != NODE_STRING) {
+                fprintf(stderr, "file.contains: handle and text required\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, rec_contains(f->rec, f->rec_len, node->data.call.args[1]->data.str));
+            break;
+        }
+
+        /* valor numérico do registro atual (0 se não for número) */
+        if (strcmp(node->data.call.func_name, "file.linenum") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f) { fprintf(stderr, "file.linenum: invalid handle\n"); stack_push(stack, 0); break; }
+            char num[64];
+            size_t len = f->rec_len < sizeof(num) - 1 ? f->rec_len : sizeof(num) - 1;
+            memcpy(num, f->rec, len);
+            num[len] = '\0';
+            stack_push(stack, strtod(num, NULL));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.printline") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f) { fprintf(stderr, "file.printline: invalid handle\n"); stack_push(stack, 0); break; }
+            fwrite(f->rec, 1, f->rec_len, stdout);
+            putchar('\n');
+            stack_push(stack, (double)f->rec_len);
+            break;
+        }
+
+        /* file.write(h, ...) / file.writeline(h, ...): strings e números no buffer do handle */
+        if (strcmp(node->data.call.func_name, "file.write") == 0 ||
+            strcmp(node->data.call.func_name, "file.writeline") == 0) {
+            int newline = strcmp(node->data.call.func_name, "file.writeline") == 0;
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f || !f->writing) { fprintf(stderr, "%s: invalid handle\n", node->data.call.func_name); stack_push(stack, 0); break; }
+            int ok = 1;
+            for (size_t i = 1; i < node->data.call.nargs && ok; ++i) {
+                Node *arg = node->data.call.args[i];
+                if (arg->type == NODE_STRING) {
+                    ok = file_write(f, arg->data.str, strlen(arg->data.str));
+                } else {
+                    char num[32];
+                    exec_expr(arg, stack, env);
+                    int len = snprintf(num, sizeof(num), "%g", stack_pop(stack));
+                    ok = file_write(f, num, (size_t)len);
+                }
+            }
+            if (ok && newline) ok = file_write(f, "\n", 1);
+            stack_push(stack, ok);
+            break;
+        }
+
+        /* copia o registro atual de um handle de leitura pra um de escrita (com '\n') */
+        if (strcmp(node->data.call.func_name, "file.writerec") == 0) {
+            KFile *out = file_get(call_arg_num(node, 0, stack, env, 0));
+            KFile *in = file_get(call_arg_num(node, 1, stack, env, 0));
+            if (!out || !out->writing || !in) { fprintf(stderr, "file.writerec: invalid handle\n"); stack_push(stack, 0); break; }
+            int ok = file_write(out, in->rec, in->rec_len) && file_write(out, "\n", 1);
+            stack_push(stack, ok);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.flush") == 0) {
+            KFile *f = file_get(call_arg_num(node, 0, stack, env, 0));
+            if (!f) { fprintf(stderr, "file.flush: invalid handle\n"); stack_push(stack, 0); break; }
+            stack_push(stack, file_flush(f));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "file.close") == 0) {
+            stack_push(stack, file_close(call_arg_num(node, 0, stack, env, 0)));
+            break;
+        }
+
+        /* ========== NUMERIC BUFFERS ========== */
+
+        if (strcmp(node->data.call.func_name, "io.loadnums") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "io.loadnums: file name must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, loadnums(node->data.call.args[0]->data.str));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.new") == 0) {
+            double n = call_arg_num(node, 0, stack, env, 0);
+            NumBuf *b = calloc(1, sizeof(NumBuf));
+            b->len = b->cap = n > 0 ? (size_t)n : 0;
+            b->data = calloc(b->cap ? b->cap : 1, sizeof(double));
+            stack_push(stack, buf_register(b));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.len") == 0) {
+            NumBuf *b = buf_get(call_arg_num(node, 0, stack, env, 0));
+            if (!b) { fprintf(stderr, "buf.len: invalid handle\n"); stack_push(stack, -1); break; }
+            stack_push(stack, (double)b->len);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.get") == 0) {
+            NumBuf *b = buf_get(call_arg_num(node, 0, stack, env, 0));
+            double i = call_arg_num(node, 1, stack, env, 0);
+            if (!b || i < 0 || (size_t)i >= b->len) { fprintf(stderr, "buf.get: invalid handle or index\n"); stack_push(stack, 0); break; }
+            stack_push(stack, b->data[(size_t)i]);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.set") == 0) {
+            NumBuf *b = buf_get(call_arg_num(node, 0, stack, env, 0));
+            double i = call_arg_num(node, 1, stack, env, 0);
+            double v = call_arg_num(node, 2, stack, env, 0);
+            if (!b || i < 0 || (size_t)i >= b->len) { fprintf(stderr, "buf.set: invalid handle or index\n"); stack_push(stack, 0); break; }
+            b->data[(size_t)i] = v;
+            stack_push(stack, v);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.sum") == 0) {
+            NumBuf *b = buf_get(call_arg_num(node, 0, stack, env, 0));
+            if (!b) { fprintf(stderr, "buf.sum: invalid handle\n"); stack_push(stack, 0); break; }
+            double sum = 0.0;
+            for (size_t i = 0; i < b->len; ++i) sum += b->data[i];
+            stack_push(stack, sum);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "buf.free") == 0) {
+            double h = call_arg_num(node, 0, stack, env, 0);
+            int ok = buf_get(h) != NULL;
+            buf_free(h);
+            stack_push(stack, ok);
+            break;
+        }
+
+#ifndef KC_NO_GRAPHICS
+        /* ========== MODELS ========== */
+
+        if (strcmp(node->data.call.func_name, "model.load") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "model.load: file name must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, model_load(node->data.call.args[0]->data.str));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "model.draw") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "model.draw: not initialized\n"); stack_push(stack, 0); break; }
+            Model3D *m = model_get(call_arg_num(node, 0, stack, env, 0));
+            if (!m) { fprintf(stderr, "model.draw: invalid handle\n"); stack_push(stack, 0); break; }
+            stack_push(stack, model_draw(m));
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "model.triangles") == 0) {
+            Model3D *m = model_get(call_arg_num(node, 0, stack, env, 0));
+            if (!m) { fprintf(stderr, "model.triangles: invalid handle\n"); stack_push(stack, -1); break; }
+            stack_push(stack, m->index_count / 3);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "model.free") == 0) {
+            double h = call_arg_num(node, 0, stack, env, 0);
+            int ok = model_get(h) != NULL;
+            model_free(h);
+            stack_push(stack, ok);
+            break;
+        }
+
+        /* ========== TEXTURES ========== */
+
+        /* mesmo caminho = mesmo handle; a decodificação roda em segundo plano */
+        if (strcmp(node->data.call.func_name, "texture.load") == 0 ||
+            strcmp(node->data.call.func_name, "graphics.load_texture") == 0) {
+            if (node->data.call.nargs < 1 || node->data.call.args[0]->type != NODE_STRING) {
+                fprintf(stderr, "texture.load: file name must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            stack_push(stack, texture_load(node->data.call.args[0]->data.str));
+            break;
+        }
+
+        /* texture.bind(h) ativa; texture.bind(0) desativa */
+        if (strcmp(node->data.call.func_name, "texture.bind") == 0 ||
+            strcmp(node->data.call.func_name, "graphics.bind_texture") == 0) {
+            if (!g_graphics_initialized) { fprintf(stderr, "texture.bind: not initialized\n"); stack_push(stack, 0); break; }
+            stack_push(stack, texture_bind(call_arg_num(node, 0, stack, env, 0)));
+            break;
+        }
+
+        /* 1 quando já está na GPU, 0 decodificando, -1 falhou */
+        if (strcmp(node->data.call.func_name, "texture.ready") == 0) {
+            texture_pump();
+            Texture *t = texture_get(call_arg_num(node, 0, stack, env, 0));
+            if (!t) { fprintf(stderr, "texture.ready: invalid handle\n"); stack_push(stack, -1); break; }
+            int state = texture_state(t);
+            stack_push(stack, state == TEX_READY ? 1 : state == TEX_FAILED ? -1 : 0);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "texture.release") == 0) {
+            stack_push(stack, texture_release(call_arg_num(node, 0, stack, env, 0)));
+            break;
+        }
+
+        /* limite de memória de GPU pras texturas (0 = sem limite) */
+        if (strcmp(node->data.call.func_name, "texture.budget") == 0) {
+            double bytes = call_arg_num(node, 0, stack, env, 0);
+            if (node->data.call.nargs >= 2 && node->data.call.args[1]->type == NODE_STRING)
+                bytes *= (double)unit_multiplier_from_string(node->data.call.args[1]->data.str);
+            g_tex_budget = bytes > 0 ? (size_t)bytes : 0;
+            texture_pump();
+            stack_push(stack, 1);
+            break;
+        }
+#endif /* KC_NO_GRAPHICS */
+
+        /* ========== NETWORK FUNCTIONS ========== */
+
+#ifndef KC_NO_NETWORK
+        if (strcmp(node->data.call.func_name, "network.init") == 0) {
+            if (g_network_initialized) { stack_push(stack, 1); break; }
+            if (!kc_load_network()) {
+                fprintf(stderr, "network.init: cannot load libcurl (%s)\n", kc_load_error());
+                stack_push(stack, 0);
+                break;
+            }
+            /* no --serve o curl já vem iniciado do processo pai */
+            if (g_curl_handle) { g_network_initialized = 1; stack_push(stack, 1); break; }
+            if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+                fprintf(stderr, "network.init: curl_global_init failed\n");
+                stack_push(stack, 0);
+                break;
+            }
+            g_curl_handle = curl_easy_init();
+            if (!g_curl_handle) {
+                fprintf(stderr, "network.init: curl_easy_init failed\n");
+                curl_global_cleanup();
+                stack_push(stack, 0);
+                break;
+            }
+            g_network_initialized = 1;
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* Limpeza do subsystema */
+        if (strcmp(node->data.call.func_name, "network.quit") == 0) {
+            if (!g_network_initialized) { stack_push(stack, 0); break; }
+            if (g_curl_handle) {
+                curl_easy_cleanup(g_curl_handle);
+                g_curl_handle = NULL;
+            }
+            curl_global_cleanup();
+            g_network_initialized = 0;
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* HTTP GET request */
+        if (strcmp(node->data.call.func_name, "http.get") == 0) {
+            if (!g_network_initialized) { fprintf(stderr, "http.get: network not initialized\n"); stack_push(stack, 0); break; }
+            if (node->data.call.nargs < 1) { fprintf(stderr, "http.get: URL required\n"); stack_push(stack, 0); break; }
+            
+            char *url = NULL;
+            if (node->data.call.args[0]->type == NODE_STRING) {
+                url = strdup(node->data.call.args[0]->data.str);
+            } else {
+                fprintf(stderr, "http.get: URL must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            
+            CURLcode res;
+            long response_code;
+            char *response_data = malloc(1);
+            response_data[0] = '\0';
+            size_t response_size = 0;
+            
+            curl_easy_setopt(g_curl_handle, CURLOPT_URL, url);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEDATA, &response_data);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEHEADER, &response_size);
+            curl_easy_setopt(g_curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(g_curl_handle, CURLOPT_TIMEOUT, 30L);
+            
+            res = curl_easy_perform(g_curl_handle);
+            curl_easy_getinfo(g_curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+            
+            if (res == CURLE_OK) {
+                printf("HTTP GET Response (%ld): %s\n", response_code, response_data);
+                stack_push(stack, (double)response_code);
+            } else {
+                fprintf(stderr, "http.get failed: %s\n", curl_easy_strerror(res));
+                stack_push(stack, 0);
+            }
+            
+            free(url);
+            free(response_data);
+            break;
+        }
+
+        /* HTTP POST request */
+        if (strcmp(node->data.call.func_name, "http.post") == 0) {
+            if (!g_network_initialized) { fprintf(stderr, "http.post: network not initialized\n"); stack_push(stack, 0); break; }
+            if (node->data.call.nargs < 2) { fprintf(stderr, "http.post: URL and data required\n"); stack_push(stack, 0); break; }
+            
+            char *url = NULL, *data = NULL;
+            if (node->data.call.args[0]->type == NODE_STRING) {
+                url = strdup(node->data.call.args[0]->data.str);
+            } else {
+                fprintf(stderr, "http.post: URL must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            
+            if (node->data.call.args[1]->type == NODE_STRING) {
+                data = strdup(node->data.call.args[1]->data.str);
+            } else {
+                fprintf(stderr, "http.post: data must be a string\n");
+                free(url);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            CURLcode res;
+            long response_code;
+            char *response_data = malloc(1);
+            response_data[0] = '\0';
+            size_t response_size = 0;
+            
+            curl_easy_setopt(g_curl_handle, CURLOPT_URL, url);
+            curl_easy_setopt(g_curl_handle, CURLOPT_POSTFIELDS, data);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEDATA, &response_data);
+            curl_easy_setopt(g_curl_handle, CURLOPT_WRITEHEADER, &response_size);
+            curl_easy_setopt(g_curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(g_curl_handle, CURLOPT_TIMEOUT, 30L);
+            
+            res = curl_easy_perform(g_curl_handle);
+            curl_easy_getinfo(g_curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+            
+            if (res == CURLE_OK) {
+                printf("HTTP POST Response (%ld): %s\n", response_code, response_data);
+                stack_push(stack, (double)response_code);
+            } else {
+                fprintf(stderr, "http.post failed: %s\n", curl_easy_strerror(res));
+                stack_push(stack, 0);
+            }
+            
+            free(url);
+            free(data);
+            free(response_data);
+            break;
+        }
+#else
+        if (strcmp(node->data.call.func_name, "network.init") == 0 || strcmp(node->data.call.func_name, "network.quit") == 0 ||
+            strncmp(node->data.call.func_name, "http.", 5) == 0) {
+            fprintf(stderr, "%s: built without network support\n", node->data.call.func_name);
+            stack_push(stack, 0);
+            break;
+        }
+#endif /* KC_NO_NETWORK */
+
+        /* Socket functions */
+        if (strcmp(node->data.call.func_name, "socket.connect") == 0) {
+            if (node->data.call.nargs < 2) { fprintf(stderr, "socket.connect: host and port required\n"); stack_push(stack, 0); break; }
+            
+            char *host = NULL;
+            int port = 0;
+            
+            if (node->data.call.args[0]->type == NODE_STRING) {
+                host = strdup(node->data.call.args[0]->data.str);
+            } else {
+                fprintf(stderr, "socket.connect: host must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            
+            if (node->data.call.args[1]->type == NODE_NUMBER) {
+                port = (int)node->data.call.args[1]->data.num;
+            } else {
+                fprintf(stderr, "socket.connect: port must be a number\n");
+                free(host);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (sock < 0) {
+                fprintf(stderr, "socket.connect: socket creation failed\n");
+                free(host);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            struct sockaddr_in server_addr;
+            server_addr.sin_family = AF_INET;
+            server_addr.sin_port = htons(port);
+            
+            if (inet_pton(AF_INET, host, &server_addr.sin_addr) <= 0) {
+                fprintf(stderr, "socket.connect: invalid address\n");
+                close(sock);
+                free(host);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+                fprintf(stderr, "socket.connect: connection failed\n");
+                close(sock);
+                free(host);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            printf("Connected to %s:%d\n", host, port);
+            free(host);
+            stack_push(stack, (double)sock);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "socket.send") == 0) {
+            if (node->data.call.nargs < 2) { fprintf(stderr, "socket.send: socket and data required\n"); stack_push(stack, 0); break; }
+            
+            if (node->data.call.args[1]->type != NODE_STRING) {
+                fprintf(stderr, "socket.send: data must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            int sock = (int)call_arg_num(node, 0, stack, env, -1);
+            const char *data = node->data.call.args[1]->data.str;
+            
+            ssize_t bytes_sent = send_all(sock, data, strlen(data));
+            if (bytes_sent < 0) {
+                fprintf(stderr, "socket.send: send failed: %s\n", strerror(errno));
+                stack_push(stack, 0);
+                break;
+            }
+            
+            printf("Sent %zd bytes: %s\n", bytes_sent, data);
+            stack_push(stack, (double)bytes_sent);
+            break;
+        }
+
+        /* socket.sendv(sock, a, b, ...): junta os pedaços com writev, sem concatenar */
+        if (strcmp(node->data.call.func_name, "socket.sendv") == 0) {
+            if (node->data.call.nargs < 2) { fprintf(stderr, "socket.sendv: socket and data required\n"); stack_push(stack, 0); break; }
+            
+            int sock = (int)call_arg_num(node, 0, stack, env, -1);
+            size_t n = node->data.call.nargs - 1;
+            struct iovec *iov = calloc(n, sizeof(struct iovec));
+            char (*numbuf)[32] = calloc(n, sizeof(*numbuf));
+            for (size_t i = 0; i < n; ++i) {
+                Node *arg = node->data.call.args[i + 1];
+                if (arg->type == NODE_STRING) {
+                    iov[i].iov_base = arg->data.str;
+                    iov[i].iov_len = strlen(arg->data.str);
+                } else {
+                    exec_expr(arg, stack, env);
+                    int len = snprintf(numbuf[i], sizeof(numbuf[i]), "%g", stack_pop(stack));
+                    iov[i].iov_base = numbuf[i];
+                    iov[i].iov_len = (size_t)len;
+                }
+            }
+            
+            ssize_t bytes_sent = writev_all(sock, iov, (int)n);
+            free(iov);
+            free(numbuf);
+            if (bytes_sent < 0) {
+                fprintf(stderr, "socket.sendv: writev failed: %s\n", strerror(errno));
+                stack_push(stack, 0);
+                break;
+            }
+            
+            printf("Sent %zd bytes in %zu parts\n", bytes_sent, n);
+            stack_push(stack, (double)bytes_sent);
+            break;
+        }
+
+        /* socket.sendfile(sock, "arquivo"): zero-copy via sendfile(2) */
+        if (strcmp(node->data.call.func_name, "socket.sendfile") == 0) {
+            if (node->data.call.nargs < 2) { fprintf(stderr, "socket.sendfile: socket and path required\n"); stack_push(stack, 0); break; }
+            
+            if (node->data.call.args[1]->type != NODE_STRING) {
+                fprintf(stderr, "socket.sendfile: path must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            int sock = (int)call_arg_num(node, 0, stack, env, -1);
+            const char *path = node->data.call.args[1]->data.str;
+            
+            int fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                fprintf(stderr, "socket.sendfile: cannot open '%s': %s\n", path, strerror(errno));
+                stack_push(stack, 0);
+                break;
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0) {
+                fprintf(stderr, "socket.sendfile: stat failed: %s\n", strerror(errno));
+                close(fd);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            long long bytes_sent = sendfile_all(sock, fd, st.st_size);
+            int send_err = errno;
+            close(fd);
+            if (bytes_sent < 0) {
+                fprintf(stderr, "socket.sendfile: send failed: %s\n", strerror(send_err));
+                stack_push(stack, 0);
+                break;
+            }
+            
+            printf("Sent %lld bytes from %s\n", bytes_sent, path);
+            stack_push(stack, (double)bytes_sent);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "socket.recv") == 0) {
+            if (node->data.call.nargs < 1) { fprintf(stderr, "socket.recv: socket required\n"); stack_push(stack, 0); break; }
+            
+            int sock = (int)call_arg_num(node, 0, stack, env, -1);
+            int buffer_size = 1024;
+            
+            if (node->data.call.nargs >= 2 && node->data.call.args[1]->type == NODE_NUMBER) {
+                buffer_size = (int)node->data.call.args[1]->data.num;
+            }
+            
+            char *buffer = malloc(buffer_size);
+            ssize_t bytes_received = recv(sock, buffer, buffer_size - 1, 0);
+            
+            if (bytes_received < 0) {
+                fprintf(stderr, "socket.recv: recv failed\n");
+                free(buffer);
+                stack_push(stack, 0);
+                break;
+            }
+            
+            buffer[bytes_received] = '\0';
+            printf("Received %zd bytes: %s\n", bytes_received, buffer);
+            free(buffer);
+            stack_push(stack, (double)bytes_received);
+            break;
+        }
+
+        if (strcmp(node->data.call.func_name, "socket.close") == 0) {
+            if (node->data.call.nargs < 1) { fprintf(stderr, "socket.close: socket required\n"); stack_push(stack, 0); break; }
+            
+            int sock = (int)call_arg_num(node, 0, stack, env, -1);
+            
+            if (close(sock) < 0) {
+                fprintf(stderr, "socket.close: close failed\n");
+                stack_push(stack, 0);
+                break;
+            }
+            
+            printf("Socket %d closed\n", sock);
+            stack_push(stack, 1);
+            break;
+        }
+
+        /* Network utility functions */
+        if (strcmp(node->data.call.func_name, "network.ping") == 0) {
+            if (node->data.call.nargs < 1) { fprintf(stderr, "network.ping: host required\n"); stack_push(stack, 0); break; }
+            
+            char *host = NULL;
+            if (node->data.call.args[0]->type == NODE_STRING) {
+                host = strdup(node->data.call.args[0]->data.str);
+            } else {
+                fprintf(stderr, "network.ping: host must be a string\n");
+                stack_push(stack, 0);
+                break;
+            }
+            
+            char command[256];
+            snprintf(command, sizeof(command), "ping -c 1 %s > /dev/null 2>&1", host);
+            int result = system(command);
+            
+            free(host);
+            stack_push(stack, (result == 0) ? 1.0 : 0.0);
+            break;
+        }
+
+        fe = find_function(node->data.call.func_name);
+        if (fe) {
+            node->data.call.fe_cache = fe;
+            call_function(fe, node, stack, env);
+            break;
+        }
+
+
+        kc_error(node, "Runtime error: unknown function '%s'", node->data.call.func_name);
+        break;
+    } while (0);
+}
+
+#ifndef KC_NO_STATS
+/* ganchos do --stats num frame pequeno em volta do exec_call */
+static __attribute__((noinline)) void exec_call_stats(Node *node, Stack *stack, Env *env) {
+    int stat_on = stats_begin(node);
+    exec_call(node, stack, env);
+    if (stat_on) stats_end(node);
+}
+#endif
+
+static void exec_expr(Node *node, Stack *stack, Env *env) {
+    if (!node) return;
+    if (returning_flag) return;
+    g_cur_node = node;
+#ifdef KC_DEBUG_STACK
+    size_t depth_in = stack->size;
+#endif
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            stack_push(stack, node->data.num);
+            break;
+
+        case NODE_VAR:
+            stack_push(stack, env_get(env, node->data.var_name));
+            break;
+
+        case NODE_STRING:
+            kc_error(node, "String literals not supported outside of 'print'.");
+            break;
+
+        case NODE_INT_EXPR: {
+            int64_t iv;
+            double dv;
+            num_eval(node->data.int_expr.expr, stack, env, &iv, &dv);
+            stack_push(stack, dv);
+            break;
+        }
+
+        case NODE_INVARIANT:
+            if (node->data.inv.epoch != node->data.inv.loop->data.while_node.epoch) inv_refresh(node, stack, env);
+            stack_push(stack, node->data.inv.value);
+            break;
+
+        case NODE_UNARY: {
+            exec_expr(node->data.unary.operand, stack, env);
+            double v = stack_pop(stack);
+            double res = 0.0;
+            switch (node->data.unary.op) {
+                case OP_NEG:   res = -v; break;
+                case OP_NOT:   res = (v == 0.0) ? 1.0 : 0.0; break;
+                case OP_BITNOT:
+                    res = (double)~(int64_t)v;
+                    break;
+                default:
+                    kc_error(node, "Unknown unary operator (code %d)", node->data.unary.op);
+            }
+            stack_push(stack, res);
+            break;
+        }
+
+        case NODE_BINARY: {
+            OpCode op = node->data.bin.op;
+            if (op == OP_ASSIGN) {
+                if (node->data.bin.left->type != NODE_VAR) {
+                    kc_error(node, "Runtime error: left side of '=' must be a variable");
+                }
+                /* conta inteira guarda o int64 exato na variável */
+                if (int_value_node(node->data.bin.right)) {
+                    int64_t iv;
+                    double dv;
+                    if (num_eval(node->data.bin.right, stack, env, &iv, &dv))
+                        env_set_int(env, node->data.bin.left->data.var_name, iv);
+                    else
+                        env_set(env, node->data.bin.left->data.var_name, dv);
+                    stack_push(stack, dv);
+                    break;
+                }
+                exec_expr(node->data.bin.right, stack, env);
+                double val = stack_pop(stack);
+                env_set(env, node->data.bin.left->data.var_name, val);
+                stack_push(stack, val);
+                break;
+            }
+            /* curto-circuito: o lado direito só roda se o esquerdo não decidir */
+            if (op == OP_LOGICAL_AND || op == OP_LOGICAL_OR) {
+                exec_expr(node->data.bin.left, stack, env);
+                int l = stack_pop(stack) != 0.0;
+                if (l == (op == OP_LOGICAL_OR)) {
+                    stack_push(stack, l ? 1.0 : 0.0);
+                    break;
+                }
+                exec_expr(node->data.bin.right, stack, env);
+                stack_push(stack, stack_pop(stack) != 0.0 ? 1.0 : 0.0);
+                break;
+            }
+            exec_expr(node->data.bin.left, stack, env);
+            exec_expr(node->data.bin.right, stack, env);
+            double r = stack_pop(stack);
+            double l = stack_pop(stack);
+            if (op > OP_SHR) kc_error(node, "Runtime error: unknown binary operator code %d", op);
+            stack_push(stack, kc_binop(op, l, r));
+            break;
+        }
+
+        case NODE_VAR_NUM:
+            SUPER_FIRE(SUPER_VAR_NUM);
+            stack_push(stack, super_bin(node, env));
+            break;
+
+        case NODE_VAR_VAR:
+            SUPER_FIRE(SUPER_VAR_VAR);
+            stack_push(stack, super_bin(node, env));
+            break;
+
+        case NODE_INC:
+            SUPER_FIRE(SUPER_INC);
+            stack_push(stack, exec_inc(node, env));
+            break;
+
+        case NODE_CALL:
+#ifndef KC_NO_STATS
+            exec_call_stats(node, stack, env);
+#else
+            exec_call(node, stack, env);
+#endif
+            break;
+
+        default:
+            kc_error(node, "Runtime: node type desconhecido (%d)", node->type);
+    }
+#ifdef KC_DEBUG_STACK
+    if (stack->size != depth_in + 1)
+        kc_error(node, "Stack: node left %zd values (expected 1)", (ssize_t)stack->size - (ssize_t)depth_in);
+#endif
+}
+
+
+static uint64_t g_loop_epoch = 0;
+
+/* laço contado (3b): i fica no VarPair do Env local e é comparado/somado
+   direto em C; o limite é calculado uma vez. 0 = i não é local, vai pro
+   caminho genérico (que dá o mesmo erro/resultado de antes). */
+static int exec_counted_loop(Node *node, Stack *stack, Env *env) {
+    Node *cond = node->data.while_node.cond, *incr = node->data.while_node.incr;
+    const char *name = cond->data.bin.left->data.var_name;
+    VarPair *iv = env->head;
+    while (iv && strcmp(iv->name, name) != 0) iv = iv->next;
+    if (!iv) return 0;
+    iv->is_int = 0;   /* o laço só atualiza value */
+
+    exec_expr(cond->data.bin.right, stack, env);
+    double bound = stack_pop(stack);
+    Node *step_node = incr->data.bin.right;
+    if (step_node->type == NODE_VAR && strcmp(step_node->data.var_name, name) == 0) step_node = incr->data.bin.left;
+    int sub = incr->data.bin.op == OP_SUB, have_step = 0;
+    double step = 0.0;
+    OpCode cmp = cond->data.bin.op;
+    Node **stmts = node->data.while_node.body->data.block.stmts;
+
+    while (1) {
+        double i = iv->value;
+        int go;
+        switch (cmp) {
+            case OP_LT: go = i <  bound; break;
+            case OP_LE: go = i <= bound; break;
+            case OP_GT: go = i >  bound; break;
+            case OP_GE: go = i >= bound; break;
+            default:    go = i != bound; break;
+        }
+        if (!go) break;
+        Node **p = stmts;
+        for (; p[1]; ++p) {
+            exec_node(*p, stack, env);
+            if (returning_flag) return 1;
+        }
+        if (!have_step) {
+            g_cur_node = *p;
+            exec_expr(step_node, stack, env);
+            step = stack_pop(stack);
+            have_step = 1;
+        }
+        iv->value = sub ? iv->value - step : iv->value + step;
+    }
+    return 1;
+}
+
+static void exec_node(Node *node, Stack *stack, Env *env) {
+    if (!node) return;
+    if (returning_flag) return;
+    g_cur_node = node;
+
+    switch (node->type) {
+        case NODE_BLOCK: {
+            for (Node **p = node->data.block.stmts; *p != NULL; ++p) {
+                if (returning_flag) break;
+                exec_node(*p, stack, env);
+            }
+            break;
+        }
+        case NODE_WHILE: {
+            node->data.while_node.epoch = ++g_loop_epoch;
+            if (!node->data.while_node.incr || !exec_counted_loop(node, stack, env)) {
+                while (1) {
+                    double c = cond_value(node->data.while_node.cond, stack, env);
+                    if (c == 0.0) break;
+                    exec_node(node->data.while_node.body, stack, env);
+                    if (returning_flag) break;
+                }
+            }
+            /* recursão pode ter rodado o mesmo laço no meio: o que foi guardado vale só pra essa entrada */
+            node->data.while_node.epoch = ++g_loop_epoch;
+            break;
+        }
+        case NODE_IF: {
+            if (cond_value(node->data.if_node.cond, stack, env) != 0.0) {
+                exec_node(node->data.if_node.then_body, stack, env);
+            } else if (node->data.if_node.else_body) {
+                exec_node(node->data.if_node.else_body, stack, env);
+            }
+            break;
+        }
+        case NODE_CLASS_DECL:
+            fprintf(stderr, "Definição de classe '%s' ainda não implementada.\n",
+                    node->data.class_decl.class_name);
+            break;
+        case NODE_FUNC_DECL:
+            /* register function in global table */
+            register_function(node);
+            break;
+        case NODE_INC:
+            SUPER_FIRE(SUPER_INC);
+            exec_inc(node, env);
+            break;
+        case NODE_RETURN: {
+            if (node->data.return_node.expr) {
+                exec_expr(node->data.return_node.expr, stack, env);
+                double v = stack_pop(stack);
+                returning_value = v;
+            } else {
+                returning_value = 0.0;
+            }
+            returning_flag = 1;
+            break;
+        }
+        default:
+
+            exec_expr(node, stack, env);
+
+            if (stack->size > 0) stack_pop(stack);
+            break;
+    }
+}
+
+/*=====================================================================
+ * 7b.  JIT x86-64 de fuktions quentes (--jit)
+ *===================================================================== */
+
+/* Template JIT: depois de KC_JIT_THRESHOLD chamadas o corpo da fuktion vira
+   código x86-64 (System V) numa página mmap, escrita e depois protegida só
+   pra execução. As variáveis continuam nos VarPair do Env de verdade: o
+   código guarda um ponteiro por nome (slot) resolvido na entrada, então lê e
+   escreve sem strcmp, e quem é chamado ainda acha tudo pelo escopo dinâmico.
+   Número, variável, aritmética, comparação, && ||, atribuição, while, if e
+   return são nativos. O resto (chamadas, builtins, strings, NODE_INT_EXPR,
+   declarações) volta pro interpretador nó a nó por um helper; se esse nó
+   pode criar variável local, os slots são conferidos de novo na volta.
+   Registradores fixos: rbx = slots, r12 = own, r13 = JitFrame. Resultado de
+   expressão em xmm0; operando esquerdo espera na pilha (16 bytes, mantém o
+   alinhamento pras chamadas). */
+#ifdef KC_JIT
+#define KC_JIT_THRESHOLD 50
+
+struct JitFrame;
+
+typedef struct JitCode {
+    void (*fn)(struct JitFrame *);
+    const char **names;     /* nome de cada slot (aponta pra AST) */
+    size_t nnames;
+    size_t size;            /* bytes mapeados */
+} JitCode;
+
+typedef struct JitFrame {
+    Env *env;               /* Env local da chamada */
+    Stack *stack;
+    VarPair **slots;        /* NULL = ainda não existe em lugar nenhum */
+    unsigned char *own;     /* 1 = slot é do Env local (pode escrever) */
+    JitCode *jc;
+} JitFrame;
+
+static double jit_eval(JitFrame *f, Node *n) {
+    exec_expr(n, f->stack, f->env);
+    return stack_pop(f->stack);
+}
+
+static void jit_sync(JitFrame *f) {
+    for (size_t i = 0; i < f->jc->nnames; ++i) {
+        if (f->own[i]) continue;
+        for (VarPair *p = f->env->head; p; p = p->next)
+            if (VAR_IS(p, f->jc->names[i])) { f->slots[i] = p; f->own[i] = 1; break; }
+    }
+}
+
+static double jit_eval_sync(JitFrame *f, Node *n) {
+    double v = jit_eval(f, n);
+    jit_sync(f);
+    return v;
+}
+
+static void jit_exec(JitFrame *f, Node *n) {
+    exec_node(n, f->stack, f->env);
+}
+
+static void jit_exec_sync(JitFrame *f, Node *n) {
+    exec_node(n, f->stack, f->env);
+    jit_sync(f);
+}
+
+/* primeira escrita num nome que ainda não é local: cria no Env, como env_set */
+static VarPair *jit_own(JitFrame *f, int i) {
+    VarPair *p = env_slot(f->env, f->jc->names[i]);
+    f->slots[i] = p;
+    f->own[i] = 1;
+    return p;
+}
+
+static void jit_undefined(JitFrame *f, Node *n) __attribute__((noreturn));
+static void jit_undefined(JitFrame *f, Node *n) {
+    (void)f;
+    kc_error(n, "Runtime error: undefined variable '%s'", n->data.var_name);
+}
+
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    const char **names;
+    size_t nnames, cap_names;
+    size_t *rets;           /* jmp pro epílogo a corrigir */
+    size_t nrets, cap_rets;
+    Node **loops;           /* whiles abertos em volta do comando atual */
+    size_t nloops, cap_loops;
+} JitAsm;
+
+static void ja_bytes(JitAsm *a, const void *p, size_t n) {
+    if (a->len + n > a->cap) {
+        while (a->len + n > a->cap) a->cap = a->cap ? a->cap * 2 : 4096;
+        a->buf = realloc(a->buf, a->cap);
+    }
+    memcpy(a->buf + a->len, p, n);
+    a->len += n;
+}
+#define JA(a, ...) do { static const unsigned char ja_b_[] = { __VA_ARGS__ }; ja_bytes((a), ja_b_, sizeof ja_b_); } while (0)
+
+static void ja_u32(JitAsm *a, uint32_t v) { ja_bytes(a, &v, 4); }
+static void ja_u64(JitAsm *a, uint64_t v) { ja_bytes(a, &v, 8); }
+
+/* salto com rel32 pra frente: devolve onde corrigir */
+static size_t ja_jcc(JitAsm *a, unsigned char cc) {
+    if (cc == 0xE9) JA(a, 0xE9);
+    else { unsigned char op[2] = { 0x0F, cc }; ja_bytes(a, op, 2); }
+    ja_u32(a, 0);
+    return a->len - 4;
+}
+
+static void ja_patch(JitAsm *a, size_t at) {
+    int32_t rel = (int32_t)(a->len - (at + 4));
+    memcpy(a->buf + at, &rel, 4);
+}
+
+static void ja_jmp_back(JitAsm *a, size_t target) {
+    JA(a, 0xE9);
+    ja_u32(a, (uint32_t)(int32_t)(target - (a->len + 4)));
+}
+
+static void ja_call(JitAsm *a, void *fn) {
+    JA(a, 0x48, 0xB8); ja_u64(a, (uint64_t)(uintptr_t)fn);      /* mov rax, fn */
+    JA(a, 0xFF, 0xD0);                                          /* call rax */
+}
+
+static void ja_const(JitAsm *a, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, 8);
+    JA(a, 0x48, 0xB8); ja_u64(a, bits);                         /* mov rax, imm64 */
+    JA(a, 0x66, 0x48, 0x0F, 0x6E, 0xC0);                        /* movq xmm0, rax */
+}
+
+static void ja_push(JitAsm *a) {
+    JA(a, 0x48, 0x83, 0xEC, 0x10);                              /* sub rsp, 16 */
+    JA(a, 0xF2, 0x0F, 0x11, 0x04, 0x24);                        /* movsd [rsp], xmm0 */
+}
+
+static void ja_pop(JitAsm *a) {
+    JA(a, 0xF2, 0x0F, 0x10, 0x04, 0x24);                        /* movsd xmm0, [rsp] */
+    JA(a, 0x48, 0x83, 0xC4, 0x10);                              /* add rsp, 16 */
+}
+
+/* helper(frame, node) */
+static void ja_helper(JitAsm *a, void *fn, Node *n) {
+    JA(a, 0x4C, 0x89, 0xEF);                                    /* mov rdi, r13 */
+    JA(a, 0x48, 0xBE); ja_u64(a, (uint64_t)(uintptr_t)n);       /* mov rsi, n */
+    ja_call(a, fn);
+}
+
+/* xmm0 == 0.0 (NaN conta como verdadeiro, igual ao `!= 0.0` do interpretador) */
+static void ja_cmp_zero(JitAsm *a) {
+    JA(a, 0x66, 0x0F, 0x57, 0xC9);                              /* xorpd xmm1, xmm1 */
+    JA(a, 0x66, 0x0F, 0x2E, 0xC1);                              /* ucomisd xmm0, xmm1 */
+}
+
+static size_t ja_jump_if_false(JitAsm *a) {
+    ja_cmp_zero(a);
+    JA(a, 0x7A, 0x06);                                          /* jp +6 (NaN: verdadeiro) */
+    return ja_jcc(a, 0x84);                                     /* je falso */
+}
+
+/* al -> 0.0/1.0 em xmm0 */
+static void ja_bool(JitAsm *a) {
+    JA(a, 0x0F, 0xB6, 0xC0);                                    /* movzx eax, al */
+    JA(a, 0xF2, 0x0F, 0x2A, 0xC0);                              /* cvtsi2sd xmm0, eax */
+}
+
+static void ja_truth(JitAsm *a) {
+    ja_cmp_zero(a);
+    JA(a, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);      /* setne al; setp cl; or al, cl */
+    ja_bool(a);
+}
+
+static int jit_slot(JitAsm *a, const char *name) {
+    for (size_t i = 0; i < a->nnames; ++i)
+        if (strcmp(a->names[i], name) == 0) return (int)i;
+    if (a->nnames == a->cap_names) {
+        a->cap_names = a->cap_names ? a->cap_names * 2 : 16;
+        a->names = realloc(a->names, a->cap_names * sizeof(char *));
+    }
+    a->names[a->nnames] = name;
+    return (int)a->nnames++;
+}
+
+/* o interpretador vai rodar n (expressão ou comando): se ele pode criar
+   variável local, confere os slots depois */
+static void ja_fallback(JitAsm *a, Node *n, int stmt) {
+    OptNames assigned = { NULL, 0, 0 };
+    int unused = 0;
+    opt_collect_assigned(n, &assigned, NULL, &unused);
+    for (size_t i = 0; i < assigned.len; ++i) jit_slot(a, assigned.names[i]);
+    if (stmt) ja_helper(a, assigned.len ? (void *)jit_exec_sync : (void *)jit_exec, n);
+    else ja_helper(a, assigned.len ? (void *)jit_eval_sync : (void *)jit_eval, n);
+    free(assigned.names);
+}
+
+/* mesma conta do exec_node: os NODE_INVARIANT que ficaram no interpretador dependem dela */
+static void ja_epoch(JitAsm *a, Node *loop) {
+    JA(a, 0x48, 0xB8); ja_u64(a, (uint64_t)(uintptr_t)&g_loop_epoch);
+    JA(a, 0x48, 0x8B, 0x08, 0x48, 0xFF, 0xC1, 0x48, 0x89, 0x08);   /* mov rcx, [rax]; inc rcx; mov [rax], rcx */
+    JA(a, 0x48, 0xB8); ja_u64(a, (uint64_t)(uintptr_t)&loop->data.while_node.epoch);
+    JA(a, 0x48, 0x89, 0x08);                                        /* mov [rax], rcx */
+}
+
+static void jit_expr(JitAsm *a, Node *n) {
+    switch (n->type) {
+        case NODE_NUMBER:
+            ja_const(a, n->data.num);
+            return;
+
+        case NODE_VAR: {
+            int i = jit_slot(a, n->data.var_name);
+            JA(a, 0x48, 0x8B, 0x83); ja_u32(a, (uint32_t)i * 8);     /* mov rax, [rbx + i*8] */
+            JA(a, 0x48, 0x85, 0xC0);                                /* test rax, rax */
+            size_t ok = ja_jcc(a, 0x85);                            /* jnz ok */
+            ja_helper(a, (void *)jit_undefined, n);
+            ja_patch(a, ok);
+            JA(a, 0xF2, 0x0F, 0x10, 0x80); ja_u32(a, offsetof(VarPair, value));   /* movsd xmm0, [rax+value] */
+            return;
+        }
+
+        case NODE_INVARIANT:
+            jit_expr(a, n->data.inv.expr);
+            return;
+
+        case NODE_UNARY:
+            if (n->data.unary.op != OP_NEG && n->data.unary.op != OP_NOT && n->data.unary.op != OP_BITNOT) break;
+            jit_expr(a, n->data.unary.operand);
+            switch (n->data.unary.op) {
+                case OP_NEG:
+                    JA(a, 0x48, 0xB8); ja_u64(a, 0x8000000000000000ULL);
+                    JA(a, 0x66, 0x48, 0x0F, 0x6E, 0xC8);            /* movq xmm1, rax */
+                    JA(a, 0x66, 0x0F, 0x57, 0xC1);                  /* xorpd xmm0, xmm1 */
+                    return;
+                case OP_NOT:
+                    ja_cmp_zero(a);
+                    JA(a, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);   /* sete al; setnp cl; and al, cl */
+                    ja_bool(a);
+                    return;
+                case OP_BITNOT:
+                    JA(a, 0xF2, 0x48, 0x0F, 0x2C, 0xC0);            /* cvttsd2si rax, xmm0 */
+                    JA(a, 0x48, 0xF7, 0xD0);                        /* not rax */
+                    JA(a, 0xF2, 0x48, 0x0F, 0x2A, 0xC0);            /* cvtsi2sd xmm0, rax */
+                    return;
+                default:
+                    return;
+            }
+
+        case NODE_BINARY: case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC: {
+            OpCode op = n->data.bin.op;
+            Node *l = n->data.bin.left, *r = n->data.bin.right;
+            if (op == OP_ASSIGN) {
+                /* conta inteira exata (env_set_int) e lado esquerdo inválido ficam com o interpretador */
+                if (l->type != NODE_VAR || int_value_node(r)) break;
+                jit_expr(a, r);
+                int i = jit_slot(a, l->data.var_name);
+                JA(a, 0x41, 0x80, 0xBC, 0x24); ja_u32(a, (uint32_t)i); JA(a, 0x00);   /* cmp byte [r12+i], 0 */
+                size_t have = ja_jcc(a, 0x85);                      /* jne have */
+                ja_push(a);
+                JA(a, 0x4C, 0x89, 0xEF);                            /* mov rdi, r13 */
+                JA(a, 0xBE); ja_u32(a, (uint32_t)i);                /* mov esi, i */
+                ja_call(a, (void *)jit_own);
+                ja_pop(a);
+                ja_patch(a, have);
+                JA(a, 0x48, 0x8B, 0x83); ja_u32(a, (uint32_t)i * 8);                        /* mov rax, [rbx + i*8] */
+                JA(a, 0xF2, 0x0F, 0x11, 0x80); ja_u32(a, offsetof(VarPair, value));       /* movsd [rax+value], xmm0 */
+                JA(a, 0xC7, 0x80); ja_u32(a, offsetof(VarPair, is_int)); ja_u32(a, 0);    /* mov dword [rax+is_int], 0 */
+                return;
+            }
+            if (op == OP_LOGICAL_AND || op == OP_LOGICAL_OR) {
+                jit_expr(a, l);
+                ja_cmp_zero(a);
+                size_t done;
+                if (op == OP_LOGICAL_AND) {
+                    JA(a, 0x7A, 0x0B);                              /* jp direita */
+                    JA(a, 0x75, 0x09);                              /* jne direita */
+                    JA(a, 0x66, 0x0F, 0x57, 0xC0);                  /* xorpd xmm0, xmm0 */
+                    done = ja_jcc(a, 0xE9);
+                } else {
+                    JA(a, 0x7A, 0x02);                              /* jp verdadeiro */
+                    JA(a, 0x74, 0x14);                              /* je direita */
+                    ja_const(a, 1.0);
+                    done = ja_jcc(a, 0xE9);
+                }
+                jit_expr(a, r);
+                ja_truth(a);
+                ja_patch(a, done);
+                return;
+            }
+            switch (op) {
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW:
+                case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+                case OP_BITAND: case OP_BITOR: case OP_BITXOR: case OP_SHL: case OP_SHR:
+                    break;
+                default:
+                    ja_fallback(a, n, 0);
+                    return;
+            }
+            jit_expr(a, l);
+            ja_push(a);
+            jit_expr(a, r);
+            JA(a, 0x66, 0x0F, 0x28, 0xC8);                          /* movapd xmm1, xmm0 */
+            ja_pop(a);                                              /* xmm0 = esquerdo */
+            switch (op) {
+                case OP_ADD: JA(a, 0xF2, 0x0F, 0x58, 0xC1); break;  /* addsd */
+                case OP_SUB: JA(a, 0xF2, 0x0F, 0x5C, 0xC1); break;  /* subsd */
+                case OP_MUL: JA(a, 0xF2, 0x0F, 0x59, 0xC1); break;  /* mulsd */
+                case OP_DIV: JA(a, 0xF2, 0x0F, 0x5E, 0xC1); break;  /* divsd */
+                case OP_MOD: ja_call(a, (void *)kc_mod); break;
+                case OP_POW: ja_call(a, (void *)pow); break;
+                /* ucomisd: unordered liga ZF, PF e CF, então seta/setae já dão falso com NaN */
+                case OP_LT: JA(a, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x97, 0xC0); ja_bool(a); break;   /* r > l */
+                case OP_LE: JA(a, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x93, 0xC0); ja_bool(a); break;   /* r >= l */
+                case OP_GT: JA(a, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x97, 0xC0); ja_bool(a); break;
+                case OP_GE: JA(a, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x93, 0xC0); ja_bool(a); break;
+                case OP_EQ:
+                    JA(a, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);   /* sete; setnp; and */
+                    ja_bool(a);
+                    break;
+                case OP_NE:
+                    JA(a, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);   /* setne; setp; or */
+                    ja_bool(a);
+                    break;
+                default:
+                    JA(a, 0xF2, 0x48, 0x0F, 0x2C, 0xC0);            /* cvttsd2si rax, xmm0 */
+                    JA(a, 0xF2, 0x48, 0x0F, 0x2C, 0xC9);            /* cvttsd2si rcx, xmm1 */
+                    switch (op) {
+                        case OP_BITAND: JA(a, 0x48, 0x21, 0xC8); break;
+                        case OP_BITOR:  JA(a, 0x48, 0x09, 0xC8); break;
+                        case OP_BITXOR: JA(a, 0x48, 0x31, 0xC8); break;
+                        case OP_SHL:    JA(a, 0x48, 0xD3, 0xE0); break;     /* shl rax, cl */
+                        default:        JA(a, 0x48, 0xD3, 0xF8); break;     /* sar rax, cl */
+                    }
+                    JA(a, 0xF2, 0x48, 0x0F, 0x2A, 0xC0);            /* cvtsi2sd xmm0, rax */
+                    break;
+            }
+            return;
+        }
+
+        default:
+            break;
+    }
+    ja_fallback(a, n, 0);
+}
+
+static void jit_stmt(JitAsm *a, Node *n) {
+    if (!n) return;
+    switch (n->type) {
+        case NODE_BLOCK:
+            for (Node **p = n->data.block.stmts; *p; ++p) jit_stmt(a, *p);
+            return;
+        case NODE_WHILE: {
+            ja_epoch(a, n);
+            size_t top = a->len;
+            jit_expr(a, n->data.while_node.cond);
+            size_t end = ja_jump_if_false(a);
+            if (a->nloops == a->cap_loops) {
+                a->cap_loops = a->cap_loops ? a->cap_loops * 2 : 8;
+                a->loops = realloc(a->loops, a->cap_loops * sizeof(Node *));
+            }
+            a->loops[a->nloops++] = n;
+            jit_stmt(a, n->data.while_node.body);
+            a->nloops--;
+            ja_jmp_back(a, top);
+            ja_patch(a, end);
+            ja_epoch(a, n);
+            return;
+        }
+        case NODE_IF: {
+            jit_expr(a, n->data.if_node.cond);
+            size_t els = ja_jump_if_false(a);
+            jit_stmt(a, n->data.if_node.then_body);
+            if (n->data.if_node.else_body) {
+                size_t end = ja_jcc(a, 0xE9);
+                ja_patch(a, els);
+                jit_stmt(a, n->data.if_node.else_body);
+                ja_patch(a, end);
+            } else {
+                ja_patch(a, els);
+            }
+            return;
+        }
+        case NODE_RETURN:
+            if (n->data.return_node.expr) jit_expr(a, n->data.return_node.expr);
+            else JA(a, 0x66, 0x0F, 0x57, 0xC0);                     /* xorpd xmm0, xmm0 */
+            JA(a, 0x48, 0xB8); ja_u64(a, (uint64_t)(uintptr_t)&returning_value);
+            JA(a, 0xF2, 0x0F, 0x11, 0x00);                          /* movsd [rax], xmm0 */
+            JA(a, 0x48, 0xB8); ja_u64(a, (uint64_t)(uintptr_t)&returning_flag);
+            JA(a, 0xC7, 0x00); ja_u32(a, 1);                        /* mov dword [rax], 1 */
+            /* o interpretador sai de cada while pelo fim dele: mesma ordem, de dentro pra fora */
+            for (size_t i = a->nloops; i-- > 0;) ja_epoch(a, a->loops[i]);
+            if (a->nrets == a->cap_rets) {
+                a->cap_rets = a->cap_rets ? a->cap_rets * 2 : 16;
+                a->rets = realloc(a->rets, a->cap_rets * sizeof(size_t));
+            }
+            a->rets[a->nrets++] = ja_jcc(a, 0xE9);
+            return;
+        case NODE_NUMBER: case NODE_VAR: case NODE_UNARY: case NODE_BINARY: case NODE_INVARIANT:
+        case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC:
+            jit_expr(a, n);                                         /* valor descartado, como no exec_node */
+            return;
+        default:
+            ja_fallback(a, n, 1);
+            return;
+    }
+}
+
+static JitCode *jit_compile(FuncEntry *fe) {
+    JitAsm a;
+    memset(&a, 0, sizeof a);
+    JA(&a, 0x55, 0x48, 0x89, 0xE5);                                /* push rbp; mov rbp, rsp */
+    JA(&a, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56);               /* push rbx, r12, r13, r14 */
+    JA(&a, 0x49, 0x89, 0xFD);                                       /* mov r13, rdi */
+    JA(&a, 0x48, 0x8B, 0x5F, (unsigned char)offsetof(JitFrame, slots));   /* mov rbx, [rdi+slots] */
+    JA(&a, 0x4C, 0x8B, 0x67, (unsigned char)offsetof(JitFrame, own));     /* mov r12, [rdi+own] */
+    for (size_t i = 0; i < fe->nparams; ++i) jit_slot(&a, fe->params[i]);
+    jit_stmt(&a, fe->body);
+    for (size_t i = 0; i < a.nrets; ++i) ja_patch(&a, a.rets[i]);
+    JA(&a, 0x48, 0x8D, 0x65, 0xE0);                                 /* lea rsp, [rbp-32] */
+    JA(&a, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);   /* pop r14, r13, r12, rbx, rbp; ret */
+
+    JitCode *jc = NULL;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (a.len + (size_t)page - 1) & ~((size_t)page - 1);
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        memcpy(mem, a.buf, a.len);
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) == 0) {
+            jc = malloc(sizeof(JitCode));
+            memcpy(&jc->fn, &mem, sizeof mem);
+            jc->names = a.names;
+            jc->nnames = a.nnames;
+            jc->size = size;
+            a.names = NULL;
+        } else {
+            munmap(mem, size);
+        }
+    }
+    free(a.buf);
+    free(a.names);
+    free(a.rets);
+    free(a.loops);
+    return jc;
+}
+
+static void jit_free(JitCode *jc) {
+    if (!jc) return;
+    void *mem;
+    memcpy(&mem, &jc->fn, sizeof mem);
+    munmap(mem, jc->size);
+    free(jc->names);
+    free(jc);
+}
+
+/* chamada de fuktion com --jit: compila quando fica quente; 0 = roda no interpretador.
+   Fora de linha: os buffers daqui não entram no frame de toda call_function
+   (recursão funda estourava a pilha do C antes). */
+static __attribute__((noinline)) int jit_run(FuncEntry *fe, Env *local, Stack *stack) {
+    if (!fe->jit) {
+        if (fe->jit_failed || ++fe->jit_calls < KC_JIT_THRESHOLD) return 0;
+        fe->jit = jit_compile(fe);
+        if (!fe->jit) {
+            fprintf(stderr, "jit: cannot map code for '%s' (%s), interpreting\n", fe->name, strerror(errno));
+            fe->jit_failed = 1;
+            return 0;
+        }
+    }
+    JitCode *jc = fe->jit;
+    VarPair *slots_buf[32];
+    unsigned char own_buf[32];
+    VarPair **slots = jc->nnames <= 32 ? slots_buf : malloc(jc->nnames * sizeof(VarPair *));
+    unsigned char *own = jc->nnames <= 32 ? own_buf : malloc(jc->nnames);
+    for (size_t i = 0; i < jc->nnames; ++i) {
+        VarPair *p = local->head;
+        while (p && !VAR_IS(p, jc->names[i])) p = p->next;
+        own[i] = p != NULL;
+        slots[i] = p ? p : env_lookup(local->parent, jc->names[i]);
+    }
+    JitFrame f = { local, stack, slots, own, jc };
+    jc->fn(&f);   /* erro de runtime sai por longjmp e vaza slots/own se vieram do malloc */
+    if (slots != slots_buf) { free(slots); free(own); }
+    return 1;
+}
+#endif
+
+/*=====================================================================
+ * 7.   Threading, textures, models, builtins
+ *===================================================================== */
+
+typedef struct { char *name; } ThreadData;
+static void *thread_func(void *arg) {
+    ThreadData *td = (ThreadData *)arg;
+    printf("Thread %s entrou na função.\n", td->name);
+    for (int i = 0; i < 3; ++i) {
+        printf("Thread %s: contador %d\n", td->name, i);
+    }
+    printf("Thread %s terminou.\n", td->name);
+    free(td->name);
+    free(td);
+    return NULL;
+}
+static void start_thread(const char *name) {
+    pthread_t t;
+    ThreadData *td = malloc(sizeof(ThreadData));
+    td->name = strdup(name);
+    if (pthread_create(&t, NULL, thread_func, td) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    pthread_detach(t);
+}
+
+#ifndef KC_NO_GRAPHICS
+/* ---------- texturas: cache com refcount, decodificação em thread, LRU ---------- */
+
+#define KC_MAX_TEXTURES 256
+#define KC_TEX_INDEX    512   /* hash caminho -> slot (endereçamento aberto) */
+
+static Texture *g_textures[KC_MAX_TEXTURES];
+static int g_tex_index[KC_TEX_INDEX];      /* slot+1; 0 = vazio, -1 = removido */
+static size_t g_tex_bytes;
+static uint64_t g_tex_clock;
+
+static pthread_mutex_t g_tex_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_tex_cond = PTHREAD_COND_INITIALIZER;
+static Texture *g_tex_queue[KC_MAX_TEXTURES];
+static size_t g_tex_qhead, g_tex_qlen;
+static int g_tex_pending;
+static int g_tex_worker_started;
+
+static Texture *texture_get(double handle) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_TEXTURES) return NULL;
+    return g_textures[h - 1];
+}
+
+static int tex_index_find(const char *path, uint64_t hash) {
+    size_t i = hash & (KC_TEX_INDEX - 1);
+    for (size_t n = 0; n < KC_TEX_INDEX; ++n, i = (i + 1) & (KC_TEX_INDEX - 1)) {
+        int v = g_tex_index[i];
+        if (v == 0) return 0;
+        if (v > 0 && g_textures[v - 1]->hash == hash && strcmp(g_textures[v - 1]->filename, path) == 0) return v;
+    }
+    return 0;
+}
+
+static void tex_index_put(uint64_t hash, int handle) {
+    size_t i = hash & (KC_TEX_INDEX - 1);
+    while (g_tex_index[i] > 0) i = (i + 1) & (KC_TEX_INDEX - 1);
+    g_tex_index[i] = handle;
+}
+
+static void tex_index_remove(uint64_t hash, int handle) {
+    size_t i = hash & (KC_TEX_INDEX - 1);
+    for (size_t n = 0; n < KC_TEX_INDEX; ++n, i = (i + 1) & (KC_TEX_INDEX - 1)) {
+        if (g_tex_index[i] == 0) return;
+        if (g_tex_index[i] == handle) { g_tex_index[i] = -1; return; }
+    }
+}
+
+/* roda fora da thread de render: só SDL_image, nada de GL */
+static SDL_Surface *decode_texture_file(const char *filename) {
+    SDL_Surface *img = IMG_Load(filename);
+    if (!img) { fprintf(stderr, "Erro ao carregar imagem: %s\n", IMG_GetError()); return NULL; }
+    /* qualquer formato (paleta, BGR, 16 bits...) vira RGBA32 */
+    SDL_Surface *rgba = SDL_ConvertSurfaceFormat(img, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(img);
+    if (!rgba) fprintf(stderr, "Erro ao converter imagem '%s': %s\n", filename, SDL_GetError());
+    return rgba;
+}
+
+static void *texture_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_tex_lock);
+    while (1) {
+        while (g_tex_qlen == 0) pthread_cond_wait(&g_tex_cond, &g_tex_lock);
+        Texture *t = g_tex_queue[g_tex_qhead];
+        g_tex_qhead = (g_tex_qhead + 1) % KC_MAX_TEXTURES;
+        g_tex_qlen--;
+        pthread_mutex_unlock(&g_tex_lock);
+
+        SDL_Surface *surf = decode_texture_file(t->filename);
+
+        pthread_mutex_lock(&g_tex_lock);
+        t->surface = surf;
+        t->state = surf ? TEX_DECODED : TEX_FAILED;
+        g_tex_pending--;
+        pthread_cond_broadcast(&g_tex_cond);
+    }
+    return NULL;
+}
+
+static int gl_has_generate_mipmap(void) {
+    const char *ver = (const char *)glGetString(GL_VERSION);
+    int major = 0, minor = 0;
+    if (!ver || sscanf(ver, "%d.%d", &major, &minor) != 2) return 0;
+    return major > 1 || (major == 1 && minor >= 4);
+}
+
+/* thread de render: surface RGBA32 -> textura com mipmaps e filtro trilinear */
+static GLuint upload_texture_surface(SDL_Surface *surface) {
+    GLuint texture_id;
+    int mipmaps = gl_has_generate_mipmap();
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    if (mipmaps) glTexParameteri(GL_TEXTURE_2D, 0x8191 /* GL_GENERATE_MIPMAP */, GL_TRUE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture_id;
+}
+
+static void texture_destroy(int handle) {
+    Texture *t = g_textures[handle - 1];
+    tex_index_remove(t->hash, handle);
+    if (t->texture_id && g_graphics_initialized) glDeleteTextures(1, &t->texture_id);
+    if (t->surface) SDL_FreeSurface(t->surface);
+    g_tex_bytes -= t->bytes;
+    free(t->filename);
+    free(t);
+    g_textures[handle - 1] = NULL;
+}
+
+/* state muda na thread de decodificação: só se lê com g_tex_lock */
+static int texture_state(Texture *t) {
+    pthread_mutex_lock(&g_tex_lock);
+    int state = t->state;
+    pthread_mutex_unlock(&g_tex_lock);
+    return state;
+}
+
+/* despeja as menos usadas sem referência até caber no orçamento */
+static void texture_enforce_budget(void) {
+    while (g_tex_budget && g_tex_bytes > g_tex_budget) {
+        int victim = 0;
+        pthread_mutex_lock(&g_tex_lock);
+        for (int i = 0; i < KC_MAX_TEXTURES; ++i) {
+            Texture *t = g_textures[i];
+            if (!t || t->refcount > 0 || t->state != TEX_READY) continue;
+            if (!victim || t->last_used < g_textures[victim - 1]->last_used) victim = i + 1;
+        }
+        pthread_mutex_unlock(&g_tex_lock);
+        if (!victim) break;
+        texture_destroy(victim);
+    }
+}
+
+/* sobe pra GPU o que a thread já decodificou */
+static void texture_pump(void) {
+    if (!g_graphics_initialized || !g_tex_worker_started) return;
+    pthread_mutex_lock(&g_tex_lock);
+    for (int i = 0; i < KC_MAX_TEXTURES; ++i) {
+        Texture *t = g_textures[i];
+        if (!t || t->state != TEX_DECODED) continue;
+        t->width = t->surface->w;
+        t->height = t->surface->h;
+        t->texture_id = upload_texture_surface(t->surface);
+        t->bytes = (size_t)t->width * (size_t)t->height * 4 * 4 / 3;
+        g_tex_bytes += t->bytes;
+        SDL_FreeSurface(t->surface);
+        t->surface = NULL;
+        t->state = TEX_READY;
+    }
+    pthread_mutex_unlock(&g_tex_lock);
+    texture_enforce_budget();
+}
+
+static int texture_load(const char *path) {
+    uint64_t hash = fnv1a(path);
+    int handle = tex_index_find(path, hash);
+    if (handle) {
+        Texture *t = g_textures[handle - 1];
+        t->refcount++;
+        t->last_used = ++g_tex_clock;
+        return handle;
+    }
+
+    for (int i = 0; i < KC_MAX_TEXTURES; ++i) if (!g_textures[i]) { handle = i + 1; break; }
+    if (!handle) { fprintf(stderr, "texture.load: too many textures\n"); return 0; }
+
+    if (!g_tex_worker_started) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, texture_worker, NULL) != 0) {
+            fprintf(stderr, "texture.load: cannot start decoder thread\n");
+            return 0;
+        }
+        pthread_detach(tid);
+        g_tex_worker_started = 1;
+    }
+
+    Texture *t = calloc(1, sizeof(Texture));
+    t->filename = strdup(path);
+    t->hash = hash;
+    t->refcount = 1;
+    t->state = TEX_LOADING;
+    t->last_used = ++g_tex_clock;
+    g_textures[handle - 1] = t;
+    tex_index_put(hash, handle);
+
+    pthread_mutex_lock(&g_tex_lock);
+    g_tex_queue[(g_tex_qhead + g_tex_qlen) % KC_MAX_TEXTURES] = t;
+    g_tex_qlen++;
+    g_tex_pending++;
+    pthread_cond_broadcast(&g_tex_cond);
+    pthread_mutex_unlock(&g_tex_lock);
+    return handle;
+}
+
+static int texture_bind(double handle) {
+    batch_flush();
+    Texture *t = texture_get(handle);
+    if (!t) {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
+        return handle <= 0;
+    }
+    /* ainda decodificando: espera só por esta */
+    pthread_mutex_lock(&g_tex_lock);
+    while (t->state == TEX_LOADING) pthread_cond_wait(&g_tex_cond, &g_tex_lock);
+    pthread_mutex_unlock(&g_tex_lock);
+    texture_pump();
+    if (texture_state(t) != TEX_READY) return 0;
+    t->last_used = ++g_tex_clock;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, t->texture_id);
+    return 1;
+}
+
+/* a textura continua no cache (pra próxima carga ser de graça) até o LRU precisar do espaço */
+static int texture_release(double handle) {
+    Texture *t = texture_get(handle);
+    if (!t || t->refcount == 0) return 0;
+    t->refcount--;
+    if (t->refcount == 0 && texture_state(t) == TEX_FAILED) texture_destroy((int)handle);
+    else texture_enforce_budget();
+    return 1;
+}
+
+static void texture_free_all(void) {
+    pthread_mutex_lock(&g_tex_lock);
+    while (g_tex_pending > 0) pthread_cond_wait(&g_tex_cond, &g_tex_lock);
+    pthread_mutex_unlock(&g_tex_lock);
+    for (int i = 0; i < KC_MAX_TEXTURES; ++i) if (g_textures[i]) texture_destroy(i + 1);
+}
+
+/* ---------- OBJ: parser em streaming sobre mmap ---------- */
+
+static const char *obj_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static const char *obj_float(const char *p, const char *end, float *out) {
+    double v = 0.0;
+    p = obj_skip_ws(p, end);
+    size_t n = kc_parse_double(p, end, &v);
+    *out = (float)v;
+    return p + n;
+}
+
+static const char *obj_int(const char *p, const char *end, long *out) {
+    int neg = 0;
+    long v = 0;
+    if (p < end && *p == '-') { neg = 1; p++; }
+    while (p < end && (unsigned)(*p - '0') < 10) v = v * 10 + (*p++ - '0');
+    *out = neg ? -v : v;
+    return p;
+}
+
+/* índice OBJ (1-based, negativo = relativo ao fim) -> 0-based, -1 se inválido */
+static long obj_index(long i, size_t count) {
+    if (i > 0 && (size_t)i <= count) return i - 1;
+    if (i < 0 && (size_t)(-i) <= count) return (long)count + i;
+    return -1;
+}
+
+typedef struct {
+    float *data;
+    size_t len, cap;
+} FloatVec;
+
+static void floatvec_push(FloatVec *v, const float *vals, size_t n) {
+    if (v->len + n > v->cap) {
+        v->cap = v->cap ? v->cap * 2 : 1024;
+        while (v->len + n > v->cap) v->cap *= 2;
+        v->data = realloc(v->data, v->cap * sizeof(float));
+    }
+    memcpy(v->data + v->len, vals, n * sizeof(float));
+    v->len += n;
+}
+
+/* tabela de hash (v, vt, vn) -> índice do vértice de saída, endereçamento aberto */
+typedef struct { uint32_t v, t, n; } ObjVertKey;   /* 1-based; v == 0 = vazio */
+
+typedef struct {
+    ObjVertKey *keys;
+    GLuint *vals;
+    size_t cap, len;
+} ObjVertMap;
+
+static size_t obj_hash(ObjVertKey k) {
+    uint64_t x = (uint64_t)k.v * 0x9e3779b97f4a7c15ULL ^ (uint64_t)k.t * 0xc2b2ae3d27d4eb4fULL ^ (uint64_t)k.n * 0x165667b19e3779f9ULL;
+    x ^= x >> 29;
+    return (size_t)x;
+}
+
+static void objmap_grow(ObjVertMap *m) {
+    size_t old_cap = m->cap;
+    ObjVertKey *old_keys = m->keys;
+    GLuint *old_vals = m->vals;
+    m->cap = old_cap ? old_cap * 2 : 4096;
+    m->keys = calloc(m->cap, sizeof(ObjVertKey));
+    m->vals = malloc(m->cap * sizeof(GLuint));
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (!old_keys[i].v) continue;
+        size_t j = obj_hash(old_keys[i]) & (m->cap - 1);
+        while (m->keys[j].v) j = (j + 1) & (m->cap - 1);
+        m->keys[j] = old_keys[i];
+        m->vals[j] = old_vals[i];
+    }
+    free(old_keys);
+    free(old_vals);
+}
+
+static int load_obj_model(const char *filename, Model3D *model) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { fprintf(stderr, "model.load: cannot open '%s': %s\n", filename, strerror(errno)); return 0; }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) { close(fd); return 0; }
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { fprintf(stderr, "model.load: mmap failed: %s\n", strerror(errno)); return 0; }
+    posix_madvise((void *)map, size, POSIX_MADV_SEQUENTIAL);
+
+    FloatVec pos = {0}, nrm = {0}, uv = {0}, out = {0};
+    GLuint *idx = NULL;
+    size_t idx_len = 0, idx_cap = 0;
+    ObjVertMap vmap = {0};
+    int has_normals = 0, has_uvs = 0;
+
+    const char *p = map, *end = map + size;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char *q = obj_skip_ws(p, eol);
+
+        if (eol - q > 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+            float v[3] = {0};
+            q = obj_float(q + 2, eol, &v[0]);
+            q = obj_float(q, eol, &v[1]);
+            obj_float(q, eol, &v[2]);
+            floatvec_push(&pos, v, 3);
+        } else if (eol - q > 3 && q[0] == 'v' && q[1] == 't' && (q[2] == ' ' || q[2] == '\t')) {
+            float v[2] = {0};
+            q = obj_float(q + 3, eol, &v[0]);
+            obj_float(q, eol, &v[1]);
+            floatvec_push(&uv, v, 2);
+        } else if (eol - q > 3 && q[0] == 'v' && q[1] == 'n' && (q[2] == ' ' || q[2] == '\t')) {
+            float v[3] = {0};
+            q = obj_float(q + 3, eol, &v[0]);
+            q = obj_float(q, eol, &v[1]);
+            obj_float(q, eol, &v[2]);
+            floatvec_push(&nrm, v, 3);
+        } else if (eol - q > 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+            /* polígono vira leque de triângulos: (first, prev, cur) */
+            GLuint first = 0, prev = 0;
+            int corner = 0;
+            q += 2;
+            while (1) {
+                q = obj_skip_ws(q, eol);
+                if (q >= eol || *q == '\r' || *q == '#') break;
+                long vi = 0, ti = 0, ni = 0;
+                q = obj_int(q, eol, &vi);
+                if (q < eol && *q == '/') {
+                    q++;
+                    if (q < eol && *q != '/') q = obj_int(q, eol, &ti);
+                    if (q < eol && *q == '/') q = obj_int(q + 1, eol, &ni);
+                }
+                while (q < eol && *q != ' ' && *q != '\t') q++;
+
+                long v0 = obj_index(vi, pos.len / 3);
+                if (v0 < 0) continue;
+                long t0 = ti ? obj_index(ti, uv.len / 2) : -1;
+                long n0 = ni ? obj_index(ni, nrm.len / 3) : -1;
+                ObjVertKey key = { (uint32_t)(v0 + 1), (uint32_t)(t0 + 1), (uint32_t)(n0 + 1) };
+
+                if ((vmap.len + 1) * 2 > vmap.cap) objmap_grow(&vmap);
+                size_t j = obj_hash(key) & (vmap.cap - 1);
+                while (vmap.keys[j].v && (vmap.keys[j].v != key.v || vmap.keys[j].t != key.t || vmap.keys[j].n != key.n))
+                    j = (j + 1) & (vmap.cap - 1);
+                GLuint vid;
+                if (vmap.keys[j].v) {
+                    vid = vmap.vals[j];
                 } else {
-                    fprintf(stderr, "network.ping: host must be a string\n");
-                    stack_push(stack, 0);
-                    break;
+                    float vert[KC_MODEL_STRIDE] = {0};
+                    memcpy(vert, pos.data + v0 * 3, 3 * sizeof(float));
+                    if (n0 >= 0) { memcpy(vert + 3, nrm.data + n0 * 3, 3 * sizeof(float)); has_normals = 1; }
+                    if (t0 >= 0) { memcpy(vert + 6, uv.data + t0 * 2, 2 * sizeof(float)); has_uvs = 1; }
+                    vid = (GLuint)(out.len / KC_MODEL_STRIDE);
+                    floatvec_push(&out, vert, KC_MODEL_STRIDE);
+                    vmap.keys[j] = key;
+                    vmap.vals[j] = vid;
+                    vmap.len++;
                 }
-                
-                char command[256];
-                snprintf(command, sizeof(command), "ping -c 1 %s > /dev/null 2>&1", host);
-                int result = system(command);
-                
-                free(host);
-                stack_push(stack, (result == 0) ? 1.0 : 0.0);
-                break;
-            }
 
-            FuncEntry *fe = find_function(node->data.call.func_name);
-            if (fe) {
-                double *argvals = calloc(fe->nparams, sizeof(double));
-                for (size_t i = 0; i < fe->nparams; ++i) {
-                    if (i < node->data.call.nargs) {
-                        exec_expr(node->data.call.args[i], stack, env);
-                        argvals[i] = stack_pop(stack);
-                    } else {
-                        argvals[i] = 0.0;
+                if (corner == 0) first = vid;
+                else if (corner >= 2) {
+                    if (idx_len + 3 > idx_cap) {
+                        idx_cap = idx_cap ? idx_cap * 2 : 3072;
+                        idx = realloc(idx, idx_cap * sizeof(GLuint));
                     }
+                    idx[idx_len++] = first;
+                    idx[idx_len++] = prev;
+                    idx[idx_len++] = vid;
                 }
-                Env local;
-                env_init(&local, env);
+                prev = vid;
+                corner++;
+            }
+        }
+        p = eol + 1;
+    }
+
+    munmap((void *)map, size);
+    free(pos.data);
+    free(nrm.data);
+    free(uv.data);
+    free(vmap.keys);
+    free(vmap.vals);
+
+    if (idx_len == 0) {
+        fprintf(stderr, "model.load: no faces in '%s'\n", filename);
+        free(out.data);
+        free(idx);
+        return 0;
+    }
+    model->verts = out.data;
+    model->indices = idx;
+    model->vertex_count = (int)(out.len / KC_MODEL_STRIDE);
+    model->index_count = (int)idx_len;
+    model->has_normals = has_normals;
+    model->has_uvs = has_uvs;
+    model->filename = strdup(filename);
+    model->texture_id = 0;
+    model->vbo = model->ibo = 0;
+    return 1;
+}
 
-                for (size_t i = 0; i < fe->nparams; ++i)
-                    env_set(&local, fe->params[i], argvals[i]);
+/* ---------- tabela de modelos ---------- */
 
-                int attempts = 0;
-                const int max_attempts = 3;
-                double retv = 0.0;
-                while (1) {
-                    returning_flag = 0;
-                    returning_value = 0.0;
-                    exec_node(fe->body, stack, &local);
-
-                    if (returning_flag) retv = returning_value;
-                    else retv = 0.0;
-
-                    if (fe->memlimit_set) {
-                        size_t used = compute_env_mem(&local);
-                        if ((long)used > fe->memlimit_bytes) {
-                            if (fe->memlimit_mode == 1) {
-                                attempts++;
-                                if (attempts > max_attempts) {
-                                    fprintf(stderr, "Runtime error: memlimit exceeded after %d restarts in function '%s'\n", max_attempts, fe->name);
-                                    exit(1);
-                                }
-                                clear_env_vars(&local);
-                                continue;
-                            } else { 
-                                while ((long)used > fe->memlimit_bytes) {
-                                    if (!evict_oldest_var(&local)) break;
-                                    used = compute_env_mem(&local);
-                                }
-                            }
-                        }
-                    }
+#define KC_MAX_MODELS 64
+static Model3D *g_models[KC_MAX_MODELS];
 
-                    break;
-                }
+static Model3D *model_get(double handle) {
+    long h = (long)handle;
+    if (h < 1 || h > KC_MAX_MODELS) return NULL;
+    return g_models[h - 1];
+}
 
+/* sobe os buffers uma vez só; a cópia no CPU não é mais necessária */
+static void model_upload(Model3D *m) {
+    if (m->vbo || !g_graphics_initialized || !gl_has_buffers()) return;
+    kc_glGenBuffers(1, &m->vbo);
+    kc_glGenBuffers(1, &m->ibo);
+    kc_glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    kc_glBufferData(GL_ARRAY_BUFFER, (ptrdiff_t)m->vertex_count * KC_MODEL_STRIDE * sizeof(float), m->verts, GL_STATIC_DRAW);
+    kc_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+    kc_glBufferData(GL_ELEMENT_ARRAY_BUFFER, (ptrdiff_t)m->index_count * sizeof(GLuint), m->indices, GL_STATIC_DRAW);
+    kc_glBindBuffer(GL_ARRAY_BUFFER, 0);
+    kc_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(m->verts);
+    free(m->indices);
+    m->verts = NULL;
+    m->indices = NULL;
+}
 
-                returning_flag = 0;
-                returning_value = 0.0;
-                stack_push(stack, retv);
+static int model_load(const char *path) {
+    int slot = -1;
+    for (int i = 0; i < KC_MAX_MODELS; ++i) if (!g_models[i]) { slot = i; break; }
+    if (slot < 0) { fprintf(stderr, "model.load: too many models\n"); return 0; }
+    Model3D *m = calloc(1, sizeof(Model3D));
+    if (!load_obj_model(path, m)) { free(m); return 0; }
+    model_upload(m);
+    g_models[slot] = m;
+    return slot + 1;
+}
+
+/* uma chamada de desenho pro modelo inteiro */
+static int model_draw(Model3D *m) {
+    batch_flush();
+    model_upload(m);
+    if (!m->vbo && !m->verts) return 0;
+
+    const GLsizei stride = KC_MODEL_STRIDE * sizeof(float);
+    const char *base = NULL;
+    const void *indices = NULL;
+    if (m->vbo) {
+        kc_glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+        kc_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+    } else {
+        base = (const char *)m->verts;
+        indices = m->indices;
+    }
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, base);
+    if (m->has_normals) {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, stride, base + 3 * sizeof(float));
+    }
+    if (m->has_uvs) {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, stride, base + 6 * sizeof(float));
+    }
+    glDrawElements(GL_TRIANGLES, m->index_count, GL_UNSIGNED_INT, indices);
+    g_frame_draws++;
+    g_frame_verts += (unsigned long)m->index_count;
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    if (m->vbo) {
+        kc_glBindBuffer(GL_ARRAY_BUFFER, 0);
+        kc_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    return 1;
+}
 
-                free(argvals);
+static void model_free(double handle) {
+    Model3D *m = model_get(handle);
+    if (!m) return;
+    if (m->vbo && g_graphics_initialized) {
+        kc_glDeleteBuffers(1, &m->vbo);
+        kc_glDeleteBuffers(1, &m->ibo);
+    }
+    free(m->verts);
+    free(m->indices);
+    free(m->filename);
+    free(m);
+    g_models[(long)handle - 1] = NULL;
+}
 
-                clear_env_vars(&local);
-                break;
-            }
+/* o contexto GL vai embora junto com os VBOs */
+static void model_free_all(void) {
+    for (int i = 0; i < KC_MAX_MODELS; ++i) if (g_models[i]) model_free(i + 1);
+}
+#endif /* KC_NO_GRAPHICS */
+
+/*=====================================================================
+ * 8.   Freeing nodes, main loop
+ *===================================================================== */
 
+static void free_node(Node *node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_NUMBER: break;
+        case NODE_VAR: free(node->data.var_name); break;
+        case NODE_STRING: free(node->data.str); break;
+        case NODE_CALL:
+            free(node->data.call.func_name);
+            for (size_t i = 0; i < node->data.call.nargs; ++i) free_node(node->data.call.args[i]);
+            free(node->data.call.args);
+            break;
+        case NODE_CLASS_DECL:
+            free(node->data.class_decl.class_name);
+            free_node(node->data.class_decl.body);
+            break;
+        case NODE_BLOCK:
+            for (Node **p = node->data.block.stmts; *p != NULL; ++p) free_node(*p);
+            free(node->data.block.stmts);
+            break;
+        case NODE_WHILE:
+            free_node(node->data.while_node.cond);
+            free_node(node->data.while_node.body);   /* incr fica dentro do corpo */
+            break;
+        case NODE_IF:
+            free_node(node->data.if_node.cond);
+            free_node(node->data.if_node.then_body);
+            free_node(node->data.if_node.else_body);
+            break;
+        case NODE_BINARY: case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC:
+            free_node(node->data.bin.left);
+            free_node(node->data.bin.right);
+            break;
+        case NODE_UNARY:
+            free_node(node->data.unary.operand);
+            break;
+        case NODE_FUNC_DECL:
+            free(node->data.func_decl.name);
+            for (size_t i = 0; i < node->data.func_decl.nparams; ++i) free(node->data.func_decl.params[i]);
+            free(node->data.func_decl.params);
+            free_node(node->data.func_decl.body);
+            break;
+        case NODE_RETURN:
+            free_node(node->data.return_node.expr);
+            break;
+        case NODE_INVARIANT:
+            free_node(node->data.inv.expr);
+            break;
+        case NODE_INT_EXPR:
+            free_node(node->data.int_expr.expr);
+            break;
+        default: break;
+    }
+    free(node);
+}
 
-            fprintf(stderr, "Runtime error: unknown function '%s'\n", node->data.call.func_name);
-            exit(1);
+/* copia a posição de cada nó da árvore pra tabela nova (g_spans) e troca o id.
+   O --serve usa depois de descartar um programa: g_spans só cresce, então
+   sem isso o processo que vive semanas acumula as posições de todo script que viu */
+static void span_renumber(Node *node, const SrcSpan *old, uint32_t nold) {
+    if (!node) return;
+    if (node->id) node->id = span_new(node->id < nold ? old[node->id] : (SrcSpan){ 0, 0, 0 });
+    switch (node->type) {
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.nargs; ++i) span_renumber(node->data.call.args[i], old, nold);
             break;
-        }
+        case NODE_CLASS_DECL: span_renumber(node->data.class_decl.body, old, nold); break;
+        case NODE_BLOCK:
+            for (Node **p = node->data.block.stmts; *p != NULL; ++p) span_renumber(*p, old, nold);
+            break;
+        case NODE_WHILE:
+            span_renumber(node->data.while_node.cond, old, nold);
+            span_renumber(node->data.while_node.body, old, nold);
+            break;
+        case NODE_IF:
+            span_renumber(node->data.if_node.cond, old, nold);
+            span_renumber(node->data.if_node.then_body, old, nold);
+            span_renumber(node->data.if_node.else_body, old, nold);
+            break;
+        case NODE_BINARY: case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC:
+            span_renumber(node->data.bin.left, old, nold);
+            span_renumber(node->data.bin.right, old, nold);
+            break;
+        case NODE_UNARY: span_renumber(node->data.unary.operand, old, nold); break;
+        case NODE_FUNC_DECL: span_renumber(node->data.func_decl.body, old, nold); break;
+        case NODE_RETURN: span_renumber(node->data.return_node.expr, old, nold); break;
+        case NODE_INVARIANT: span_renumber(node->data.inv.expr, old, nold); break;   /* inv.loop é só referência */
+        case NODE_INT_EXPR: span_renumber(node->data.int_expr.expr, old, nold); break;
+        default: break;
+    }
+}
 
-        default:
-            fprintf(stderr, "Runtime: node type desconhecido (%d)\n", node->type);
-            exit(1);
+static void free_function_table(void) {
+    FuncEntry *p = func_table;
+    while (p) {
+        FuncEntry *n = p->next;
+        free(p->name);
+        for (size_t i = 0; i < p->nparams; ++i) free(p->params[i]);
+        free(p->params);
+#ifdef KC_JIT
+        jit_free(p->jit);
+#endif
+        free(p);
+        p = n;
+    }
+    func_table = NULL;
+    for (FuncTable *t = g_funcs, *o; t; t = o) {
+        o = t->older;
+        free(t->slots);
+        free(t);
     }
+    g_funcs = NULL;
+    g_funcs_count = 0;
 }
 
+/*=====================================================================
+ * 8b.  Cache de AST em disco (--cache / KOALCODE_CACHE_DIR)
+ *===================================================================== */
 
-static void exec_node(Node *node, Stack *stack, Env *env) {
-    if (!node) return;
-    if (returning_flag) return;
+/* arquivo <hash do fonte>-<hash da versão>.kcc:
+     CacheHeader | CacheNode[node_count] | uint32 lists[list_count] | strings
+   sem ponteiros: filhos são índices (+1, 0 = NULL), strings são offsets (+1)
+   e listas (args, stmts, params) são offsets em lists. É lido via mmap e
+   validado inteiro antes de montar os Nodes; qualquer diferença = parse normal.
+   Guarda a AST como o parser gerou, antes de qualquer passo de otimização. */
+#define KC_CACHE_MAGIC  0x5453414bu   /* "KAST" */
+#define KC_CACHE_FORMAT 3u            /* sobe quando Node/NodeType mudar */
 
-    switch (node->type) {
-        case NODE_BLOCK: {
-            for (Node **p = node->data.block.stmts; *p != NULL; ++p) {
-                if (returning_flag) break;
-                exec_node(*p, stack, env);
-            }
+typedef struct {
+    uint32_t magic, format;
+    uint64_t version_hash;
+    uint64_t source_hash, source_len;
+    uint32_t node_count, list_count;
+    uint32_t roots, root_count;       /* offset/tamanho em lists */
+    uint64_t strings_size;
+    uint64_t payload_hash;            /* cache_checksum de tudo depois do header */
+} CacheHeader;
+
+typedef struct {
+    uint32_t type, op;
+    uint32_t a, b, c, d;
+    SrcSpan span;
+    double num;
+} CacheNode;
+
+typedef struct {
+    CacheNode *nodes; size_t nlen, ncap;
+    uint32_t *lists; size_t llen, lcap;
+    char *strings; size_t slen, scap;
+} CacheWriter;
+
+static uint64_t fnv1a_mem(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) { h ^= p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+/* checksum do corpo do arquivo: 8 bytes por passo */
+static uint64_t cache_checksum(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 1099511628211ULL;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    while (len--) h = (h ^ *p++) * 1099511628211ULL;
+    return h;
+}
+
+static uint32_t cw_string(CacheWriter *w, const char *str) {
+    if (!str) return 0;
+    size_t n = strlen(str) + 1;
+    if (w->slen + n > w->scap) {
+        while (w->slen + n > w->scap) w->scap = w->scap ? w->scap * 2 : 4096;
+        w->strings = realloc(w->strings, w->scap);
+    }
+    memcpy(w->strings + w->slen, str, n);
+    w->slen += n;
+    return (uint32_t)(w->slen - n + 1);
+}
+
+/* reserva n entradas contíguas em lists */
+static uint32_t cw_list(CacheWriter *w, size_t n) {
+    if (w->llen + n > w->lcap) {
+        while (w->llen + n > w->lcap) w->lcap = w->lcap ? w->lcap * 2 : 256;
+        w->lists = realloc(w->lists, w->lcap * sizeof(uint32_t));
+    }
+    w->llen += n;
+    return (uint32_t)(w->llen - n);
+}
+
+/* pré-ordem: filhos sempre têm índice maior que o pai (o leitor depende disso) */
+static uint32_t cw_node(CacheWriter *w, Node *n) {
+    if (!n) return 0;
+    if (w->nlen == w->ncap) {
+        w->ncap = w->ncap ? w->ncap * 2 : 1024;
+        w->nodes = realloc(w->nodes, w->ncap * sizeof(CacheNode));
+    }
+    size_t idx = w->nlen++;
+    CacheNode c;
+    memset(&c, 0, sizeof c);
+    c.type = (uint32_t)n->type;
+    c.span = node_span(n);
+    switch (n->type) {
+        case NODE_BINARY:
+            c.op = (uint32_t)n->data.bin.op;
+            c.a = cw_node(w, n->data.bin.left);
+            c.b = cw_node(w, n->data.bin.right);
             break;
-        }
-        case NODE_WHILE: {
-            while (1) {
-                exec_expr(node->data.while_node.cond, stack, env);
-                double c = stack_pop(stack);
-                if (c == 0.0) break;
-                exec_node(node->data.while_node.body, stack, env);
-                if (returning_flag) break;
-            }
+        case NODE_UNARY:
+            c.op = (uint32_t)n->data.unary.op;
+            c.a = cw_node(w, n->data.unary.operand);
             break;
-        }
-        case NODE_IF: {
-            exec_expr(node->data.if_node.cond, stack, env);
-            double cond_value = stack_pop(stack);
-            if (cond_value != 0.0) {
-                exec_node(node->data.if_node.then_body, stack, env);
-            } else if (node->data.if_node.else_body) {
-                exec_node(node->data.if_node.else_body, stack, env);
+        case NODE_NUMBER: c.num = n->data.num; break;
+        case NODE_STRING: c.a = cw_string(w, n->data.str); break;
+        case NODE_VAR: c.a = cw_string(w, n->data.var_name); break;
+        case NODE_THREAD_START: c.a = cw_string(w, n->data.thread_name); break;
+        case NODE_CALL: {
+            c.a = cw_string(w, n->data.call.func_name);
+            c.c = (uint32_t)n->data.call.nargs;
+            uint32_t off = cw_list(w, n->data.call.nargs);
+            c.b = off;
+            for (size_t i = 0; i < n->data.call.nargs; ++i) {
+                uint32_t child = cw_node(w, n->data.call.args[i]);
+                w->lists[off + i] = child;   /* lists pode ter sido realocada */
             }
             break;
         }
         case NODE_CLASS_DECL:
-            fprintf(stderr, "Definição de classe '%s' ainda não implementada.\n",
-                    node->data.class_decl.class_name);
-            break;
-        case NODE_FUNC_DECL:
-            /* register function in global table */
-            register_function(node);
-            break;
-        case NODE_RETURN: {
-            if (node->data.return_node.expr) {
-                exec_expr(node->data.return_node.expr, stack, env);
-                double v = stack_pop(stack);
-                returning_value = v;
-            } else {
-                returning_value = 0.0;
+            c.a = cw_string(w, n->data.class_decl.class_name);
+            c.b = cw_node(w, n->data.class_decl.body);
+            break;
+        case NODE_BLOCK: {
+            size_t count = 0;
+            while (n->data.block.stmts[count]) count++;
+            uint32_t off = cw_list(w, count);
+            c.b = off;
+            c.c = (uint32_t)count;
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t child = cw_node(w, n->data.block.stmts[i]);
+                w->lists[off + i] = child;
             }
-            returning_flag = 1;
             break;
         }
-        default:
-
-            exec_expr(node, stack, env);
-
-            if (stack->size > 0) stack_pop(stack);
+        case NODE_WHILE:
+            c.a = cw_node(w, n->data.while_node.cond);
+            c.b = cw_node(w, n->data.while_node.body);
+            break;
+        case NODE_IF:
+            c.a = cw_node(w, n->data.if_node.cond);
+            c.b = cw_node(w, n->data.if_node.then_body);
+            c.c = cw_node(w, n->data.if_node.else_body);
+            break;
+        case NODE_FUNC_DECL: {
+            c.a = cw_string(w, n->data.func_decl.name);
+            c.c = (uint32_t)n->data.func_decl.nparams;
+            uint32_t off = cw_list(w, n->data.func_decl.nparams);
+            c.b = off;
+            for (size_t i = 0; i < n->data.func_decl.nparams; ++i) {
+                uint32_t str = cw_string(w, n->data.func_decl.params[i]);
+                w->lists[off + i] = str;
+            }
+            c.d = cw_node(w, n->data.func_decl.body);
             break;
+        }
+        case NODE_RETURN: c.a = cw_node(w, n->data.return_node.expr); break;
+        case NODE_INVARIANT: case NODE_INT_EXPR:
+        case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC: break;   /* o otimizador só roda depois de gravar */
     }
+    w->nodes[idx] = c;
+    return (uint32_t)idx + 1;
 }
 
-/*=====================================================================
- * 7.   Threading, textures, models, builtins
- *===================================================================== */
+static char *cache_path(const char *dir, uint64_t source_hash) {
+    size_t len = strlen(dir) + 64;
+    char *path = malloc(len);
+    snprintf(path, len, "%s/%016llx-%08x.kcc", dir, (unsigned long long)source_hash,
+             (unsigned)(fnv1a_mem(KC_VERSION, sizeof KC_VERSION - 1) & 0xffffffffu));
+    return path;
+}
 
-typedef struct { char *name; } ThreadData;
-static void *thread_func(void *arg) {
-    ThreadData *td = (ThreadData *)arg;
-    printf("Thread %s entrou na função.\n", td->name);
-    for (int i = 0; i < 3; ++i) {
-        printf("Thread %s: contador %d\n", td->name, i);
+/* imagem completa (header + corpo) num buffer só; *out_size recebe o tamanho */
+static char *cache_serialize(const char *src, size_t src_len, Node **program, size_t *out_size) {
+    CacheWriter w;
+    memset(&w, 0, sizeof w);
+    size_t nroots = 0;
+    while (program[nroots]) nroots++;
+    uint32_t roots = cw_list(&w, nroots);
+    for (size_t i = 0; i < nroots; ++i) {
+        uint32_t child = cw_node(&w, program[i]);
+        w.lists[roots + i] = child;
     }
-    printf("Thread %s terminou.\n", td->name);
-    free(td->name);
-    free(td);
-    return NULL;
+
+    CacheHeader h;
+    memset(&h, 0, sizeof h);
+    h.magic = KC_CACHE_MAGIC;
+    h.format = KC_CACHE_FORMAT;
+    h.version_hash = fnv1a_mem(KC_VERSION, sizeof KC_VERSION - 1);
+    h.source_hash = fnv1a_mem(src, src_len);
+    h.source_len = src_len;
+    h.node_count = (uint32_t)w.nlen;
+    h.list_count = (uint32_t)w.llen;
+    h.roots = roots;
+    h.root_count = (uint32_t)nroots;
+    h.strings_size = w.slen;
+
+    size_t nbytes = w.nlen * sizeof(CacheNode), lbytes = w.llen * sizeof(uint32_t);
+    size_t size = sizeof h + nbytes + lbytes + w.slen;
+    char *image = malloc(size);
+    char *body = image + sizeof h;
+    if (nbytes) memcpy(body, w.nodes, nbytes);
+    if (lbytes) memcpy(body + nbytes, w.lists, lbytes);
+    if (w.slen) memcpy(body + nbytes + lbytes, w.strings, w.slen);
+    h.payload_hash = cache_checksum(KC_CACHE_MAGIC, body, size - sizeof h);
+    memcpy(image, &h, sizeof h);
+
+    free(w.nodes);
+    free(w.lists);
+    free(w.strings);
+    *out_size = size;
+    return image;
 }
-static void start_thread(const char *name) {
-    pthread_t t;
-    ThreadData *td = malloc(sizeof(ThreadData));
-    td->name = strdup(name);
-    if (pthread_create(&t, NULL, thread_func, td) != 0) {
-        perror("pthread_create");
-        exit(1);
+
+static void cache_store(const char *dir, const char *src, size_t src_len, Node **program) {
+    size_t size;
+    char *image = cache_serialize(src, src_len, program, &size);
+
+    mkdir(dir, 0755);
+    char *path = cache_path(dir, fnv1a_mem(src, src_len));
+    size_t tlen = strlen(path) + 32;
+    char *tmp = malloc(tlen);
+    snprintf(tmp, tlen, "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    int ok = f != NULL;
+    if (ok) {
+        ok = fwrite(image, 1, size, f) == size;
+        ok = (fclose(f) == 0) && ok;
     }
-    pthread_detach(t);
+    /* rename é atômico: um leitor vê o arquivo antigo ou o novo inteiro */
+    if (!ok || rename(tmp, path) != 0) unlink(tmp);
+    free(tmp);
+    free(path);
+    free(image);
 }
 
-static GLuint load_texture_from_file(const char *filename, int *width, int *height) {
-
-    SDL_Surface *surface = IMG_Load(filename);
-    if (!surface) { fprintf(stderr, "Erro ao carregar imagem: %s\n", IMG_GetError()); return 0; }
-    *width = surface->w; *height = surface->h;
-    GLuint texture_id; glGenTextures(1, &texture_id); glBindTexture(GL_TEXTURE_2D, texture_id);
-    GLenum format = (surface->format->BytesPerPixel == 4) ? GL_RGBA : GL_RGB;
-    glTexImage2D(GL_TEXTURE_2D, 0, format, surface->w, surface->h, 0, format, GL_UNSIGNED_BYTE, surface->pixels);
-    SDL_FreeSurface(surface);
-    return texture_id;
+typedef struct {
+    const CacheHeader *h;
+    const CacheNode *nodes;
+    const uint32_t *lists;
+    const char *strings;
+} CacheImage;
+
+static int cache_valid_str(const CacheImage *img, uint32_t s, int nullable) {
+    if (s == 0) return nullable;
+    return s <= img->h->strings_size;
 }
 
-static int load_obj_model(const char *filename, Model3D *model) {
+static int cache_valid_child(uint32_t parent, uint32_t child, uint32_t count, int nullable) {
+    if (child == 0) return nullable;
+    return child > parent && child <= count;   /* só pra frente: sem ciclos */
+}
 
-    (void)filename; (void)model;
-    return 0;
+/* confere todos os índices/offsets antes de confiar no arquivo */
+static int cache_validate(const CacheImage *img) {
+    const CacheHeader *h = img->h;
+    if (h->strings_size && img->strings[h->strings_size - 1] != '\0') return 0;
+    if ((uint64_t)h->roots + h->root_count > h->list_count) return 0;
+    for (uint32_t i = 0; i < h->root_count; ++i)
+        if (!cache_valid_child(0, img->lists[h->roots + i], h->node_count, 0)) return 0;
+    for (uint32_t i = 0; i < h->node_count; ++i) {
+        const CacheNode *c = &img->nodes[i];
+        uint32_t self = i + 1;
+        int ok;
+        switch (c->type) {
+            case NODE_BINARY:
+                ok = c->op < OP_UNKNOWN && cache_valid_child(self, c->a, h->node_count, 0) && cache_valid_child(self, c->b, h->node_count, 0);
+                break;
+            case NODE_UNARY:
+                ok = c->op < OP_UNKNOWN && cache_valid_child(self, c->a, h->node_count, 0);
+                break;
+            case NODE_NUMBER: ok = 1; break;
+            case NODE_STRING: case NODE_VAR: case NODE_THREAD_START:
+                ok = cache_valid_str(img, c->a, c->type == NODE_THREAD_START);
+                break;
+            case NODE_CALL: case NODE_BLOCK: case NODE_FUNC_DECL:
+                ok = (uint64_t)c->b + c->c <= h->list_count &&
+                     (c->type == NODE_BLOCK || cache_valid_str(img, c->a, 0));
+                for (uint32_t k = 0; ok && k < c->c; ++k)
+                    ok = c->type == NODE_FUNC_DECL ? cache_valid_str(img, img->lists[c->b + k], 0)
+                                                   : cache_valid_child(self, img->lists[c->b + k], h->node_count, 0);
+                if (ok && c->type == NODE_FUNC_DECL) ok = cache_valid_child(self, c->d, h->node_count, 0);
+                break;
+            case NODE_CLASS_DECL:
+                ok = cache_valid_str(img, c->a, 0) && cache_valid_child(self, c->b, h->node_count, 0);
+                break;
+            case NODE_WHILE:
+                ok = cache_valid_child(self, c->a, h->node_count, 0) && cache_valid_child(self, c->b, h->node_count, 0);
+                break;
+            case NODE_IF:
+                ok = cache_valid_child(self, c->a, h->node_count, 0) && cache_valid_child(self, c->b, h->node_count, 0) &&
+                     cache_valid_child(self, c->c, h->node_count, 1);
+                break;
+            case NODE_RETURN: ok = cache_valid_child(self, c->a, h->node_count, 1); break;
+            default: ok = 0; break;
+        }
+        if (!ok) return 0;
+    }
+    return 1;
 }
 
-/*=====================================================================
- * 8.   Freeing nodes, main loop
- *===================================================================== */
+static char *cache_str(const CacheImage *img, uint32_t s) {
+    return s ? strdup(img->strings + s - 1) : NULL;
+}
 
-static void free_node(Node *node) {
-    if (!node) return;
-    switch (node->type) {
-        case NODE_NUMBER: break;
-        case NODE_VAR: free(node->data.var_name); break;
-        case NODE_STRING: free(node->data.str); break;
+static Node *cache_node(const CacheImage *img, uint32_t idx) {
+    if (!idx) return NULL;
+    const CacheNode *c = &img->nodes[idx - 1];
+    Node *n = node_alloc(c->span);
+    n->type = (NodeType)c->type;
+    switch (n->type) {
+        case NODE_BINARY:
+            n->data.bin.op = (OpCode)c->op;
+            n->data.bin.left = cache_node(img, c->a);
+            n->data.bin.right = cache_node(img, c->b);
+            break;
+        case NODE_UNARY:
+            n->data.unary.op = (OpCode)c->op;
+            n->data.unary.operand = cache_node(img, c->a);
+            break;
+        case NODE_NUMBER: n->data.num = c->num; break;
+        case NODE_STRING: n->data.str = cache_str(img, c->a); break;
+        case NODE_VAR: n->data.var_name = cache_str(img, c->a); break;
+        case NODE_THREAD_START: n->data.thread_name = cache_str(img, c->a); break;
         case NODE_CALL:
-            free(node->data.call.func_name);
-            for (size_t i = 0; i < node->data.call.nargs; ++i) free_node(node->data.call.args[i]);
-            free(node->data.call.args);
+            n->data.call.func_name = cache_str(img, c->a);
+            n->data.call.nargs = c->c;
+            n->data.call.stat_id = 0;
+            n->data.call.fe_cache = NULL;
+            /* como o parser: espaço pra pelo menos 4 argumentos */
+            n->data.call.args = calloc(c->c > 4 ? c->c : 4, sizeof(Node *));
+            for (uint32_t i = 0; i < c->c; ++i) n->data.call.args[i] = cache_node(img, img->lists[c->b + i]);
             break;
         case NODE_CLASS_DECL:
-            free(node->data.class_decl.class_name);
-            free_node(node->data.class_decl.body);
+            n->data.class_decl.class_name = cache_str(img, c->a);
+            n->data.class_decl.body = cache_node(img, c->b);
             break;
         case NODE_BLOCK:
-            for (Node **p = node->data.block.stmts; *p != NULL; ++p) free_node(*p);
-            free(node->data.block.stmts);
+            n->data.block.stmts = calloc(c->c + 1, sizeof(Node *));
+            for (uint32_t i = 0; i < c->c; ++i) n->data.block.stmts[i] = cache_node(img, img->lists[c->b + i]);
             break;
         case NODE_WHILE:
-            free_node(node->data.while_node.cond);
-            free_node(node->data.while_node.body);
+            n->data.while_node.cond = cache_node(img, c->a);
+            n->data.while_node.body = cache_node(img, c->b);
+            n->data.while_node.incr = NULL;
+            n->data.while_node.epoch = 0;
             break;
         case NODE_IF:
-            free_node(node->data.if_node.cond);
-            free_node(node->data.if_node.then_body);
-            free_node(node->data.if_node.else_body);
-            break;
-        case NODE_BINARY:
-            free_node(node->data.bin.left);
-            free_node(node->data.bin.right);
-            break;
-        case NODE_UNARY:
-            free_node(node->data.unary.operand);
+            n->data.if_node.cond = cache_node(img, c->a);
+            n->data.if_node.then_body = cache_node(img, c->b);
+            n->data.if_node.else_body = cache_node(img, c->c);
             break;
         case NODE_FUNC_DECL:
-            free(node->data.func_decl.name);
-            for (size_t i = 0; i < node->data.func_decl.nparams; ++i) free(node->data.func_decl.params[i]);
-            free(node->data.func_decl.params);
-            free_node(node->data.func_decl.body);
-            break;
-        case NODE_RETURN:
-            free_node(node->data.return_node.expr);
+            n->data.func_decl.name = cache_str(img, c->a);
+            n->data.func_decl.nparams = c->c;
+            n->data.func_decl.params = calloc(c->c ? c->c : 1, sizeof(char *));
+            for (uint32_t i = 0; i < c->c; ++i) n->data.func_decl.params[i] = cache_str(img, img->lists[c->b + i]);
+            n->data.func_decl.body = cache_node(img, c->d);
             break;
-        default: break;
+        case NODE_RETURN: n->data.return_node.expr = cache_node(img, c->a); break;
+        case NODE_INVARIANT: case NODE_INT_EXPR:
+        case NODE_VAR_NUM: case NODE_VAR_VAR: case NODE_INC: break;   /* cache_valid já recusa */
     }
-    free(node);
+    return n;
 }
 
-static void free_function_table(void) {
-    FuncEntry *p = func_table;
-    while (p) {
-        FuncEntry *n = p->next;
-        free(p->name);
-        for (size_t i = 0; i < p->nparams; ++i) free(p->params[i]);
-        free(p->params);
-        free(p);
-        p = n;
+/* monta os Nodes de uma imagem; NULL se ela não é deste fonte/versão ou está corrompida */
+static Node **cache_from_image(const void *data, size_t size, uint64_t source_hash, size_t src_len) {
+    if (size < sizeof(CacheHeader)) return NULL;
+    CacheImage img;
+    img.h = data;
+    const CacheHeader *h = img.h;
+    uint64_t need = sizeof(CacheHeader) + (uint64_t)h->node_count * sizeof(CacheNode) +
+                    (uint64_t)h->list_count * sizeof(uint32_t) + h->strings_size;
+    if (h->magic != KC_CACHE_MAGIC || h->format != KC_CACHE_FORMAT ||
+        h->version_hash != fnv1a_mem(KC_VERSION, sizeof KC_VERSION - 1) ||
+        h->source_hash != source_hash || h->source_len != src_len || need != size ||
+        cache_checksum(KC_CACHE_MAGIC, h + 1, size - sizeof(CacheHeader)) != h->payload_hash)
+        return NULL;
+    img.nodes = (const CacheNode *)(h + 1);
+    img.lists = (const uint32_t *)(img.nodes + h->node_count);
+    img.strings = (const char *)(img.lists + h->list_count);
+    if (!cache_validate(&img)) return NULL;
+    Node **program = calloc(h->root_count + 1, sizeof(Node *));
+    for (uint32_t i = 0; i < h->root_count; ++i) program[i] = cache_node(&img, img.lists[h->roots + i]);
+    return program;
+}
+
+/* NULL se não tem cache válido pra este fonte */
+static Node **cache_load(const char *dir, const char *src, size_t src_len) {
+    uint64_t source_hash = fnv1a_mem(src, src_len);
+    char *path = cache_path(dir, source_hash);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) { close(fd); return NULL; }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    Node **program = cache_from_image(map, size, source_hash, src_len);
+    munmap(map, size);
+    return program;
+}
+
+/* --cache sem KOALCODE_CACHE_DIR: $XDG_CACHE_HOME/koalcode ou ~/.cache/koalcode */
+static char *cache_default_dir(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    char buf[PATH_MAX];
+    if (base && *base) snprintf(buf, sizeof buf, "%s/koalcode", base);
+    else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) return NULL;
+        snprintf(buf, sizeof buf, "%s/.cache", home);
+        mkdir(buf, 0755);
+        snprintf(buf, sizeof buf, "%s/.cache/koalcode", home);
     }
-    func_table = NULL;
+    return strdup(buf);
 }
 
 /*=====================================================================
- * 9.   MAIN (melhor parte kk)
+ * 8c.  Execução de um programa e modo servidor (--serve)
  *===================================================================== */
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Uso: %s <arquivo.kc>\n", argv[0]);
-        return 1;
-    }
-
-    FILE *f = fopen(argv[1], "rb");
-    if (!f) { perror("fopen"); return 1; }
+static char *read_source(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror(path); return NULL; }
     fseek(f, 0, SEEK_END);
     long sz = ftell(f);
     fseek(f, 0, SEEK_SET);
-    char *src = malloc(sz + 1);
-    fread(src, 1, sz, f);
-    src[sz] = '\0';
+    if (sz < 0) { perror(path); fclose(f); return NULL; }
+    char *src = malloc((size_t)sz + 1);
+    size_t got = fread(src, 1, (size_t)sz, f);
+    src[got] = '\0';
     fclose(f);
+    *len = got;
+    return src;
+}
 
+/* cache em disco se tiver, senão tokenizer + parser */
+static Node **parse_source(const char *src, size_t len, const char *cache_dir) {
+    Node **program = cache_dir ? cache_load(cache_dir, src, len) : NULL;
+    if (program) return program;
     TokenStream ts = tokenize(src);
     global_ts = &ts;
     global_tok_pos = 0;
+    jmp_buf on_error;
+    g_error_jmp = &on_error;
+    if (setjmp(on_error) == 0) program = parse_program();
+    else program = NULL;   /* parse_error já mostrou a mensagem; o pedaço da árvore fica vazado */
+    g_error_jmp = NULL;
+    for (size_t i = 0; i < ts.size; ++i) token_free(&ts.tokens[i]);
+    free(ts.tokens);
+    global_ts = NULL;
+    if (program && cache_dir) cache_store(cache_dir, src, len, program);
+    return program;
+}
 
-    Node **program = parse_program();
+static void free_program(Node **program) {
+    for (Node **pn = program; *pn != NULL; ++pn) free_node(*pn);
+    free(program);
+}
 
-    Stack stack;
-    stack_init(&stack);
-    Env env;
-    env_init(&env, NULL);
+/* 0 = terminou, 1 = parou num erro de runtime (kc_error volta pra cá) */
+static int exec_program(Node **program, Stack *stack, Env *env) {
+    jmp_buf on_error;
+    g_error_jmp = &on_error;
+    if (setjmp(on_error)) {
+        /* os Env locais das fuktions que estavam no meio ficam vazados */
+        g_error_jmp = NULL;
+        g_call_depth = 0;
+        returning_flag = 0;
+#ifndef KC_NO_STATS
+        t_stat_top = 0;       /* as chamadas cronometradas abertas não fecham mais */
+        t_stat_open = -1;
+#endif
+        return 1;
+    }
 
     for (Node **pn = program; *pn != NULL; ++pn) {
         if ((*pn)->type == NODE_FUNC_DECL) {
@@ -2130,19 +7243,27 @@ int main(int argc, char **argv) {
 
     for (Node **pn = program; *pn != NULL; ++pn) {
         if ((*pn)->type != NODE_FUNC_DECL) {
-            exec_node(*pn, &stack, &env);
+            exec_node(*pn, stack, env);
         }
     }
+    g_error_jmp = NULL;
+    return 0;
+}
 
-    /* Cleanup */
-    for (size_t i = 0; i < ts.size; ++i) token_free(&ts.tokens[i]);
-    free(ts.tokens);
-
-    for (Node **pn = program; *pn != NULL; ++pn) {
-        free_node(*pn);
+/* roda o programa numa VM nova e libera tudo o que o script abriu */
+static int run_program(Node **program) {
+    size_t depth = 0;
+    for (Node **pn = program; *pn; ++pn) {
+        size_t d = stack_depth(*pn);
+        if (d > depth) depth = d;
     }
-    free(program);
-    free(src);
+    Stack stack;
+    stack_init(&stack, depth);
+    Env env;
+    env_init(&env, NULL);
+
+    int status = exec_program(program, &stack, &env);
+
     free(stack.stack);
 
     VarPair *vp = env.head;
@@ -2154,15 +7275,650 @@ int main(int argc, char **argv) {
     }
 
     free_function_table();
+#ifndef KC_NO_GRAPHICS
+    if (g_graphics_initialized) {
+        /* script sem graphics.quit: ainda fecha o dump de quadros */
+        model_free_all();
+        texture_free_all();
+        gfx_close();
+        g_graphics_initialized = 0;
+    }
+#endif
+    file_close_all();
+    buf_free_all();
+    math_free_all();
+#ifndef KC_NO_GRAPHICS
+    model_free_all();
+    texture_free_all();
+#endif
 
+#ifndef KC_NO_NETWORK
     if (g_network_initialized) {
         if (g_curl_handle) {
             curl_easy_cleanup(g_curl_handle);
             g_curl_handle = NULL;
         }
         curl_global_cleanup();
+        g_network_initialized = 0;
     }
+#endif
+    return status;
+}
 
-    sleep(1);
-    return 0;
-}
\ No newline at end of file
+/* protocolo (uma conexão por script):
+     cliente -> "CWD <pasta>\n" (opcional), depois "RUN <caminho>\n" ou "SRC <bytes>\n<fonte>"
+                + opcionalmente stdin/stdout/stderr dele via SCM_RIGHTS
+     servidor -> a saída do script (se não recebeu os fds) e no fim "EXIT <código>\n"
+   O pai só analisa e guarda programas; cada script roda num filho (fork), que
+   herda a AST pronta, o curl iniciado e as bibliotecas já carregadas. */
+#define KC_SERVE_PROGRAMS 32
+#define KC_SERVE_MAX_SRC  (256UL << 20)   /* maior "SRC <bytes>" aceito */
+#define KC_SERVE_LINE_MAX 8192
+#define KC_SERVE_REQ_MAX  (KC_SERVE_MAX_SRC + 4 * KC_SERVE_LINE_MAX)
+#define KC_SERVE_TIMEOUT  5.0             /* segundos pro pedido inteiro chegar */
+
+typedef struct {
+    uint64_t hash;
+    size_t len;
+    Node **program;
+    uint64_t last_used;
+} ServeProgram;
+
+typedef struct {
+    pid_t pid;
+    int conn;
+} ServeJob;
+
+/* pedido ainda chegando: o poll do serve_main lê aos pedaços, sem bloquear,
+   e o pedido inteiro tem KC_SERVE_TIMEOUT segundos pra chegar */
+typedef struct {
+    int conn;
+    int fds[3];             /* stdin/stdout/stderr do cliente, -1 se não mandou */
+    char *buf;
+    size_t len, cap;
+    double deadline;
+} ServeConn;
+
+/* análise num filho: a imagem (cache_serialize) chega pelo pipe, lida aos
+   pedaços pelo poll do serve_main, e o pedido só roda quando ela termina */
+typedef struct {
+    pid_t pid;
+    int fd;                 /* ponta de leitura do pipe, O_NONBLOCK */
+    int status, reaped;     /* o SIGCHLD pode chegar antes do fim do pipe */
+    char *image;
+    size_t size, cap;
+    uint64_t hash;
+    /* o pedido que espera */
+    int conn, fds[3];
+    char *cwd, *path, *src;
+    size_t len;
+} ServeParse;
+
+static ServeProgram g_serve_programs[KC_SERVE_PROGRAMS];
+static uint64_t g_serve_clock = 0;
+static ServeJob *g_serve_jobs = NULL;
+static size_t g_serve_njobs = 0, g_serve_jobs_cap = 0;
+static ServeConn *g_serve_conns = NULL;
+static size_t g_serve_nconns = 0, g_serve_conns_cap = 0;
+static ServeParse *g_serve_parses = NULL;
+static size_t g_serve_nparses = 0, g_serve_parses_cap = 0;
+static int g_sigchld_pipe[2] = { -1, -1 };
+
+static void serve_on_sigchld(int sig) {
+    (void)sig;
+    int saved = errno;
+    ssize_t r = write(g_sigchld_pipe[1], "c", 1);
+    (void)r;
+    errno = saved;
+}
+
+/* recebe sem bloquear o que já chegou; fds[] pega stdin/stdout/stderr do cliente.
+   0 = esperar mais, -1 = a conexão fechou ou deu erro */
+static int serve_conn_recv(ServeConn *c) {
+    for (;;) {
+        if (c->len + 1 >= c->cap) {
+            size_t cap = c->cap ? c->cap * 2 : 16384;
+            if (cap > KC_SERVE_REQ_MAX) cap = KC_SERVE_REQ_MAX;
+            if (cap <= c->len + 1) { fprintf(stderr, "serve: request too large\n"); return -1; }
+            c->buf = realloc(c->buf, cap);
+            c->cap = cap;
+        }
+        union { struct cmsghdr h; char buf[CMSG_SPACE(3 * sizeof(int))]; } ctrl;
+        struct iovec iov = { c->buf + c->len, c->cap - c->len - 1 };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof ctrl.buf;
+        ssize_t n = recvmsg(c->conn, &msg, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        for (struct cmsghdr *h = CMSG_FIRSTHDR(&msg); h; h = CMSG_NXTHDR(&msg, h)) {
+            if (h->cmsg_level != SOL_SOCKET || h->cmsg_type != SCM_RIGHTS) continue;
+            size_t nfds = (h->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t k = 0; k < nfds; ++k) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(h) + k * sizeof(int), sizeof fd);
+                if (k < 3 && c->fds[k] < 0) c->fds[k] = fd;
+                else close(fd);                          /* repetido ou sobrando */
+            }
+        }
+        if (n == 0) return -1;
+        c->len += (size_t)n;
+    }
+}
+
+/* analisa o que chegou até agora. 1 = pedido completo (src preenchido),
+   0 = falta chegar, -1 = pedido inválido. cwd e path (o do RUN, "" no SRC) têm path_size bytes */
+static int serve_conn_parse(ServeConn *c, char *cwd, char *path, size_t path_size, char **src, size_t *src_len) {
+    char line[KC_SERVE_LINE_MAX];
+    size_t pos = 0;
+    cwd[0] = path[0] = '\0';
+    while (1) {
+        char *start = c->buf + pos;
+        char *nl = memchr(start, '\n', c->len - pos);
+        size_t n = nl ? (size_t)(nl - start) : c->len - pos;
+        if (n >= sizeof line) { fprintf(stderr, "serve: request line too long\n"); return -1; }
+        if (!nl) return 0;
+        memcpy(line, start, n);
+        line[n] = '\0';
+        pos += n + 1;
+        if (strncmp(line, "CWD ", 4) == 0) {
+            if (n - 4 < path_size) memcpy(cwd, line + 4, n - 4 + 1);
+        } else if (strncmp(line, "RUN ", 4) == 0) {
+            if (n - 4 < path_size) memcpy(path, line + 4, n - 4 + 1);
+            *src = read_source(line + 4, src_len);
+            return *src ? 1 : -1;
+        } else if (strncmp(line, "SRC ", 4) == 0) {
+            char *end;
+            errno = 0;
+            unsigned long long n_src = strtoull(line + 4, &end, 10);
+            if (errno || end == line + 4 || *end || line[4] == '-' || n_src > KC_SERVE_MAX_SRC) {
+                fprintf(stderr, "serve: bad source length '%s'\n", line + 4);
+                return -1;
+            }
+            size_t want = (size_t)n_src;
+            if (c->len - pos < want) {
+                if (pos + want + 1 > KC_SERVE_REQ_MAX) { fprintf(stderr, "serve: request too large\n"); return -1; }
+                if (c->cap < pos + want + 1) {          /* já reserva o fonte inteiro */
+                    char *grown = realloc(c->buf, pos + want + 1);
+                    if (!grown) { fprintf(stderr, "serve: out of memory for a %zu-byte source\n", want); return -1; }
+                    c->buf = grown;
+                    c->cap = pos + want + 1;
+                }
+                return 0;
+            }
+            memmove(c->buf, c->buf + pos, want);       /* o buffer vira o fonte */
+            c->buf[want] = '\0';
+            *src = c->buf;
+            *src_len = want;
+            c->buf = NULL;
+            c->len = c->cap = 0;
+            return 1;
+        } else {
+            fprintf(stderr, "serve: bad request line '%s'\n", line);
+            return -1;
+        }
+    }
+}
+
+/* tira o pedido i da lista; fail = responde EXIT 1 e fecha tudo */
+static void serve_conn_remove(size_t i, int fail) {
+    ServeConn *c = &g_serve_conns[i];
+    free(c->buf);
+    if (fail) {
+        for (int k = 0; k < 3; ++k) if (c->fds[k] >= 0) close(c->fds[k]);
+        send_all(c->conn, "EXIT 1\n", 7);
+        close(c->conn);
+    }
+    g_serve_conns[i] = g_serve_conns[--g_serve_nconns];
+}
+
+/* g_spans refeita só com os programas em memória: as posições dos descartados saem junto.
+   Só roda quando metade da tabela já é lixo, então cada nó paga O(1) no total */
+static uint32_t g_serve_spans_live = 0;
+
+static void serve_compact_spans(void) {
+    if (g_nspans / 2 <= g_serve_spans_live) return;
+    SrcSpan *old = g_spans;
+    uint32_t nold = g_nspans;
+    g_spans = NULL;
+    g_nspans = g_spans_cap = 0;
+    for (int i = 0; i < KC_SERVE_PROGRAMS; ++i) {
+        if (!g_serve_programs[i].program) continue;
+        for (Node **pn = g_serve_programs[i].program; *pn; ++pn) span_renumber(*pn, old, nold);
+    }
+    free(old);
+    g_serve_spans_live = g_nspans;
+}
+
+/* guarda a AST nova no lugar da usada há mais tempo */
+static Node **serve_install(uint64_t hash, size_t len, Node **program) {
+    optimize_program(program);   /* depois de serializar: o cache guarda a árvore crua */
+    ServeProgram *slot = &g_serve_programs[0];
+    for (int i = 0; i < KC_SERVE_PROGRAMS; ++i) {
+        ServeProgram *p = &g_serve_programs[i];
+        if (!p->program || (slot->program && p->last_used < slot->last_used)) slot = p;
+    }
+    int evicted = slot->program != NULL;
+    if (evicted) free_program(slot->program);
+    slot->hash = hash;
+    slot->len = len;
+    slot->program = program;
+    slot->last_used = ++g_serve_clock;
+    if (evicted) serve_compact_spans();
+    return program;
+}
+
+/* AST pronta pra este fonte, da memória ou do cache em disco; NULL = precisa analisar */
+static Node **serve_program(const char *src, size_t len, const char *cache_dir) {
+    uint64_t hash = fnv1a_mem(src, len);
+    for (int i = 0; i < KC_SERVE_PROGRAMS; ++i) {
+        ServeProgram *p = &g_serve_programs[i];
+        if (p->program && p->hash == hash && p->len == len) { p->last_used = ++g_serve_clock; return p->program; }
+    }
+    Node **program = cache_dir ? cache_load(cache_dir, src, len) : NULL;
+    return program ? serve_install(hash, len, program) : NULL;
+}
+
+/* O parser roda num filho: erro de sintaxe deixa a árvore pela metade (vazada),
+   e o pai fica vivo por semanas. Cada pedido analisa o seu, então a mensagem
+   de erro vai pro stderr de quem mandou. 0 = não deu pra começar */
+static int serve_parse_start(int conn, const int fds[3], const char *cwd, const char *path,
+                             char *src, size_t len, const char *cache_dir) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) { close(pipefd[0]); close(pipefd[1]); return 0; }
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(fds[2] >= 0 ? fds[2] : conn, 2);
+        Node **parsed = parse_source(src, len, cache_dir);
+        if (!parsed) _exit(1);
+        size_t size;
+        char *image = cache_serialize(src, len, parsed, &size);
+        for (size_t off = 0; off < size; ) {
+            ssize_t w = write(pipefd[1], image + off, size - off);
+            if (w <= 0) _exit(2);
+            off += (size_t)w;
+        }
+        _exit(0);
+    }
+    close(pipefd[1]);
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    if (g_serve_nparses == g_serve_parses_cap) {
+        g_serve_parses_cap = g_serve_parses_cap ? g_serve_parses_cap * 2 : 8;
+        g_serve_parses = realloc(g_serve_parses, g_serve_parses_cap * sizeof(ServeParse));
+    }
+    ServeParse *p = &g_serve_parses[g_serve_nparses++];
+    memset(p, 0, sizeof *p);
+    p->pid = pid;
+    p->fd = pipefd[0];
+    p->status = -1;
+    p->hash = fnv1a_mem(src, len);
+    p->conn = conn;
+    memcpy(p->fds, fds, sizeof p->fds);
+    p->cwd = strdup(cwd);
+    p->path = strdup(path);
+    p->src = src;
+    p->len = len;
+    return 1;
+}
+
+/* lê o que já chegou da imagem; 1 = o filho fechou o pipe (terminou) */
+static int serve_parse_recv(ServeParse *p) {
+    while (1) {
+        if (p->size == p->cap) {
+            p->cap = p->cap ? p->cap * 2 : 65536;
+            p->image = realloc(p->image, p->cap);
+        }
+        ssize_t r = read(p->fd, p->image + p->size, p->cap - p->size);
+        if (r > 0) { p->size += (size_t)r; continue; }
+        if (r == 0) return 1;
+        if (errno == EINTR) continue;
+        return errno != EAGAIN && errno != EWOULDBLOCK;
+    }
+}
+
+static void serve_finish_jobs(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < g_serve_nparses; ++i) {
+            if (g_serve_parses[i].pid != pid) continue;
+            g_serve_parses[i].status = status;
+            g_serve_parses[i].reaped = 1;
+        }
+        for (size_t i = 0; i < g_serve_njobs; ++i) {
+            if (g_serve_jobs[i].pid != pid) continue;
+            int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+            char line[32];
+            int n = snprintf(line, sizeof line, "EXIT %d\n", code);
+            send_all(g_serve_jobs[i].conn, line, (size_t)n);
+            close(g_serve_jobs[i].conn);
+            g_serve_jobs[i] = g_serve_jobs[--g_serve_njobs];
+            break;
+        }
+    }
+}
+
+/* roda o programa num filho; program NULL = responde EXIT 1 */
+static void serve_run(int listen_fd, int conn, const int fds[3], const char *cwd,
+                      const char *path, char *src, Node **program) {
+    pid_t pid = program ? fork() : -1;
+    if (pid == 0) {
+        /* erros saem como numa execução direta: caminho relativo à pasta do cliente + a linha */
+        size_t n_cwd = strlen(cwd);
+        if (n_cwd && strncmp(path, cwd, n_cwd) == 0 && path[n_cwd] == '/') path += n_cwd + 1;
+        if (path[0]) g_script_name = path;
+        g_source = src;
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        close(listen_fd);
+        close(g_sigchld_pipe[0]);
+        close(g_sigchld_pipe[1]);
+        for (size_t i = 0; i < g_serve_njobs; ++i) close(g_serve_jobs[i].conn);
+        for (size_t i = 0; i < g_serve_nconns; ++i) {
+            close(g_serve_conns[i].conn);
+            for (int k = 0; k < 3; ++k) if (g_serve_conns[i].fds[k] >= 0) close(g_serve_conns[i].fds[k]);
+        }
+        for (size_t i = 0; i < g_serve_nparses; ++i) {
+            close(g_serve_parses[i].fd);
+            close(g_serve_parses[i].conn);
+            for (int k = 0; k < 3; ++k) if (g_serve_parses[i].fds[k] >= 0) close(g_serve_parses[i].fds[k]);
+        }
+        if (fds[0] >= 0) dup2(fds[0], 0);
+        else { int devnull = open("/dev/null", O_RDONLY); if (devnull >= 0) { dup2(devnull, 0); close(devnull); } }
+        dup2(fds[1] >= 0 ? fds[1] : conn, 1);
+        dup2(fds[2] >= 0 ? fds[2] : conn, 2);
+        if (cwd[0] && chdir(cwd) != 0) perror(cwd);
+        int rc = run_program(program);
+        fflush(stdout);
+        exit(rc);
+    }
+    free(src);
+    for (int i = 0; i < 3; ++i) if (fds[i] >= 0) close(fds[i]);
+    if (pid < 0) {
+        send_all(conn, "EXIT 1\n", 7);
+        close(conn);
+        return;
+    }
+    if (g_serve_njobs == g_serve_jobs_cap) {
+        g_serve_jobs_cap = g_serve_jobs_cap ? g_serve_jobs_cap * 2 : 16;
+        g_serve_jobs = realloc(g_serve_jobs, g_serve_jobs_cap * sizeof(ServeJob));
+    }
+    g_serve_jobs[g_serve_njobs].pid = pid;
+    g_serve_jobs[g_serve_njobs].conn = conn;
+    g_serve_njobs++;
+}
+
+/* pedido completo: programa já conhecido roda agora; senão a análise
+   começa num filho e serve_parse_done roda o pedido depois */
+static void serve_handle(int listen_fd, int conn, const int fds[3], const char *cwd,
+                         const char *path, char *src, size_t len, const char *cache_dir) {
+    Node **program = src ? serve_program(src, len, cache_dir) : NULL;
+    if (src && !program && serve_parse_start(conn, fds, cwd, path, src, len, cache_dir)) return;
+    serve_run(listen_fd, conn, fds, cwd, path, src, program);
+}
+
+/* a imagem da análise i chegou inteira: monta a AST e roda o pedido */
+static void serve_parse_done(size_t i, int listen_fd) {
+    ServeParse p = g_serve_parses[i];
+    g_serve_parses[i] = g_serve_parses[--g_serve_nparses];
+    close(p.fd);
+    if (!p.reaped) while (waitpid(p.pid, &p.status, 0) < 0 && errno == EINTR) {}
+    /* outro pedido com o mesmo fonte pode ter terminado antes */
+    Node **program = serve_program(p.src, p.len, NULL);
+    if (!program && WIFEXITED(p.status) && WEXITSTATUS(p.status) == 0) {
+        program = cache_from_image(p.image, p.size, p.hash, p.len);
+        if (program) serve_install(p.hash, p.len, program);
+    }
+    free(p.image);
+    serve_run(listen_fd, p.conn, p.fds, p.cwd, p.path, p.src, program);
+    free(p.cwd);
+    free(p.path);
+}
+
+static int serve_main(const char *sock_path, const char *cache_dir) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof addr.sun_path) { fprintf(stderr, "serve: socket path too long\n"); return 1; }
+    strcpy(addr.sun_path, sock_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) { perror("socket"); return 1; }
+    unlink(sock_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0 || listen(listen_fd, 64) != 0) {
+        perror(sock_path);
+        close(listen_fd);
+        return 1;
+    }
+    if (pipe(g_sigchld_pipe) != 0) { perror("pipe"); return 1; }
+    fcntl(g_sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(g_sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = serve_on_sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+#ifndef KC_NO_GRAPHICS
+    kc_load_graphics();   /* só o dlopen; SDL_Init fica pro graphics.init de cada script */
+#endif
+#ifndef KC_NO_NETWORK
+    /* curl aquecido: os filhos herdam o handle pronto */
+    if (kc_load_network() && curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK) g_curl_handle = curl_easy_init();
+#endif
+
+    fprintf(stderr, "koalcode: serving on %s\n", sock_path);
+    struct pollfd *pfd = NULL;
+    size_t pfd_cap = 0;
+    while (1) {
+        /* [0] = accept, [1] = SIGCHLD, [2..] = pedidos chegando, depois as análises */
+        if (pfd_cap < 2 + g_serve_nconns + g_serve_nparses) {
+            pfd_cap = 2 + (g_serve_nconns + g_serve_nparses) * 2;
+            pfd = realloc(pfd, pfd_cap * sizeof *pfd);
+        }
+        pfd[0] = (struct pollfd){ listen_fd, POLLIN, 0 };
+        pfd[1] = (struct pollfd){ g_sigchld_pipe[0], POLLIN, 0 };
+        double now = kc_now(), next = -1;
+        for (size_t i = 0; i < g_serve_nconns; ++i) {
+            pfd[2 + i] = (struct pollfd){ g_serve_conns[i].conn, POLLIN, 0 };
+            if (next < 0 || g_serve_conns[i].deadline < next) next = g_serve_conns[i].deadline;
+        }
+        size_t nconns = g_serve_nconns, nparses = g_serve_nparses;
+        for (size_t i = 0; i < nparses; ++i)
+            pfd[2 + nconns + i] = (struct pollfd){ g_serve_parses[i].fd, POLLIN, 0 };
+        size_t npoll = 2 + nconns + nparses;
+        int timeout = next < 0 ? -1 : next <= now ? 0 : (int)((next - now) * 1000) + 1;
+        if (poll(pfd, npoll, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (pfd[1].revents & POLLIN) {
+            char drain[64];
+            while (read(g_sigchld_pipe[0], drain, sizeof drain) > 0) {}
+            serve_finish_jobs();
+        }
+        /* de trás pra frente: remover i só mexe em quem já foi visto.
+           Análises antes dos pedidos: pedido novo pode abrir análise nova */
+        for (size_t i = nparses; i-- > 0; ) {
+            if (pfd[2 + nconns + i].revents && serve_parse_recv(&g_serve_parses[i]))
+                serve_parse_done(i, listen_fd);
+        }
+        now = kc_now();
+        for (size_t i = nconns; i-- > 0; ) {
+            ServeConn *c = &g_serve_conns[i];
+            if (!pfd[2 + i].revents) {
+                if (now >= c->deadline) {
+                    fprintf(stderr, "serve: request timed out\n");
+                    serve_conn_remove(i, 1);
+                }
+                continue;
+            }
+            int closed = serve_conn_recv(c) < 0;
+            char cwd[PATH_MAX], path[PATH_MAX];
+            char *src = NULL;
+            size_t len = 0;
+            int state = serve_conn_parse(c, cwd, path, sizeof path, &src, &len);
+            if (state == 0 && !closed && now < c->deadline) continue;
+            if (state <= 0) {
+                if (state == 0) fprintf(stderr, closed ? "serve: incomplete request\n" : "serve: request timed out\n");
+                serve_conn_remove(i, 1);
+                continue;
+            }
+            int conn = c->conn, fds[3] = { c->fds[0], c->fds[1], c->fds[2] };
+            serve_conn_remove(i, 0);
+            fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);   /* o filho escreve nela */
+            serve_handle(listen_fd, conn, fds, cwd, path, src, len, cache_dir);
+        }
+        if (pfd[0].revents & POLLIN) {
+            int conn = accept(listen_fd, NULL, NULL);
+            if (conn < 0) continue;
+            fcntl(conn, F_SETFD, FD_CLOEXEC);
+            fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+            if (g_serve_nconns == g_serve_conns_cap) {
+                g_serve_conns_cap = g_serve_conns_cap ? g_serve_conns_cap * 2 : 16;
+                g_serve_conns = realloc(g_serve_conns, g_serve_conns_cap * sizeof(ServeConn));
+            }
+            g_serve_conns[g_serve_nconns++] = (ServeConn){ conn, { -1, -1, -1 }, NULL, 0, 0, kc_now() + KC_SERVE_TIMEOUT };
+        }
+    }
+    free(pfd);
+    close(listen_fd);
+    unlink(sock_path);
+    return 1;
+}
+
+/* cliente do --serve: manda o caminho e os próprios stdin/stdout/stderr */
+static int client_main(const char *sock_path, const char *script) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof addr.sun_path) { fprintf(stderr, "client: socket path too long\n"); return 1; }
+    strcpy(addr.sun_path, sock_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof addr) != 0) { perror(sock_path); return 1; }
+
+    char cwd[PATH_MAX], path[PATH_MAX];
+    if (!getcwd(cwd, sizeof cwd)) cwd[0] = '\0';
+    if (!realpath(script, path)) { perror(script); return 1; }
+    char header[2 * PATH_MAX + 16];
+    int hlen = snprintf(header, sizeof header, "CWD %s\nRUN %s\n", cwd, path);
+
+    int fds[3] = { 0, 1, 2 };
+    union { struct cmsghdr h; char buf[CMSG_SPACE(sizeof fds)]; } ctrl;
+    memset(&ctrl, 0, sizeof ctrl);
+    struct iovec iov = { header, (size_t)hlen };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof ctrl.buf;
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(c), fds, sizeof fds);
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != hlen) { perror("sendmsg"); return 1; }
+
+    /* a saída do script vai direto pros nossos fds; aqui só chega o EXIT */
+    char buf[256];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof buf - 1 && (n = recv(sock, buf + len, sizeof buf - 1 - len, 0)) > 0) len += (size_t)n;
+    buf[len] = '\0';
+    close(sock);
+    char *exit_line = strstr(buf, "EXIT ");
+    if (!exit_line) { fprintf(stderr, "client: server closed the connection\n"); return 1; }
+    return atoi(exit_line + 5);
+}
+
+/*=====================================================================
+ * 9.   MAIN (melhor parte kk)
+ *===================================================================== */
+
+int main(int argc, char **argv) {
+    const char *script = NULL;
+    const char *serve_path = NULL, *client_path = NULL;
+    int use_cache = 0, linger = 0, profile = 0, stats = 0;
+    const char *env_headless = getenv("KOALCODE_HEADLESS");
+    g_headless = env_headless && *env_headless && strcmp(env_headless, "0") != 0;
+    g_dump_path = getenv("KOALCODE_DUMP_FRAMES");
+    if (g_dump_path && !*g_dump_path) g_dump_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) g_headless = 1;
+        else if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc) g_dump_path = argv[++i];
+        else if (strcmp(argv[i], "--cache") == 0) use_cache = 1;
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) serve_path = argv[++i];
+        else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) client_path = argv[++i];
+        else if (strcmp(argv[i], "--linger") == 0) linger = 1;
+        else if (strcmp(argv[i], "--profile") == 0) profile = 1;
+        else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+        else if (strcmp(argv[i], "--jit") == 0) g_jit = 1;
+        else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) { profile = 1; g_prof_out = argv[++i]; }
+        else if (!script) script = argv[i];
+    }
+
+    char *cache_dir = NULL;
+    const char *env_cache = getenv("KOALCODE_CACHE_DIR");
+    if (env_cache && *env_cache) cache_dir = strdup(env_cache);
+    else if (use_cache) cache_dir = cache_default_dir();
+
+#ifndef KC_JIT
+    if (g_jit) {
+        fprintf(stderr, "--jit: not available on this platform, interpreting\n");
+        g_jit = 0;
+    }
+#endif
+
+    if (serve_path) return serve_main(serve_path, cache_dir);
+    if (!script) {
+        fprintf(stderr, "Uso: %s [--headless] [--dump-frames arquivo.ppm] [--cache] [--linger]\n"
+                        "          [--profile] [--profile-out pilhas.folded] [--stats] [--jit] <arquivo.kc>\n"
+                        "     %s --serve <socket>\n"
+                        "     %s --client <socket> <arquivo.kc>\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (client_path) return client_main(client_path, script);
+
+    size_t len;
+    char *src = read_source(script, &len);
+    if (!src) return 1;
+    g_script_name = script;
+    g_source = src;
+    Node **program = parse_source(src, len, cache_dir);
+    free(cache_dir);
+    if (!program) { free(src); return 1; }
+    optimize_program(program);
+
+    if (profile) prof_start(src, len);
+#ifndef KC_NO_STATS
+    if (stats) atexit(stats_report);   /* depois do --profile no stderr */
+#else
+    if (stats) fprintf(stderr, "--stats: built without stats support\n");
+#endif
+    int rc = run_program(program);
+    prof_report();
+
+    free_program(program);
+    g_source = NULL;
+    free(src);
+
+    /* antigo sleep(1) da saída: agora só com --linger (janela de terminal que fecha sozinha) */
+    if (linger) sleep(1);
+    return rc;
+}